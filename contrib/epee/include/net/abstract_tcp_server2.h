@@ -42,6 +42,7 @@
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 
@@ -59,6 +60,8 @@
 #include "../../../../src/p2p/network_throttle-detail.hpp"
 
 #define ABSTRACT_SERVER_SEND_QUE_MAX_COUNT 1000
+#define ABSTRACT_SERVER_SEND_QUE_FULL_TIMEOUT_MS 5000 // close the connection if its send queue stays full this long
+#define ABSTRACT_SERVER_SEND_QUE_HARD_MAX_COUNT (2 * ABSTRACT_SERVER_SEND_QUE_MAX_COUNT) // past this, refuse and close without waiting
 
 namespace epee
 {
@@ -117,6 +120,8 @@ namespace net_utils
     //----------------- i_service_endpoint ---------------------
     virtual bool do_send(const void* ptr, size_t cb); ///< (see do_send from i_service_endpoint)
     virtual bool do_send_chunk(const void* ptr, size_t cb); ///< will send (or queue) a part of data
+    virtual bool do_send_shared(const void* head_ptr, size_t head_cb, const shared_buffer& data, t_send_priority priority); ///< (see do_send_shared from i_service_endpoint)
+    bool do_send_chunks(std::list<send_que_entry>&& chunks); ///< queues the parts of one message together
     virtual bool close();
     virtual bool call_run_once_service_io();
     virtual bool request_callback();
@@ -133,6 +138,15 @@ namespace net_utils
     /// Handle completion of a write operation.
     void handle_write(const boost::system::error_code& e, size_t cb);
 
+    /// Read again, now or after a rate limit delay on m_read_delay_timer.
+    void start_read(std::size_t bytes_transferred);
+    void handle_read_delay(const boost::system::error_code& e, std::size_t bytes_transferred);
+
+    /// Write the front of m_send_que, now or after a rate limit delay on
+    /// m_write_delay_timer. Call with m_send_que_lock held.
+    void start_write();
+    void handle_write_delay(const boost::system::error_code& e);
+
     /// Buffer for incoming data.
     boost::array<char, 8192> buffer_;
     //boost::array<char, 1024> buffer_;
@@ -156,6 +170,11 @@ namespace net_utils
     std::mutex m_throttle_speed_in_mutex;
     std::mutex m_throttle_speed_out_mutex;
 
+    // rate limiting waits on these rather than sleeping in the io threads
+    boost::asio::deadline_timer m_read_delay_timer;
+    boost::asio::deadline_timer m_write_delay_timer;
+    std::chrono::steady_clock::time_point m_send_que_full_since; // when m_send_que went over ABSTRACT_SERVER_SEND_QUE_MAX_COUNT
+
 	public:
 			void setRpcStation();
   };
@@ -81,7 +81,9 @@ PRAGMA_WARNING_DISABLE_VS(4355)
 		m_pfilter( pfilter ),
 		m_connection_type( connection_type ),
 		m_throttle_speed_in("speed_in", "throttle_speed_in"),
-		m_throttle_speed_out("speed_out", "throttle_speed_out")
+		m_throttle_speed_out("speed_out", "throttle_speed_out"),
+		m_read_delay_timer(io_service),
+		m_write_delay_timer(io_service)
   {
     _info_c("net/sleepRPC", "test, connection constructor set m_connection_type="<<m_connection_type);
   }
@@ -274,31 +276,9 @@ PRAGMA_WARNING_DISABLE_VS(4355)
 			context.m_current_speed_down = m_throttle_speed_in.get_current_speed();
 		}
     
-    {
-			CRITICAL_REGION_LOCAL(	epee::net_utils::network_throttle_manager::network_throttle_manager::m_lock_get_global_throttle_in );
-			epee::net_utils::network_throttle_manager::network_throttle_manager::get_global_throttle_in().handle_trafic_exact(bytes_transferred * 1024);
-		}
+		if (speed_limit_is_enabled())
+			count_recv(bytes_transferred);
 
-		double delay=0; // will be calculated - how much we should sleep to obey speed limit etc
-
-
-		if (speed_limit_is_enabled()) {
-			do // keep sleeping if we should sleep
-			{
-				{ //_scope_dbg1("CRITICAL_REGION_LOCAL");
-					CRITICAL_REGION_LOCAL(	epee::net_utils::network_throttle_manager::m_lock_get_global_throttle_in );
-					delay = epee::net_utils::network_throttle_manager::get_global_throttle_in().get_sleep_time_after_tick( bytes_transferred ); // decission from global throttle
-				}
-				
-				delay *= 0.5;
-				if (delay > 0) {
-					long int ms = (long int)(delay * 100);
-					epee::net_utils::data_logger::get_instance().add_data("sleep_down", ms);
-					std::this_thread::sleep_for(std::chrono::milliseconds(ms));
-				}
-			} while(delay > 0);
-		} // any form of sleeping
-		
       //_info("[sock " << socket_.native_handle() << "] RECV " << bytes_transferred);
       logger_handle_net_read(bytes_transferred);
       context.m_last_recv = time(NULL);
@@ -319,12 +299,7 @@ PRAGMA_WARNING_DISABLE_VS(4355)
           shutdown();
       }else
       {
-        socket_.async_read_some(boost::asio::buffer(buffer_),
-          strand_.wrap(
-            boost::bind(&connection<t_protocol_handler>::handle_read, connection<t_protocol_handler>::shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred)));
-        //_info("[sock " << socket_.native_handle() << "]Async read requested.");
+        start_read(bytes_transferred);
       }
     }else
     {
@@ -343,6 +318,41 @@ PRAGMA_WARNING_DISABLE_VS(4355)
   }
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
+  void connection<t_protocol_handler>::start_read(std::size_t bytes_transferred)
+  {
+    auto self = connection<t_protocol_handler>::shared_from_this();
+    if (speed_limit_is_enabled())
+    {
+      // over the download limit: wait on a timer instead of holding this io thread
+      double delay = get_recv_delay(bytes_transferred);
+      if (delay > 0)
+      {
+        m_read_delay_timer.expires_from_now(boost::posix_time::milliseconds((long int)(delay * 1000)));
+        m_read_delay_timer.async_wait(strand_.wrap(
+          boost::bind(&connection<t_protocol_handler>::handle_read_delay, self, boost::asio::placeholders::error, bytes_transferred)));
+        return;
+      }
+    }
+
+    socket_.async_read_some(boost::asio::buffer(buffer_),
+      strand_.wrap(
+        boost::bind(&connection<t_protocol_handler>::handle_read, self,
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred)));
+    //_info("[sock " << socket_.native_handle() << "]Async read requested.");
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  void connection<t_protocol_handler>::handle_read_delay(const boost::system::error_code& e, std::size_t bytes_transferred)
+  {
+    TRY_ENTRY();
+    if (e || m_was_shutdown)
+      return;
+    start_read(bytes_transferred);
+    CATCH_ENTRY_L0("connection<t_protocol_handler>::handle_read_delay", void());
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
   bool connection<t_protocol_handler>::call_run_once_service_io()
   {
     TRY_ENTRY();
@@ -450,9 +460,58 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     CATCH_ENTRY_L0("connection<t_protocol_handler>::do_send", false);
 	} // do_send()
 
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  bool connection<t_protocol_handler>::do_send_shared(const void* head_ptr, size_t head_cb, const shared_buffer& data, t_send_priority priority)
+  {
+    TRY_ENTRY();
+    // Use safe_shared_from_this, because of this is public method and it can be called on the object being deleted
+    auto self = safe_shared_from_this();
+    if (!self) return false;
+    if (m_was_shutdown) return false;
+
+    // split into chunks as do_send() does, but each refers to a slice of data
+    const size_t chunksize_good = 1024 * 32;
+    const bool allow_split = (m_connection_type == e_connection_type_RPC) ? false : true; // do not split RPC data
+
+    // the chunks are queued together, so that a message of a higher class
+    // may go ahead of this one but never in the middle of it
+    std::list<send_que_entry> chunks(1);
+    send_que_entry& first = chunks.front();
+    first.head.assign((const char*)head_ptr, head_cb);
+    first.data = data;
+    first.data_size = data->size();
+    first.priority = priority;
+    first.message_start = true;
+    if (allow_split && head_cb + data->size() > 2 * chunksize_good)
+      first.data_size = std::min(chunksize_good, data->size());
+    size_t pos = first.data_size;
+
+    while (pos < data->size())
+    {
+      chunks.emplace_back();
+      send_que_entry& chunk = chunks.back();
+      chunk.data = data;
+      chunk.data_offset = pos;
+      chunk.data_size = std::min(chunksize_good, data->size() - pos);
+      chunk.priority = priority;
+      pos += chunk.data_size;
+    }
+    return do_send_chunks(std::move(chunks));
+
+    CATCH_ENTRY_L0("connection<t_protocol_handler>::do_send_shared", false);
+  }
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
   bool connection<t_protocol_handler>::do_send_chunk(const void* ptr, size_t cb)
+  {
+    std::list<send_que_entry> chunks(1);
+    chunks.front().head.assign((const char*)ptr, cb);
+    return do_send_chunks(std::move(chunks));
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  bool connection<t_protocol_handler>::do_send_chunks(std::list<send_que_entry>&& chunks)
   {
     TRY_ENTRY();
     // Use safe_shared_from_this, because of this is public method and it can be called on the object being deleted
@@ -461,6 +520,9 @@ PRAGMA_WARNING_DISABLE_VS(4355)
       return false;
     if(m_was_shutdown)
       return false;
+    size_t cb = 0;
+    BOOST_FOREACH(const send_que_entry& chunk, chunks)
+      cb += chunk.size();
     {
 		CRITICAL_REGION_LOCAL(m_throttle_speed_out_mutex);
 		m_throttle_speed_out.handle_trafic_exact(cb);
@@ -472,79 +534,63 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     context.m_send_cnt += cb;
     //some data should be wrote to stream
     //request complete
-    
-		if (speed_limit_is_enabled()) {
-			sleep_before_packet(cb, 1, 1);
-		}
 
     epee::critical_region_t<decltype(m_send_que_lock)> send_guard(m_send_que_lock); // *** critical ***
-    long int retry=0;
-    const long int retry_limit = 5*4;
-    while (m_send_que.size() > ABSTRACT_SERVER_SEND_QUE_MAX_COUNT)
+    if (m_send_que.size() + chunks.size() > ABSTRACT_SERVER_SEND_QUE_HARD_MAX_COUNT)
     {
-        retry++;
-
-        /* if ( ::cryptonote::core::get_is_stopping() ) { // TODO re-add fast stop
-            _fact("ABORT queue wait due to stopping");
-            return false; // aborted
-        }*/
-
-        long int ms = 250 + (rand()%50);
-        _info_c("net/sleep", "Sleeping because QUEUE is FULL, in " << __FUNCTION__ << " for " << ms << " ms before packet_size="<<cb); // XXX debug sleep
-        boost::this_thread::sleep(boost::posix_time::milliseconds( ms ) );
-        _dbg1("sleep for queue: " << ms);
-
-        if (retry > retry_limit) {
+        // the grace period below must not let the queue grow without bound
+        send_guard.unlock();
+        _erro("send que size is more than ABSTRACT_SERVER_SEND_QUE_HARD_MAX_COUNT(" << ABSTRACT_SERVER_SEND_QUE_HARD_MAX_COUNT << "), shutting down connection");
+        close();
+        return false;
+    }
+    if (m_send_que.size() > ABSTRACT_SERVER_SEND_QUE_MAX_COUNT)
+    {
+        // the peer (or our rate limit) is not draining the queue; give it some
+        // time, but never block the caller waiting for it
+        const auto now = std::chrono::steady_clock::now();
+        if (m_send_que_full_since == std::chrono::steady_clock::time_point())
+            m_send_que_full_since = now;
+        else if (now - m_send_que_full_since > std::chrono::milliseconds(ABSTRACT_SERVER_SEND_QUE_FULL_TIMEOUT_MS))
+        {
             send_guard.unlock();
-            _erro("send que size is more than ABSTRACT_SERVER_SEND_QUE_MAX_COUNT(" << ABSTRACT_SERVER_SEND_QUE_MAX_COUNT << "), shutting down connection");
-            //	_dbg1_c("net/sleep", "send que size is more than ABSTRACT_SERVER_SEND_QUE_MAX_COUNT(" << ABSTRACT_SERVER_SEND_QUE_MAX_COUNT << "), shutting down connection");
+            _erro("send que size is more than ABSTRACT_SERVER_SEND_QUE_MAX_COUNT(" << ABSTRACT_SERVER_SEND_QUE_MAX_COUNT << ") for too long, shutting down connection");
             close();
             return false;
         }
     }
+    else
+    {
+        m_send_que_full_since = std::chrono::steady_clock::time_point();
+    }
 
-    m_send_que.resize(m_send_que.size()+1);
-    m_send_que.back().assign((const char*)ptr, cb);
-    
-    if(m_send_que.size() > 1)
-    { // active operation should be in progress, nothing to do, just wait last operation callback
-        auto size_now = cb;
-        _info_c("net/out/size", "do_send() NOW just queues: packet="<<size_now<<" B, is added to queue-size="<<m_send_que.size());
-        //do_send_handler_delayed( ptr , size_now ); // (((H))) // empty function
+    if(!m_send_que.empty())
+    { // active operation should be in progress, just wait last operation callback
+        auto pos = m_send_que.end();
+        const send_que_entry& first = chunks.front();
+        if (first.message_start)
+        {
+          // go ahead of queued messages of a lower class; the front is being written
+          pos = std::next(m_send_que.begin());
+          while (pos != m_send_que.end() && !(pos->message_start && pos->priority < first.priority))
+            ++pos;
+        }
+        m_send_que.splice(pos, chunks);
+        _info_c("net/out/size", "do_send() NOW just queues: packet="<<cb<<" B, is added to queue-size="<<m_send_que.size());
       
       LOG_PRINT_L4("[sock " << socket_.native_handle() << "] Async send requested " << m_send_que.front().size());
     }
     else
     { // no active operation
-
-        if(m_send_que.size()!=1)
-        {
-            _erro("Looks like no active operations, but send que size != 1!!");
-            return false;
-        }
-
-        auto size_now = m_send_que.front().size();
-        _dbg1_c("net/out/size", "do_send() NOW SENSD: packet="<<size_now<<" B");
-        if (speed_limit_is_enabled())
-			do_send_handler_write( ptr , size_now ); // (((H)))
-
-        ASRT( size_now == m_send_que.front().size() );
-        boost::asio::async_write(socket_, boost::asio::buffer(m_send_que.front().data(), size_now ) ,
-                                 //strand_.wrap(
-                                 boost::bind(&connection<t_protocol_handler>::handle_write, self, _1, _2)
-                                 //)
-                                 );
-        //_dbg3("(chunk): " << size_now);
-        //logger_handle_net_write(size_now);
-        //_info("[sock " << socket_.native_handle() << "] Async send requested " << m_send_que.front().size());
+        m_send_que.splice(m_send_que.end(), chunks);
+        _dbg1_c("net/out/size", "do_send() NOW SENSD: packet="<<m_send_que.front().size()<<" B");
+        start_write();
     }
-    
-    //do_send_handler_stop( ptr , cb ); // empty function
 
     return true;
 
     CATCH_ENTRY_L0("connection<t_protocol_handler>::do_send", false);
-  } // do_send_chunk
+  } // do_send_chunks
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
   bool connection<t_protocol_handler>::shutdown()
@@ -553,6 +599,10 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     boost::system::error_code ignored_ec;
     socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
     m_was_shutdown = true;
+    CRITICAL_REGION_BEGIN(m_send_que_lock);
+    m_read_delay_timer.cancel(ignored_ec);
+    m_write_delay_timer.cancel(ignored_ec);
+    CRITICAL_REGION_END();
     m_protocol_handler.release_protocol();
     return true;
   }
@@ -596,10 +646,6 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     }
     logger_handle_net_write(cb);
 
-		if (speed_limit_is_enabled()) {
-			sleep_before_packet(cb, 1, 1);
-		}
-
     bool do_shutdown = false;
     CRITICAL_REGION_BEGIN(m_send_que_lock);
     if(m_send_que.empty())
@@ -618,17 +664,8 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     }else
     {
       //have more data to send
-		auto size_now = m_send_que.front().size();
-		_dbg1_c("net/out/size", "handle_write() NOW SENDS: packet="<<size_now<<" B" <<", from  queue size="<<m_send_que.size());
-		if (speed_limit_is_enabled())
-			do_send_handler_write_from_queue(e, m_send_que.front().size() , m_send_que.size()); // (((H)))
-		ASRT( size_now == m_send_que.front().size() );
-		boost::asio::async_write(socket_, boost::asio::buffer(m_send_que.front().data(), size_now) , 
-        // strand_.wrap(
-          boost::bind(&connection<t_protocol_handler>::handle_write, connection<t_protocol_handler>::shared_from_this(), _1, _2)
-				// )
-        );
-      //_dbg3("(normal)" << size_now);
+		_dbg1_c("net/out/size", "handle_write() NOW SENDS: packet="<<m_send_que.front().size()<<" B" <<", from  queue size="<<m_send_que.size());
+		start_write();
     }
     CRITICAL_REGION_END();
 
@@ -638,6 +675,45 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     }
     CATCH_ENTRY_L0("connection<t_protocol_handler>::handle_write", void());
   }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  void connection<t_protocol_handler>::start_write()
+  {
+    auto self = connection<t_protocol_handler>::shared_from_this();
+    if (speed_limit_is_enabled())
+    {
+      // over the upload limit: leave the queue as it is and come back on a
+      // timer. New blocks are not held back by what bulk traffic used up, but
+      // still count towards the limit
+      const send_que_entry& front = m_send_que.front();
+      double delay = front.priority < e_send_priority_block ? get_send_delay(front.size()) : 0;
+      if (delay > 0)
+      {
+        m_write_delay_timer.expires_from_now(boost::posix_time::milliseconds((long int)(delay * 1000)));
+        m_write_delay_timer.async_wait(
+          boost::bind(&connection<t_protocol_handler>::handle_write_delay, self, boost::asio::placeholders::error));
+        return;
+      }
+      count_send(front.size());
+    }
+
+    boost::asio::async_write(socket_, m_send_que.front().buffers(),
+      boost::bind(&connection<t_protocol_handler>::handle_write, self,
+        boost::asio::placeholders::error,
+        boost::asio::placeholders::bytes_transferred));
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  void connection<t_protocol_handler>::handle_write_delay(const boost::system::error_code& e)
+  {
+    TRY_ENTRY();
+    if (e || m_was_shutdown)
+      return;
+    CRITICAL_REGION_LOCAL(m_send_que_lock);
+    if (!m_send_que.empty())
+      start_write();
+    CATCH_ENTRY_L0("connection<t_protocol_handler>::handle_write_delay", void());
+  }
 
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
@@ -184,6 +184,22 @@
   return true;\
 }
 
+#define MAP_JON_RPC_WE_IF(method_name, callback_f, command_type, cond) \
+    else if(callback_name == method_name && (cond)) \
+{ \
+  PREPARE_OBJECTS_FROM_JSON(command_type) \
+  epee::json_rpc::error_response fail_resp = AUTO_VAL_INIT(fail_resp); \
+  fail_resp.jsonrpc = "2.0"; \
+  fail_resp.id = req.id; \
+  if(!callback_f(req.params, resp.result, fail_resp.error)) \
+  { \
+    epee::serialization::store_t_to_json(static_cast<epee::json_rpc::error_response&>(fail_resp), response_info.m_body); \
+    return true; \
+  } \
+  FINALIZE_OBJECTS_TO_JSON(method_name) \
+  return true;\
+}
+
 #define MAP_JON_RPC_WERI(method_name, callback_f, command_type) \
     else if(callback_name == method_name) \
 { \
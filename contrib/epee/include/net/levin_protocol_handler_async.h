@@ -30,7 +30,9 @@
 #include <boost/interprocess/detail/atomic.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 
+#include <algorithm>
 #include <atomic>
+#include <map>
 
 #include "levin_base.h"
 #include "misc_language.h"
@@ -56,6 +58,7 @@ class async_protocol_handler_config
   typedef boost::unordered_map<boost::uuids::uuid, async_protocol_handler<t_connection_context>* > connections_map;
   critical_section m_connects_lock;
   connections_map m_connects;
+  std::map<int, net_utils::t_send_priority> m_command_priorities; // set up before any connection, read without lock
 
   void add_connection(async_protocol_handler<t_connection_context>* pc);
   void del_connection(async_protocol_handler<t_connection_context>* pc);
@@ -76,12 +79,15 @@ public:
   int invoke_async(int command, const std::string& in_buff, boost::uuids::uuid connection_id, callback_t cb, size_t timeout = LEVIN_DEFAULT_TIMEOUT_PRECONFIGURED);
 
   int notify(int command, const std::string& in_buff, boost::uuids::uuid connection_id);
+  int notify(int command, const net_utils::shared_buffer& in_buff, boost::uuids::uuid connection_id);
   bool close(boost::uuids::uuid connection_id);
   bool update_connection_context(const t_connection_context& contxt);
   bool request_callback(boost::uuids::uuid connection_id);
   template<class callback_t>
   bool foreach_connection(callback_t cb);
   size_t get_connections_count();
+  void set_command_priority(int command, net_utils::t_send_priority priority);
+  net_utils::t_send_priority get_command_priority(int command) const;
 
   async_protocol_handler_config():m_pcommands_handler(NULL), m_max_packet_size(LEVIN_DEFAULT_MAX_PACKET_SIZE)
   {}
@@ -124,7 +130,8 @@ public:
   config_type& m_config;
   t_connection_context& m_connection_context;
 
-  std::string m_cache_in_buffer;
+  std::string m_cache_in_buffer; // the start of a header split across reads
+  std::string m_cache_in_body; // the start of a body split across reads
   stream_state m_state;
 
   int32_t m_oponent_protocol_ver;
@@ -320,133 +327,96 @@ public:
       return false;
     }
 
-    if(m_cache_in_buffer.size() +  cb > m_config.m_max_packet_size)
+    if(m_cache_in_buffer.size() + m_cache_in_body.size() +  cb > m_config.m_max_packet_size)
     {
       LOG_ERROR_CC(m_connection_context, "Maximum packet size exceed!, m_max_packet_size = " << m_config.m_max_packet_size 
-                          << ", packet received " << m_cache_in_buffer.size() +  cb 
+                          << ", packet received " << m_cache_in_buffer.size() + m_cache_in_body.size() +  cb 
                           << ", connection will be closed.");
       return false;
     }
 
-    m_cache_in_buffer.append((const char*)ptr, cb);
-
+    // packets are framed where they lie in ptr, only the part of a header
+    // or body which runs past its end is kept, and each body is copied just
+    // once, into the string handed to the handler
+    const char* data = (const char*)ptr;
+    size_t left = cb;
     bool is_continue = true;
     while(is_continue)
     {
       switch(m_state)
       {
       case stream_state_body:
-        if(m_cache_in_buffer.size() < m_current_head.m_cb)
-        {
-          is_continue = false;
-          break;
-        }
         {
-          std::string buff_to_invoke;
-          if(m_cache_in_buffer.size()  == m_current_head.m_cb)
-            buff_to_invoke.swap(m_cache_in_buffer);
-          else
+          const size_t needed = (size_t)m_current_head.m_cb - m_cache_in_body.size();
+          if(left < needed)
           {
-            buff_to_invoke.assign(m_cache_in_buffer, 0, (std::string::size_type)m_current_head.m_cb);
-            m_cache_in_buffer.erase(0, (std::string::size_type)m_current_head.m_cb);
-          }
-
-          bool is_response = (m_oponent_protocol_ver == LEVIN_PROTOCOL_VER_1 && m_current_head.m_flags&LEVIN_PACKET_RESPONSE);
-
-          LOG_PRINT_CC_L4(m_connection_context, "LEVIN_PACKET_RECIEVED. [len=" << m_current_head.m_cb 
-            << ", flags" << m_current_head.m_flags 
-            << ", r?=" << m_current_head.m_have_to_return_data 
-            <<", cmd = " << m_current_head.m_command 
-            << ", v=" << m_current_head.m_protocol_version);
-
-          if(is_response)
-          {//response to some invoke 
-
-            epee::critical_region_t<decltype(m_invoke_response_handlers_lock)> invoke_response_handlers_guard(m_invoke_response_handlers_lock);
-            if(!m_invoke_response_handlers.empty())
-            {//async call scenario
-              boost::shared_ptr<invoke_response_handler_base> response_handler = m_invoke_response_handlers.front();
-              bool timer_cancelled = response_handler->cancel_timer();
-               // Don't pop handler, to avoid destroying it
-              if(timer_cancelled)
-                m_invoke_response_handlers.pop_front();
-              invoke_response_handlers_guard.unlock();
-
-              if(timer_cancelled)
-                response_handler->handle(m_current_head.m_command, buff_to_invoke, m_connection_context);
-            }
-            else
+            if(left)
             {
-              invoke_response_handlers_guard.unlock();
-              //use sync call scenario
-              if(!boost::interprocess::ipcdetail::atomic_read32(&m_wait_count) && !boost::interprocess::ipcdetail::atomic_read32(&m_close_called))
-              {
-                LOG_ERROR_CC(m_connection_context, "no active invoke when response came, wtf?");
-                return false;
-              }else
-              {
-                CRITICAL_REGION_BEGIN(m_local_inv_buff_lock);
-                buff_to_invoke.swap(m_local_inv_buff);
-                buff_to_invoke.clear();
-                m_invoke_result_code = m_current_head.m_return_code;
-                CRITICAL_REGION_END();
-                boost::interprocess::ipcdetail::atomic_write32(&m_invoke_buf_ready, 1);
-              }
+              // the head only claims the size, so do not trust it with more
+              // than a capped reserve; past that the buffer grows as bytes
+              // actually arrive
+              if(m_cache_in_body.empty())
+                m_cache_in_body.reserve(std::min<size_t>(m_current_head.m_cb, LEVIN_INITIAL_BODY_RESERVE));
+              m_cache_in_body.append(data, left);
             }
-          }else
+            is_continue = false;
+            break;
+          }
+
+          std::string buff_to_invoke;
+          if(m_cache_in_body.empty())
+            buff_to_invoke.assign(data, needed);
+          else
           {
-            if(m_current_head.m_have_to_return_data)
-            {
-              std::string return_buff;
-              m_current_head.m_return_code = m_config.m_pcommands_handler->invoke(
-                                                                  m_current_head.m_command, 
-                                                                  buff_to_invoke, 
-                                                                  return_buff, 
-                                                                  m_connection_context);
-              m_current_head.m_cb = return_buff.size();
-              m_current_head.m_have_to_return_data = false;
-              m_current_head.m_protocol_version = LEVIN_PROTOCOL_VER_1;
-              m_current_head.m_flags = LEVIN_PACKET_RESPONSE;
-              std::string send_buff((const char*)&m_current_head, sizeof(m_current_head));
-              send_buff += return_buff;
-              CRITICAL_REGION_BEGIN(m_send_lock);
-              if(!m_pservice_endpoint->do_send(send_buff.data(), send_buff.size()))
-                return false;
-              CRITICAL_REGION_END();
-              LOG_PRINT_CC_L4(m_connection_context, "LEVIN_PACKET_SENT. [len=" << m_current_head.m_cb 
-                << ", flags" << m_current_head.m_flags 
-                << ", r?=" << m_current_head.m_have_to_return_data 
-                <<", cmd = " << m_current_head.m_command 
-                << ", ver=" << m_current_head.m_protocol_version);
-            }
-            else
-              m_config.m_pcommands_handler->notify(m_current_head.m_command, buff_to_invoke, m_connection_context);
+            m_cache_in_body.append(data, needed);
+            buff_to_invoke.swap(m_cache_in_body);
           }
+          data += needed;
+          left -= needed;
+          m_state = stream_state_head;
+
+          if(!handle_packet(buff_to_invoke))
+            return false;
         }
-        m_state = stream_state_head;
         break;
       case stream_state_head:
         {
-          if(m_cache_in_buffer.size() < sizeof(bucket_head2))
+          if(m_cache_in_buffer.empty() && left >= sizeof(bucket_head2))
+          {
+            memcpy(&m_current_head, data, sizeof(bucket_head2));
+            data += sizeof(bucket_head2);
+            left -= sizeof(bucket_head2);
+          }
+          else
           {
-            if(m_cache_in_buffer.size() >= sizeof(uint64_t) && *((uint64_t*)m_cache_in_buffer.data()) != LEVIN_SIGNATURE)
+            const size_t n = std::min(sizeof(bucket_head2) - m_cache_in_buffer.size(), left);
+            m_cache_in_buffer.append(data, n);
+            data += n;
+            left -= n;
+            if(m_cache_in_buffer.size() < sizeof(bucket_head2))
             {
-              LOG_ERROR_CC(m_connection_context, "Signature mismatch, connection will be closed");
-              return false;
+              uint64_t signature;
+              if(m_cache_in_buffer.size() >= sizeof(signature))
+              {
+                memcpy(&signature, m_cache_in_buffer.data(), sizeof(signature));
+                if(signature != LEVIN_SIGNATURE)
+                {
+                  LOG_ERROR_CC(m_connection_context, "Signature mismatch, connection will be closed");
+                  return false;
+                }
+              }
+              is_continue = false;
+              break;
             }
-            is_continue = false;
-            break;
+            memcpy(&m_current_head, m_cache_in_buffer.data(), sizeof(bucket_head2));
+            m_cache_in_buffer.clear();
           }
 
-          bucket_head2* phead = (bucket_head2*)m_cache_in_buffer.data();
-          if(LEVIN_SIGNATURE != phead->m_signature)
+          if(LEVIN_SIGNATURE != m_current_head.m_signature)
           {
             LOG_ERROR_CC(m_connection_context, "Signature mismatch, connection will be closed");
             return false;
           }
-          m_current_head = *phead;
-
-          m_cache_in_buffer.erase(0, sizeof(bucket_head2));
           m_state = stream_state_body;
           m_oponent_protocol_ver = m_current_head.m_protocol_version;
           if(m_current_head.m_cb > m_config.m_max_packet_size)
@@ -466,6 +436,88 @@ public:
 
     return true;
   }
+  //------------------------------------------------------------------------------------------
+  // queues head and body as one message, in the send queue class set for its command
+  bool send_message(const bucket_head2& head, const net_utils::shared_buffer& body)
+  {
+    return m_pservice_endpoint->do_send_shared(&head, sizeof(head), body, m_config.get_command_priority(head.m_command));
+  }
+  //------------------------------------------------------------------------------------------
+  // hands a received packet, whose header is m_current_head, to its handler
+  bool handle_packet(std::string& buff_to_invoke)
+  {
+    bool is_response = (m_oponent_protocol_ver == LEVIN_PROTOCOL_VER_1 && m_current_head.m_flags&LEVIN_PACKET_RESPONSE);
+
+    LOG_PRINT_CC_L4(m_connection_context, "LEVIN_PACKET_RECIEVED. [len=" << m_current_head.m_cb 
+      << ", flags" << m_current_head.m_flags 
+      << ", r?=" << m_current_head.m_have_to_return_data 
+      <<", cmd = " << m_current_head.m_command 
+      << ", v=" << m_current_head.m_protocol_version);
+
+    if(is_response)
+    {//response to some invoke 
+
+      epee::critical_region_t<decltype(m_invoke_response_handlers_lock)> invoke_response_handlers_guard(m_invoke_response_handlers_lock);
+      if(!m_invoke_response_handlers.empty())
+      {//async call scenario
+        boost::shared_ptr<invoke_response_handler_base> response_handler = m_invoke_response_handlers.front();
+        bool timer_cancelled = response_handler->cancel_timer();
+         // Don't pop handler, to avoid destroying it
+        if(timer_cancelled)
+          m_invoke_response_handlers.pop_front();
+        invoke_response_handlers_guard.unlock();
+
+        if(timer_cancelled)
+          response_handler->handle(m_current_head.m_command, buff_to_invoke, m_connection_context);
+      }
+      else
+      {
+        invoke_response_handlers_guard.unlock();
+        //use sync call scenario
+        if(!boost::interprocess::ipcdetail::atomic_read32(&m_wait_count) && !boost::interprocess::ipcdetail::atomic_read32(&m_close_called))
+        {
+          LOG_ERROR_CC(m_connection_context, "no active invoke when response came, wtf?");
+          return false;
+        }else
+        {
+          CRITICAL_REGION_BEGIN(m_local_inv_buff_lock);
+          buff_to_invoke.swap(m_local_inv_buff);
+          buff_to_invoke.clear();
+          m_invoke_result_code = m_current_head.m_return_code;
+          CRITICAL_REGION_END();
+          boost::interprocess::ipcdetail::atomic_write32(&m_invoke_buf_ready, 1);
+        }
+      }
+    }else
+    {
+      if(m_current_head.m_have_to_return_data)
+      {
+        std::string return_buff;
+        m_current_head.m_return_code = m_config.m_pcommands_handler->invoke(
+                                                            m_current_head.m_command, 
+                                                            buff_to_invoke, 
+                                                            return_buff, 
+                                                            m_connection_context);
+        m_current_head.m_cb = return_buff.size();
+        m_current_head.m_have_to_return_data = false;
+        m_current_head.m_protocol_version = LEVIN_PROTOCOL_VER_1;
+        m_current_head.m_flags = LEVIN_PACKET_RESPONSE;
+        CRITICAL_REGION_BEGIN(m_send_lock);
+        if(!send_message(m_current_head, boost::make_shared<std::string>(std::move(return_buff))))
+          return false;
+        CRITICAL_REGION_END();
+        LOG_PRINT_CC_L4(m_connection_context, "LEVIN_PACKET_SENT. [len=" << m_current_head.m_cb 
+          << ", flags" << m_current_head.m_flags 
+          << ", r?=" << m_current_head.m_have_to_return_data 
+          <<", cmd = " << m_current_head.m_command 
+          << ", ver=" << m_current_head.m_protocol_version);
+      }
+      else
+        m_config.m_pcommands_handler->notify(m_current_head.m_command, buff_to_invoke, m_connection_context);
+    }
+
+    return true;
+  }
 
   bool after_init_connection()
   {
@@ -515,14 +567,7 @@ public:
       boost::interprocess::ipcdetail::atomic_write32(&m_invoke_buf_ready, 0);
       CRITICAL_REGION_BEGIN(m_send_lock);
       CRITICAL_REGION_LOCAL1(m_invoke_response_handlers_lock);
-      if(!m_pservice_endpoint->do_send(&head, sizeof(head)))
-      {
-        LOG_ERROR_CC(m_connection_context, "Failed to do_send");
-        err_code = LEVIN_ERROR_CONNECTION;
-        break;
-      }
-
-      if(!m_pservice_endpoint->do_send(in_buff.data(), (int)in_buff.size()))
+      if(!send_message(head, boost::make_shared<std::string>(in_buff)))
       {
         LOG_ERROR_CC(m_connection_context, "Failed to do_send");
         err_code = LEVIN_ERROR_CONNECTION;
@@ -572,13 +617,7 @@ public:
 
     boost::interprocess::ipcdetail::atomic_write32(&m_invoke_buf_ready, 0);
     CRITICAL_REGION_BEGIN(m_send_lock);
-    if(!m_pservice_endpoint->do_send(&head, sizeof(head)))
-    {
-      LOG_ERROR_CC(m_connection_context, "Failed to do_send");
-      return LEVIN_ERROR_CONNECTION;
-    }
-
-    if(!m_pservice_endpoint->do_send(in_buff.data(), (int)in_buff.size()))
+    if(!send_message(head, boost::make_shared<std::string>(in_buff)))
     {
       LOG_ERROR_CC(m_connection_context, "Failed to do_send");
       return LEVIN_ERROR_CONNECTION;
@@ -638,15 +677,47 @@ public:
     head.m_protocol_version = LEVIN_PROTOCOL_VER_1;
     head.m_flags = LEVIN_PACKET_REQUEST;
     CRITICAL_REGION_BEGIN(m_send_lock);
-    if(!m_pservice_endpoint->do_send(&head, sizeof(head)))
+    if(!send_message(head, boost::make_shared<std::string>(in_buff)))
     {
       LOG_ERROR_CC(m_connection_context, "Failed to do_send()");
       return -1;
     }
+    CRITICAL_REGION_END();
+    LOG_PRINT_CC_L4(m_connection_context, "LEVIN_PACKET_SENT. [len=" << head.m_cb << 
+      ", f=" << head.m_flags << 
+      ", r?=" << head.m_have_to_return_data <<
+      ", cmd = " << head.m_command << 
+      ", ver=" << head.m_protocol_version);
+
+    return 1;
+  }
 
-    if(!m_pservice_endpoint->do_send(in_buff.data(), (int)in_buff.size()))
+  int notify(int command, const net_utils::shared_buffer& in_buff)
+  {
+    misc_utils::auto_scope_leave_caller scope_exit_handler = misc_utils::create_scope_leave_handler(
+                          boost::bind(&async_protocol_handler::finish_outer_call, this));
+
+    if(m_deletion_initiated)
+      return LEVIN_ERROR_CONNECTION_DESTROYED;
+
+    CRITICAL_REGION_LOCAL(m_call_lock);
+
+    if(m_deletion_initiated)
+      return LEVIN_ERROR_CONNECTION_DESTROYED;
+
+    bucket_head2 head = {0};
+    head.m_signature = LEVIN_SIGNATURE;
+    head.m_have_to_return_data = false;
+    head.m_cb = in_buff->size();
+
+    head.m_command = command;
+    head.m_protocol_version = LEVIN_PROTOCOL_VER_1;
+    head.m_flags = LEVIN_PACKET_REQUEST;
+    CRITICAL_REGION_BEGIN(m_send_lock);
+    // in_buff is queued as is, shared with whichever other connections it goes to
+    if(!send_message(head, in_buff))
     {
-      LOG_ERROR_CC(m_connection_context, "Failed to do_send()");
+      LOG_ERROR_CC(m_connection_context, "Failed to do_send_shared()");
       return -1;
     }
     CRITICAL_REGION_END();
@@ -774,6 +845,27 @@ int async_protocol_handler_config<t_connection_context>::notify(int command, con
 }
 //------------------------------------------------------------------------------------------
 template<class t_connection_context>
+int async_protocol_handler_config<t_connection_context>::notify(int command, const net_utils::shared_buffer& in_buff, boost::uuids::uuid connection_id)
+{
+  async_protocol_handler<t_connection_context>* aph;
+  int r = find_and_lock_connection(connection_id, aph);
+  return LEVIN_OK == r ? aph->notify(command, in_buff) : r;
+}
+//------------------------------------------------------------------------------------------
+template<class t_connection_context>
+void async_protocol_handler_config<t_connection_context>::set_command_priority(int command, net_utils::t_send_priority priority)
+{
+  m_command_priorities[command] = priority;
+}
+//------------------------------------------------------------------------------------------
+template<class t_connection_context>
+net_utils::t_send_priority async_protocol_handler_config<t_connection_context>::get_command_priority(int command) const
+{
+  auto it = m_command_priorities.find(command);
+  return it == m_command_priorities.end() ? net_utils::e_send_priority_handshake : it->second;
+}
+//------------------------------------------------------------------------------------------
+template<class t_connection_context>
 bool async_protocol_handler_config<t_connection_context>::close(boost::uuids::uuid connection_id)
 {
   CRITICAL_REGION_LOCAL(m_connects_lock);
@@ -30,6 +30,7 @@
 #define _NET_UTILS_BASE_H_
 
 #include <boost/uuid/uuid.hpp>
+#include <boost/shared_ptr.hpp>
 #include "string_tools.h"
 
 #ifndef MAKE_IP
@@ -108,9 +109,29 @@ namespace net_utils
 	/************************************************************************/
 	/*                                                                      */
 	/************************************************************************/
+  // bytes queued by reference, possibly by many connections at once,
+  // e.g. a relayed block, so they must not change once shared
+  typedef boost::shared_ptr<const std::string> shared_buffer;
+
+  // classes of outgoing messages, lowest first: a message queued with
+  // do_send_shared() goes out ahead of those of a lower class still queued
+  enum t_send_priority
+  {
+    e_send_priority_bulk = 0,      // sync responses (blocks, chain entries)
+    e_send_priority_handshake = 1, // handshakes, pings, requests; the default
+    e_send_priority_tx = 2,        // transaction relay
+    e_send_priority_block = 3      // new block relay
+  };
+
 	struct i_service_endpoint
 	{
 		virtual bool do_send(const void* ptr, size_t cb)=0;
+    // sends head_ptr (copied) then data as one message, sharing data rather
+    // than copying it where possible
+    virtual bool do_send_shared(const void* head_ptr, size_t head_cb, const shared_buffer& data, t_send_priority priority)
+    {
+      return do_send(head_ptr, head_cb) && do_send(data->data(), data->size());
+    }
     virtual bool close()=0;
     virtual bool call_run_once_service_io()=0;
     virtual bool request_callback()=0;
@@ -1235,13 +1235,29 @@ void BlockchainBDB::unlock()
     check_open();
 }
 
-bool BlockchainBDB::block_exists(const crypto::hash& h) const
+bool BlockchainBDB::block_exists(const crypto::hash& h, uint64_t *height) const
 {
     LOG_PRINT_L3("BlockchainBDB::" << __func__);
     check_open();
 
     Dbt_copy<crypto::hash> key(h);
 
+    if (height)
+    {
+        Dbt_copy<uint32_t> result;
+        auto get_result = m_block_heights->get(DB_DEFAULT_TX, &key, &result, 0);
+        if (get_result == DB_NOTFOUND)
+        {
+            LOG_PRINT_L3("Block with hash " << epee::string_tools::pod_to_hex(h) << " not found in db");
+            return false;
+        }
+        else if (get_result)
+            throw0(DB_ERROR("DB error attempting to fetch block index from hash"));
+
+        *height = result - 1;
+        return true;
+    }
+
     auto get_result = m_block_heights->exists(DB_DEFAULT_TX, &key, 0);
     if (get_result == DB_NOTFOUND)
     {
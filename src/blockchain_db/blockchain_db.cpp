@@ -158,6 +158,33 @@ void BlockchainDB::pop_block(block& blk, std::vector<transaction>& txs)
   remove_transaction(get_transaction_hash(blk.miner_tx));
 }
 
+void BlockchainDB::pop_blocks(uint64_t nblocks, std::vector<std::pair<block, std::vector<transaction>>>& popped)
+{
+  popped.reserve(popped.size() + nblocks);
+  for (uint64_t i = 0; i < nblocks; ++i)
+  {
+    popped.emplace_back();
+    pop_block(popped.back().first, popped.back().second);
+  }
+}
+
+void BlockchainDB::has_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const
+{
+  spent.resize(key_images.size());
+  for (size_t i = 0; i < key_images.size(); ++i)
+    spent[i] = has_key_image(key_images[i]);
+}
+
+bool BlockchainDB::for_all_records(std::function<bool(const std::string& table, const std::string& key, const std::string& value)> f) const
+{
+  throw DB_ERROR("Raw record access not supported by this database type");
+}
+
+void BlockchainDB::append_records(const std::string& table, const std::vector<std::pair<std::string, std::string>>& records)
+{
+  throw DB_ERROR("Raw record access not supported by this database type");
+}
+
 bool BlockchainDB::is_open() const
 {
   return m_open;
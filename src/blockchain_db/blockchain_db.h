@@ -78,6 +78,10 @@
  *
  * vector<str>   get_filenames()
  *
+ *   Raw records, for snapshots:
+ *   bool        for_all_records(function)
+ *   void        append_records(table, records)
+ *
  * Blocks:
  *   bool        block_exists(hash)
  *   height      add_block(block, block_size, cumulative_difficulty, coins_generated, transactions)
@@ -97,6 +101,7 @@
  *   block       get_top_block()
  *   height      height()
  *   void        pop_block(block&, tx_list&)
+ *   void        pop_blocks(count, popped)
  *
  * Transactions:
  *   bool        tx_exists(hash)
@@ -116,6 +121,7 @@
  *
  * Spent Output Key Images:
  *   bool        has_key_image(key_image)
+ *   void        has_key_images(key_images, spent)
  *
  * Exceptions:
  *   DB_ERROR -- generic
@@ -397,8 +403,9 @@ public:
                             , const std::vector<transaction>& txs
                             );
 
-  // return true if a block with hash <h> exists in the blockchain
-  virtual bool block_exists(const crypto::hash& h) const = 0;
+  // return true if a block with hash <h> exists in the blockchain, and
+  // its height by reference if <height> is not NULL
+  virtual bool block_exists(const crypto::hash& h, uint64_t *height = NULL) const = 0;
 
   // return block with hash <h>
   virtual block get_block(const crypto::hash& h) const = 0;
@@ -437,7 +444,8 @@ public:
   // return vector of blocks in range <h1,h2> of height (inclusively)
   virtual std::vector<block> get_blocks_range(const uint64_t& h1, const uint64_t& h2) const = 0;
 
-  // return vector of block hashes in range <h1, h2> of height (inclusively)
+  // return vector of block hashes in range <h1, h2> of height (inclusively),
+  // throw if any of those heights is not in the db
   virtual std::vector<crypto::hash> get_hashes_range(const uint64_t& h1, const uint64_t& h2) const = 0;
 
   // return the hash of the top block on the chain
@@ -458,6 +466,15 @@ public:
   // those transactions.
   virtual void pop_block(block& blk, std::vector<transaction>& txs);
 
+  // pops the top <nblocks> blocks off the blockchain, as one db transaction
+  // where the backend supports it.
+  // Appends the popped blocks (top first) and their associated transactions
+  // to <popped>, in the same form pop_block returns them.
+  //
+  // The default pops one block at a time; backends override it to collect
+  // the outputs and spent key images of all blocks and remove them in bulk.
+  virtual void pop_blocks(uint64_t nblocks, std::vector<std::pair<block, std::vector<transaction>>>& popped);
+
 
   // return true if a transaction with hash <h> exists
   virtual bool tx_exists(const crypto::hash& h) const = 0;
@@ -511,11 +528,33 @@ public:
   // returns true if key image <img> is present in spent key images storage
   virtual bool has_key_image(const crypto::key_image& img) const = 0;
 
+  // sets spent[i] to whether key_images[i] is present in spent key images
+  // storage, looking them all up in one read txn
+  //
+  // The default calls has_key_image for each.
+  virtual void has_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const;
+
   virtual bool for_all_key_images(std::function<bool(const crypto::key_image&)>) const = 0;
   virtual bool for_all_blocks(std::function<bool(uint64_t, const crypto::hash&, const cryptonote::block&)>) const = 0;
   virtual bool for_all_transactions(std::function<bool(const crypto::hash&, const cryptonote::transaction&)>) const = 0;
   virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const = 0;
 
+  // Calls <f> with the table name, key and value of every record in the
+  // database, all read within one read txn so they form a consistent
+  // snapshot. Records of a table come in that table's key order, as
+  // append_records expects them. Stops early and returns false if <f> does.
+  //
+  // The default throws, for backends without raw record access.
+  virtual bool for_all_records(std::function<bool(const std::string& table, const std::string& key, const std::string& value)> f) const;
+
+  // Writes <records> (key, value) to <table>, in one write txn. Records
+  // given in key order after any already in the table are appended without
+  // searching the table, so loading a whole snapshot into a fresh db is a
+  // sequential write; others are inserted normally.
+  //
+  // The default throws, for backends without raw record access.
+  virtual void append_records(const std::string& table, const std::vector<std::pair<std::string, std::string>>& records);
+
   // Hard fork related storage
   virtual void set_hard_fork_starting_height(uint8_t version, uint64_t height) = 0;
   virtual uint64_t get_hard_fork_starting_height(uint8_t version) const = 0;
@@ -30,6 +30,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/current_function.hpp>
+#include <boost/range/adaptor/reversed.hpp>
+#include <algorithm>
 #include <memory>  // std::unique_ptr
 #include <cstring>  // memcpy
 #include <random>
@@ -1336,7 +1338,7 @@ void BlockchainLMDB::unlock()
       auto_txn.commit(); \
   } while(0)
 
-bool BlockchainLMDB::block_exists(const crypto::hash& h) const
+bool BlockchainLMDB::block_exists(const crypto::hash& h, uint64_t *height) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
@@ -1346,7 +1348,8 @@ bool BlockchainLMDB::block_exists(const crypto::hash& h) const
   RCURSOR(block_heights);
 
   MDB_val_copy<crypto::hash> key(h);
-  auto get_result = mdb_cursor_get(m_cur_block_heights, &key, NULL, MDB_SET);
+  MDB_val result;
+  auto get_result = mdb_cursor_get(m_cur_block_heights, &key, &result, MDB_SET);
   if (get_result == MDB_NOTFOUND)
   {
     TXN_POSTFIX_RDONLY();
@@ -1356,6 +1359,9 @@ bool BlockchainLMDB::block_exists(const crypto::hash& h) const
   else if (get_result)
     throw0(DB_ERROR("DB error attempting to fetch block index from hash"));
 
+  if (height)
+    *height = *(const uint64_t *)result.mv_data;
+
   TXN_POSTFIX_RDONLY();
   return true;
 }
@@ -1600,12 +1606,33 @@ std::vector<crypto::hash> BlockchainLMDB::get_hashes_range(const uint64_t& h1, c
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
   std::vector<crypto::hash> v;
+  if (h2 < h1)
+    return v;
 
-  for (uint64_t height = h1; height <= h2; ++height)
+  TXN_PREFIX_RDONLY();
+  const mdb_txn_cursors *m_cursors = m_write_txn ? &m_wcursors : &m_tinfo->m_ti_rcursors;
+  RCURSOR(block_hashes);
+
+  // block hashes are keyed by consecutive heights, so the range is a single
+  // cursor sweep rather than one lookup per height
+  v.reserve(h2 - h1 + 1);
+  MDB_val_copy<uint64_t> key(h1);
+  MDB_val k = key, result;
+  auto get_result = mdb_cursor_get(m_cur_block_hashes, &k, &result, MDB_SET_KEY);
+  for (uint64_t height = h1; ; ++height)
   {
-    v.push_back(get_block_hash_from_height(height));
+    if (get_result == MDB_NOTFOUND || (get_result == 0 && *(const uint64_t *)k.mv_data != height))
+      throw0(BLOCK_DNE(std::string("Attempt to get hash from height ").append(boost::lexical_cast<std::string>(height)).append(" failed -- hash not in db").c_str()));
+    else if (get_result)
+      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve a block hash from the db: ", get_result).c_str()));
+
+    v.push_back(*(const crypto::hash*)result.mv_data);
+    if (height == h2)
+      break;
+    get_result = mdb_cursor_get(m_cur_block_hashes, &k, &result, MDB_NEXT);
   }
 
+  TXN_POSTFIX_RDONLY();
   return v;
 }
 
@@ -2011,6 +2038,63 @@ bool BlockchainLMDB::has_key_image(const crypto::key_image& img) const
   return false;
 }
 
+void BlockchainLMDB::has_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  spent.assign(key_images.size(), false);
+  if (key_images.empty())
+    return;
+
+  // visit the key images in the table's order, so the cursor only moves
+  // forward, and is not moved at all for repeats or when it is already on
+  // or past the next key image
+  std::vector<size_t> order(key_images.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&key_images](size_t a, size_t b) {
+    MDB_val va = {sizeof(crypto::key_image), (void*)&key_images[a]};
+    MDB_val vb = {sizeof(crypto::key_image), (void*)&key_images[b]};
+    return compare_hash32(&va, &vb) < 0;
+  });
+
+  TXN_PREFIX_RDONLY();
+  const mdb_txn_cursors *m_cursors = m_write_txn ? &m_wcursors : &m_tinfo->m_ti_rcursors;
+  RCURSOR(spent_keys);
+
+  MDB_val k;
+  bool at_end = false, positioned = false;
+  for (size_t i : order)
+  {
+    MDB_val target = {sizeof(crypto::key_image), (void*)&key_images[i]};
+    if (positioned && compare_hash32(&k, &target) >= 0)
+    {
+      spent[i] = compare_hash32(&k, &target) == 0;
+      continue;
+    }
+    if (at_end)
+      continue;
+
+    // k keeps the key the cursor is on, it is only moved once one is found
+    MDB_val found = target;
+    int result = mdb_cursor_get(m_cur_spent_keys, &found, NULL, MDB_SET_RANGE);
+    if (result == MDB_NOTFOUND)
+    {
+      // every key image left is past the last one in the table
+      at_end = true;
+      continue;
+    }
+    if (result)
+      throw0(DB_ERROR(lmdb_error("Failed to look up key images: ", result).c_str()));
+    k = found;
+    positioned = true;
+    spent[i] = compare_hash32(&k, &target) == 0;
+  }
+
+  TXN_POSTFIX_RDONLY();
+}
+
 bool BlockchainLMDB::for_all_key_images(std::function<bool(const crypto::key_image&)> f) const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -2162,6 +2246,145 @@ bool BlockchainLMDB::for_all_outputs(std::function<bool(uint64_t amount, const c
   return ret;
 }
 
+std::vector<std::pair<const char*, MDB_dbi>> BlockchainLMDB::get_tables() const
+{
+  return {
+    {LMDB_BLOCKS, m_blocks},
+    {LMDB_BLOCK_TIMESTAMPS, m_block_timestamps},
+    {LMDB_BLOCK_HEIGHTS, m_block_heights},
+    {LMDB_BLOCK_HASHES, m_block_hashes},
+    {LMDB_BLOCK_SIZES, m_block_sizes},
+    {LMDB_BLOCK_DIFFS, m_block_diffs},
+    {LMDB_BLOCK_COINS, m_block_coins},
+    {LMDB_TXS, m_txs},
+    {LMDB_TX_UNLOCKS, m_tx_unlocks},
+    {LMDB_TX_HEIGHTS, m_tx_heights},
+    {LMDB_TX_OUTPUTS, m_tx_outputs},
+    {LMDB_OUTPUT_TXS, m_output_txs},
+    {LMDB_OUTPUT_INDICES, m_output_indices},
+    {LMDB_OUTPUT_AMOUNTS, m_output_amounts},
+    {LMDB_OUTPUT_KEYS, m_output_keys},
+    {LMDB_SPENT_KEYS, m_spent_keys},
+    {LMDB_HF_STARTING_HEIGHTS, m_hf_starting_heights},
+    {LMDB_HF_VERSIONS, m_hf_versions},
+    {LMDB_PROPERTIES, m_properties},
+  };
+}
+
+bool BlockchainLMDB::for_all_records(std::function<bool(const std::string& table, const std::string& key, const std::string& value)> f) const
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+
+  TXN_PREFIX_RDONLY();
+
+  bool ret = true;
+  for (const auto &table: get_tables())
+  {
+    MDB_cursor *cur;
+    if (auto result = mdb_cursor_open(m_txn, table.second, &cur))
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to open cursor for ") + table.first + ": ", result).c_str()));
+
+    const std::string name(table.first);
+    MDB_val k;
+    MDB_val v;
+    MDB_cursor_op op = MDB_FIRST;
+    while (ret)
+    {
+      int result = mdb_cursor_get(cur, &k, &v, op);
+      op = MDB_NEXT;
+      if (result == MDB_NOTFOUND)
+        break;
+      if (result)
+      {
+        mdb_cursor_close(cur);
+        throw0(DB_ERROR(lmdb_error(std::string("Failed to enumerate records of ") + table.first + ": ", result).c_str()));
+      }
+      ret = f(name, std::string((const char*)k.mv_data, k.mv_size), std::string((const char*)v.mv_data, v.mv_size));
+    }
+    mdb_cursor_close(cur);
+    if (!ret)
+      break;
+  }
+
+  TXN_POSTFIX_RDONLY();
+
+  return ret;
+}
+
+void BlockchainLMDB::append_records(const std::string& table, const std::vector<std::pair<std::string, std::string>>& records)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  check_open();
+  if (m_write_txn != nullptr)
+    throw0(DB_ERROR("Attempted to append records with a write txn in progress"));
+
+  MDB_dbi dbi = 0;
+  bool found = false;
+  for (const auto &t: get_tables())
+  {
+    if (table == t.first)
+    {
+      dbi = t.second;
+      found = true;
+      break;
+    }
+  }
+  if (!found)
+    throw0(DB_ERROR(("Unknown table: " + table).c_str()));
+
+  // b-tree pages take more room than the raw records
+  uint64_t size = 0;
+  for (const auto &r: records)
+    size += r.first.size() + r.second.size();
+  if (need_resize(size * 2))
+    do_resize(std::max<uint64_t>(size * 2, 512 * (1 << 20)));
+
+  mdb_txn_safe txn;
+  if (auto result = mdb_txn_begin(m_env, NULL, 0, txn))
+    throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", result).c_str()));
+
+  unsigned int flags;
+  if (auto result = mdb_dbi_flags(txn, dbi, &flags))
+    throw0(DB_ERROR(lmdb_error("Failed to query table flags: ", result).c_str()));
+  const bool dupsort = flags & MDB_DUPSORT;
+
+  MDB_cursor *cur;
+  if (auto result = mdb_cursor_open(txn, dbi, &cur))
+    throw0(DB_ERROR(lmdb_error("Failed to open cursor: ", result).c_str()));
+
+  const std::string *prev_key = NULL;
+  for (const auto &r: records)
+  {
+    MDB_val k = {r.first.size(), (void*)r.first.data()};
+    MDB_val v = {r.second.size(), (void*)r.second.data()};
+
+    // MDB_APPEND refuses a key equal to the last one, so further values for
+    // the same key in a dupsort table go in as appended duplicates instead
+    const bool dup = dupsort && prev_key && *prev_key == r.first;
+    int result = mdb_cursor_put(cur, &k, &v, dup ? MDB_APPENDDUP : MDB_APPEND);
+    if (result == MDB_KEYEXIST)
+      result = mdb_cursor_put(cur, &k, &v, 0);
+    if (result)
+      throw0(DB_ERROR(lmdb_error(std::string("Failed to add record to ") + table + ": ", result).c_str()));
+    prev_key = &r.first;
+  }
+  mdb_cursor_close(cur);
+
+  MDB_stat db_stats;
+  if (mdb_stat(txn, m_blocks, &db_stats))
+    throw0(DB_ERROR("Failed to query m_blocks"));
+  const uint64_t height = db_stats.ms_entries;
+  if (mdb_stat(txn, m_output_indices, &db_stats))
+    throw0(DB_ERROR("Failed to query m_output_indices"));
+  const uint64_t num_outputs = db_stats.ms_entries;
+
+  txn.commit();
+
+  m_height = height;
+  m_num_outputs = num_outputs;
+}
+
 // batch_num_blocks: (optional) Used to check if resize needed before batch transaction starts.
 void BlockchainLMDB::batch_start(uint64_t batch_num_blocks)
 {
@@ -2441,26 +2664,181 @@ uint64_t BlockchainLMDB::add_block(const block& blk, const size_t& block_size, c
 }
 
 void BlockchainLMDB::pop_block(block& blk, std::vector<transaction>& txs)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+
+  std::vector<std::pair<block, std::vector<transaction>>> popped;
+  pop_blocks(1, popped);
+  blk = std::move(popped.front().first);
+  txs = std::move(popped.front().second);
+}
+
+// Removes the tx records of a popped tx right away, and hands back its key
+// images and <amount, global output index> pairs so pop_blocks can remove
+// those in sorted bulk passes once all blocks have been collected.
+void BlockchainLMDB::pop_transaction(const crypto::hash& tx_hash, const transaction& tx, std::vector<crypto::key_image>& k_images, std::vector<std::pair<uint64_t, uint64_t>>& amount_outputs)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  mdb_txn_cursors *m_cursors = &m_wcursors;
+  CURSOR(tx_outputs)
+
+  for (const txin_v& tx_input : tx.vin)
+  {
+    if (tx_input.type() == typeid(txin_to_key))
+      k_images.push_back(boost::get<txin_to_key>(tx_input).k_image);
+  }
+
+  MDB_val_copy<crypto::hash> val_h(tx_hash);
+  if (mdb_del(*m_write_txn, m_txs, &val_h, NULL))
+      throw1(TX_DNE("Attempting to remove transaction that isn't in the db"));
+  if (mdb_del(*m_write_txn, m_tx_unlocks, &val_h, NULL))
+      throw1(DB_ERROR("Failed to add removal of tx unlock time to db transaction"));
+  if (mdb_del(*m_write_txn, m_tx_heights, &val_h, NULL))
+      throw1(DB_ERROR("Failed to add removal of tx block height to db transaction"));
+
+  MDB_val v;
+  auto result = mdb_cursor_get(m_cur_tx_outputs, &val_h, &v, MDB_SET);
+  if (result == MDB_NOTFOUND)
+  {
+    LOG_PRINT_L1("tx has no outputs to remove: " << tx_hash);
+    return;
+  }
+  else if (result)
+    throw0(DB_ERROR(lmdb_error("DB error attempting to get tx outputs: ", result).c_str()));
+
+  mdb_size_t num_elems = 0;
+  mdb_cursor_count(m_cur_tx_outputs, &num_elems);
+  if (num_elems != tx.vout.size())
+    throw0(DB_ERROR("tx output count does not match its global output indices"));
+
+  // global output indices are sorted, so they follow vout order
+  for (uint64_t i = 0; i < num_elems; ++i)
+  {
+    if (i > 0)
+      mdb_cursor_get(m_cur_tx_outputs, &val_h, &v, MDB_NEXT_DUP);
+    amount_outputs.push_back(std::make_pair(tx.vout[i].amount, *(const uint64_t*)v.mv_data));
+  }
+
+  result = mdb_cursor_del(m_cur_tx_outputs, MDB_NODUPDATA);
+  if (result)
+    throw1(DB_ERROR(lmdb_error("Failed to add removal of tx outputs to db transaction: ", result).c_str()));
+}
+
+void BlockchainLMDB::pop_blocks(uint64_t nblocks, std::vector<std::pair<block, std::vector<transaction>>>& popped)
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  if (nblocks > m_height)
+    throw0(BLOCK_DNE("Attempting to pop more blocks than the blockchain has"));
+
   block_txn_start(false);
 
   uint64_t num_outputs = m_num_outputs;
+  uint64_t height = m_height;
+  size_t num_popped = popped.size();
   try
   {
-    BlockchainDB::pop_block(blk, txs);
-	block_txn_stop();
+    mdb_txn_cursors *m_cursors = &m_wcursors;
+    CURSOR(output_txs)
+    CURSOR(output_indices)
+    CURSOR(output_keys)
+    CURSOR(output_amounts)
+    CURSOR(spent_keys)
+
+    std::vector<crypto::key_image> k_images;
+    std::vector<std::pair<uint64_t, uint64_t>> amount_outputs;
+
+    popped.reserve(popped.size() + nblocks);
+    for (uint64_t i = 0; i < nblocks; ++i)
+    {
+      popped.emplace_back();
+      block& blk = popped.back().first;
+      std::vector<transaction>& txs = popped.back().second;
+
+      blk = get_top_block();
+      remove_block();
+      --m_height;
+
+      for (const auto& h : boost::adaptors::reverse(blk.tx_hashes))
+      {
+        txs.push_back(get_tx(h));
+        pop_transaction(h, txs.back(), k_images, amount_outputs);
+      }
+      pop_transaction(get_transaction_hash(blk.miner_tx), blk.miner_tx, k_images, amount_outputs);
+    }
+
+    // outputs are appended with increasing global indices, so the popped ones
+    // are exactly the top of the global index range
+    if (amount_outputs.size() > m_num_outputs)
+      throw0(DB_ERROR("Popped more outputs than the db has"));
+    const uint64_t first_output = m_num_outputs - amount_outputs.size();
+
+    for (uint64_t index = first_output; index < m_num_outputs; ++index)
+    {
+      MDB_val_copy<uint64_t> k(index);
+      MDB_val v;
+      MDB_cursor *cursors[] = { m_cur_output_indices, m_cur_output_txs, m_cur_output_keys };
+      for (MDB_cursor *cur : cursors)
+      {
+        auto result = mdb_cursor_get(cur, &k, &v, MDB_SET);
+        if (result == MDB_NOTFOUND)
+        {
+          LOG_PRINT_L0("Unexpected: global output index " << index << " not found");
+          continue;
+        }
+        else if (result)
+          throw0(DB_ERROR(lmdb_error("DB error attempting to get an output: ", result).c_str()));
+        if ((result = mdb_cursor_del(cur, 0)))
+          throw1(DB_ERROR(lmdb_error("Error adding removal of output to db transaction: ", result).c_str()));
+      }
+    }
+
+    // amount -> global index entries are dup-sorted, so each one is found by
+    // a direct lookup instead of scanning the amount's whole index list
+    std::sort(amount_outputs.begin(), amount_outputs.end());
+    for (const auto& ao : amount_outputs)
+    {
+      if (ao.second < first_output)
+        throw0(DB_ERROR("Popped output is not at the top of the global output index range"));
+      MDB_val_copy<uint64_t> k(ao.first);
+      MDB_val_copy<uint64_t> v(ao.second);
+      auto result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
+      if (result == MDB_NOTFOUND)
+        throw1(OUTPUT_DNE("Failed to find amount output index"));
+      else if (result)
+        throw0(DB_ERROR(lmdb_error("DB error attempting to get an output: ", result).c_str()));
+      if ((result = mdb_cursor_del(m_cur_output_amounts, 0)))
+        throw0(DB_ERROR(lmdb_error("Error deleting amount output index: ", result).c_str()));
+    }
+    m_num_outputs = first_output;
+
+    std::sort(k_images.begin(), k_images.end(), [](const crypto::key_image& a, const crypto::key_image& b) {
+      return memcmp(&a, &b, sizeof(a)) < 0;
+    });
+    for (const auto& k_image : k_images)
+    {
+      MDB_val_copy<crypto::key_image> k(k_image);
+      MDB_val v;
+      auto result = mdb_cursor_get(m_cur_spent_keys, &k, &v, MDB_SET);
+      if (result == MDB_NOTFOUND)
+        continue;
+      else if (result)
+        throw0(DB_ERROR(lmdb_error("DB error attempting to get a spent key image: ", result).c_str()));
+      if ((result = mdb_cursor_del(m_cur_spent_keys, 0)))
+        throw1(DB_ERROR("Error adding removal of key image to db transaction"));
+    }
+
+    block_txn_stop();
   }
   catch (...)
   {
     m_num_outputs = num_outputs;
-	block_txn_abort();
+    m_height = height;
+    popped.resize(num_popped);
+    block_txn_abort();
     throw;
   }
-
-  --m_height;
 }
 
 void BlockchainLMDB::get_output_tx_and_index_from_global(const std::vector<uint64_t> &global_indices,
@@ -2751,7 +3129,10 @@ uint64_t BlockchainLMDB::get_hard_fork_starting_height(uint8_t version) const
   MDB_val val_ret;
   auto result = mdb_get(m_txn, m_hf_starting_heights, &val_key, &val_ret);
   if (result == MDB_NOTFOUND)
+  {
+    TXN_POSTFIX_RDONLY();
     return std::numeric_limits<uint64_t>::max();
+  }
   if (result)
     throw0(DB_ERROR("Error attempting to retrieve a hard fork starting height from the db"));
 
@@ -186,7 +186,7 @@ public:
 
   virtual void unlock();
 
-  virtual bool block_exists(const crypto::hash& h) const;
+  virtual bool block_exists(const crypto::hash& h, uint64_t *height = NULL) const;
 
   virtual block get_block(const crypto::hash& h) const;
 
@@ -250,12 +250,16 @@ public:
   virtual std::vector<uint64_t> get_tx_amount_output_indices(const crypto::hash& h) const;
 
   virtual bool has_key_image(const crypto::key_image& img) const;
+  virtual void has_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const;
 
   virtual bool for_all_key_images(std::function<bool(const crypto::key_image&)>) const;
   virtual bool for_all_blocks(std::function<bool(uint64_t, const crypto::hash&, const cryptonote::block&)>) const;
   virtual bool for_all_transactions(std::function<bool(const crypto::hash&, const cryptonote::transaction&)>) const;
   virtual bool for_all_outputs(std::function<bool(uint64_t amount, const crypto::hash &tx_hash, size_t tx_idx)> f) const;
 
+  virtual bool for_all_records(std::function<bool(const std::string& table, const std::string& key, const std::string& value)> f) const;
+  virtual void append_records(const std::string& table, const std::vector<std::pair<std::string, std::string>>& records);
+
   virtual uint64_t add_block( const block& blk
                             , const size_t& block_size
                             , const difficulty_type& cumulative_difficulty
@@ -277,6 +281,8 @@ public:
 
   virtual void pop_block(block& blk, std::vector<transaction>& txs);
 
+  virtual void pop_blocks(uint64_t nblocks, std::vector<std::pair<block, std::vector<transaction>>>& popped);
+
   virtual bool can_thread_bulk_indices() const { return true; }
 private:
   void do_resize(uint64_t size_increase=0);
@@ -285,6 +291,9 @@ private:
   void check_and_resize_for_batch(uint64_t batch_num_blocks);
   uint64_t get_estimated_batch_size(uint64_t batch_num_blocks) const;
 
+  // every table, by name, in the order snapshots list them
+  std::vector<std::pair<const char*, MDB_dbi>> get_tables() const;
+
   virtual void add_block( const block& blk
                 , const size_t& block_size
                 , const difficulty_type& cumulative_difficulty
@@ -304,6 +313,8 @@ private:
 
   void remove_tx_outputs(const crypto::hash& tx_hash, const transaction& tx);
 
+  void pop_transaction(const crypto::hash& tx_hash, const transaction& tx, std::vector<crypto::key_image>& k_images, std::vector<std::pair<uint64_t, uint64_t>>& amount_outputs);
+
   void remove_output(const uint64_t& out_index, const uint64_t amount);
   void remove_amount_output_index(const uint64_t amount, const uint64_t global_output_index);
 
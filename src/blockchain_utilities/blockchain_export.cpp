@@ -88,7 +88,7 @@ int main(int argc, char* argv[])
   const command_line::arg_descriptor<std::string> arg_database = {
     "database", available_dbs.c_str(), default_db_type
   };
-  const command_line::arg_descriptor<bool> arg_blocks_dat = {"blocksdat", "Output in blocks.dat format", blocks_dat};
+  const command_line::arg_descriptor<bool> arg_blocks_dat = {"blocksdat", "Output in blocks.dat format (block ids for --fast-block-sync, checked against their transactions)", blocks_dat};
 
 
   command_line::add_arg(desc_cmd_sett, command_line::arg_data_dir, default_data_path.string());
@@ -155,7 +155,7 @@ int main(int argc, char* argv[])
   if (command_line::has_arg(vm, arg_output_file))
     output_file_path = boost::filesystem::path(command_line::get_arg(vm, arg_output_file));
   else
-    output_file_path = boost::filesystem::path(m_config_folder) / "export" / BLOCKCHAIN_RAW;
+    output_file_path = boost::filesystem::path(m_config_folder) / "export" / (opt_blocks_dat ? BLOCKS_DAT : BLOCKCHAIN_RAW);
   LOG_PRINT_L0("Export output file: " << output_file_path.string());
 
   // If we wanted to use the memory pool, we would set up a fake_core.
@@ -218,18 +218,18 @@ int pop_blocks(FakeCore& simple_core, int num_blocks)
     simple_core.batch_start();
 
   int quit = 0;
-  block popped_block;
-  std::vector<transaction> popped_txs;
+#if defined(BLOCKCHAIN_DB) && (BLOCKCHAIN_DB == DB_MEMORY)
   for (int i=0; i < num_blocks; ++i)
   {
-#if defined(BLOCKCHAIN_DB) && (BLOCKCHAIN_DB == DB_MEMORY)
     simple_core.m_storage.debug_pop_block_from_blockchain();
-#else
-    // simple_core.m_storage.pop_block_from_blockchain() is private, so call directly through db
-    simple_core.m_storage.get_db().pop_block(popped_block, popped_txs);
-#endif
     quit = 1;
   }
+#else
+  // simple_core.m_storage.pop_blocks_from_blockchain() is private, so call directly through db
+  std::vector<std::pair<block, std::vector<transaction>>> popped;
+  simple_core.m_storage.get_db().pop_blocks(num_blocks, popped);
+  quit = 1;
+#endif
 
 
 
@@ -0,0 +1,175 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "snapshot_file.h"
+#include "common/command_line.h"
+#include "common/util.h"
+#include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/lmdb/db_lmdb.h"
+#include "cryptonote_core/checkpoints_create.h"
+#include "version.h"
+
+namespace po = boost::program_options;
+using namespace epee; // log_space
+
+int main(int argc, char* argv[])
+{
+  uint32_t log_level = 0;
+
+  tools::sanitize_locale();
+
+  boost::filesystem::path default_data_path {tools::get_default_data_dir()};
+  boost::filesystem::path default_testnet_data_path {default_data_path / "testnet"};
+  boost::filesystem::path snapshot_file_path;
+
+  po::options_description desc_cmd_only("Command line options");
+  po::options_description desc_cmd_sett("Command line options and settings options");
+  const command_line::arg_descriptor<std::string> arg_snapshot_file = {"snapshot-file", "Specify snapshot file", "", true};
+  const command_line::arg_descriptor<uint32_t> arg_log_level  = {"log-level",  "", log_level};
+  const command_line::arg_descriptor<bool>     arg_testnet_on = {
+    "testnet"
+      , "Run on testnet."
+      , false
+  };
+  const command_line::arg_descriptor<bool> arg_import = {"import", "Load the snapshot into a new database instead of exporting one", false};
+
+  command_line::add_arg(desc_cmd_sett, command_line::arg_data_dir, default_data_path.string());
+  command_line::add_arg(desc_cmd_sett, command_line::arg_testnet_data_dir, default_testnet_data_path.string());
+  command_line::add_arg(desc_cmd_sett, arg_snapshot_file);
+  command_line::add_arg(desc_cmd_sett, arg_testnet_on);
+  command_line::add_arg(desc_cmd_sett, arg_log_level);
+  command_line::add_arg(desc_cmd_sett, arg_import);
+
+  command_line::add_arg(desc_cmd_only, command_line::arg_help);
+
+  po::options_description desc_options("Allowed options");
+  desc_options.add(desc_cmd_only).add(desc_cmd_sett);
+
+  po::variables_map vm;
+  bool r = command_line::handle_error_helper(desc_options, [&]()
+  {
+    po::store(po::parse_command_line(argc, argv, desc_options), vm);
+    po::notify(vm);
+    return true;
+  });
+  if (! r)
+    return 1;
+
+  if (command_line::get_arg(vm, command_line::arg_help))
+  {
+    std::cout << "Monero '" << MONERO_RELEASE_NAME << "' (v" << MONERO_VERSION_FULL << ")" << ENDL << ENDL;
+    std::cout << desc_options << std::endl;
+    return 1;
+  }
+
+  log_level = command_line::get_arg(vm, arg_log_level);
+
+  log_space::get_set_log_detalisation_level(true, log_level);
+  log_space::log_singletone::add_logger(LOGGER_CONSOLE, NULL, NULL);
+  LOG_PRINT_L0("Starting...");
+  LOG_PRINT_L0("Setting log level = " << log_level);
+
+  bool opt_testnet = command_line::get_arg(vm, arg_testnet_on);
+  bool opt_import = command_line::get_arg(vm, arg_import);
+
+  auto data_dir_arg = opt_testnet ? command_line::arg_testnet_data_dir : command_line::arg_data_dir;
+  std::string m_config_folder = command_line::get_arg(vm, data_dir_arg);
+
+  if (command_line::has_arg(vm, arg_snapshot_file))
+    snapshot_file_path = boost::filesystem::path(command_line::get_arg(vm, arg_snapshot_file));
+  else
+    snapshot_file_path = boost::filesystem::path(m_config_folder) / "export" / BLOCKCHAIN_SNAPSHOT;
+  LOG_PRINT_L0("Snapshot file: " << snapshot_file_path.string());
+
+  cryptonote::BlockchainDB* db = new cryptonote::BlockchainLMDB();
+  boost::filesystem::path folder(m_config_folder);
+  folder /= db->get_db_name();
+  const std::string filename = folder.string();
+
+  if (opt_import && boost::filesystem::exists(folder / "data.mdb"))
+  {
+    LOG_PRINT_RED_L0("Database already exists in " << filename << ", a snapshot can only be loaded into a new one");
+    delete db;
+    return 1;
+  }
+
+  LOG_PRINT_L0((opt_import ? "Creating" : "Loading") << " blockchain database in folder " << filename << " ...");
+  try
+  {
+    db->open(filename, opt_import ? 0 : MDB_RDONLY);
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_L0("Error opening database: " << e.what());
+    delete db;
+    return 1;
+  }
+
+  SnapshotFile snapshot;
+  try
+  {
+    if (opt_import)
+    {
+      cryptonote::checkpoints checkpoints;
+      if (!opt_testnet && !cryptonote::create_checkpoints(checkpoints))
+      {
+        LOG_PRINT_RED_L0("Failed to initialize checkpoints");
+        r = false;
+      }
+      else
+      {
+        LOG_PRINT_L0("Importing snapshot...");
+        r = snapshot.load_snapshot(db, snapshot_file_path, checkpoints);
+      }
+    }
+    else
+    {
+      LOG_PRINT_L0("Exporting snapshot...");
+      r = snapshot.store_snapshot(db, snapshot_file_path);
+    }
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_RED_L0("Error: " << e.what());
+    r = false;
+  }
+
+  db->close();
+  delete db;
+
+  if (!r)
+  {
+    if (opt_import)
+      LOG_PRINT_RED_L0("Snapshot import failed, delete " << filename << " before trying again");
+    else
+      LOG_PRINT_RED_L0("Snapshot export failed");
+    return 1;
+  }
+  LOG_PRINT_L0("Snapshot " << (opt_import ? "imported" : "exported") << " OK");
+  return 0;
+}
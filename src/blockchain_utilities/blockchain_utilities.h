@@ -48,4 +48,6 @@
 #define BUFFER_SIZE 1000000
 #define NUM_BLOCKS_PER_CHUNK 1
 #define BLOCKCHAIN_RAW "blockchain.raw"
+#define BLOCKS_DAT "blocks.dat"
+#define BLOCKCHAIN_SNAPSHOT "blockchain.snapshot"
 
@@ -148,10 +148,25 @@ bool BlocksdatFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
   {
     // this method's height refers to 0-based height (genesis block = height 0)
     crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
-    write_block(hash);
-    if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
-      num_blocks_written += NUM_BLOCKS_PER_CHUNK;
+    // a node syncing below this hash set trusts the txs each matching block
+    // commits to, so only embed ids whose block and txs are intact here
+    if (!m_blockchain_storage->get_block_by_hash(hash, b) || get_block_hash(b) != hash)
+    {
+      LOG_PRINT_RED_L0("Block " << hash << " at height " << m_cur_height << " is missing or does not hash to its id");
+      BlocksdatFile::close();
+      return false;
+    }
+    for (const auto& tx_hash : b.tx_hashes)
+    {
+      if (!m_blockchain_storage->have_tx(tx_hash))
+      {
+        LOG_PRINT_RED_L0("Transaction " << tx_hash << " of block " << hash << " at height " << m_cur_height << " not found");
+        BlocksdatFile::close();
+        return false;
+      }
     }
+    write_block(hash);
+    ++num_blocks_written;
     if (m_cur_height % progress_interval == 0) {
       std::cout << refresh_string;
       std::cout << "block " << m_cur_height << "/" << block_stop << std::flush;
@@ -0,0 +1,475 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "snapshot_file.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+#include "common/varint.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+
+
+using namespace cryptonote;
+using namespace epee;
+
+namespace
+{
+  const char snapshot_magic[8] = {'X', 'M', 'R', 'S', 'N', 'A', 'P', '\0'};
+  const uint32_t snapshot_version = 1;
+
+  // a chunk is written once its payload reaches chunk_size; one bigger than
+  // max_chunk_size can only come from a corrupt file
+  const size_t chunk_size = 1 << 20;
+  const size_t max_chunk_size = 64 << 20;
+
+  // records are handed to the db in batches of about this many bytes
+  const uint64_t records_batch_size = 64 << 20;
+
+  enum snapshot_entry : uint8_t
+  {
+    entry_table = 0,
+    entry_record = 1,
+    entry_end = 2
+  };
+
+  std::string refresh_string = "\r                                    \r";
+
+  void add_uint(std::string& s, uint64_t v, size_t bytes)
+  {
+    for (size_t i = 0; i < bytes; ++i)
+      s.push_back((char)((v >> (8 * i)) & 0xff));
+  }
+
+  bool get_uint(const std::string& s, size_t& pos, uint64_t& v, size_t bytes)
+  {
+    if (s.size() - pos < bytes)
+      return false;
+    v = 0;
+    for (size_t i = 0; i < bytes; ++i)
+      v |= ((uint64_t)(unsigned char)s[pos + i]) << (8 * i);
+    pos += bytes;
+    return true;
+  }
+
+  void add_blob(std::string& s, const std::string& blob)
+  {
+    tools::write_varint(std::back_inserter(s), blob.size());
+    s += blob;
+  }
+
+  bool get_blob(const std::string& s, size_t& pos, std::string& blob)
+  {
+    uint64_t size;
+    int read = tools::read_varint(s.begin() + pos, s.end(), size);
+    if (read <= 0)
+      return false;
+    pos += read;
+    if (s.size() - pos < size)
+      return false;
+    blob.assign(s, pos, size);
+    pos += size;
+    return true;
+  }
+
+  crypto::hash chain_checksum(const crypto::hash& prev, const std::string& payload)
+  {
+    crypto::hash data[2] = {prev, crypto::cn_fast_hash(payload.data(), payload.size())};
+    return crypto::cn_fast_hash(data, sizeof(data));
+  }
+}
+
+
+
+bool SnapshotFile::open_writer(const boost::filesystem::path& file_path)
+{
+  const boost::filesystem::path dir_path = file_path.parent_path();
+  if (!dir_path.empty())
+  {
+    if (boost::filesystem::exists(dir_path))
+    {
+      if (!boost::filesystem::is_directory(dir_path))
+      {
+        LOG_PRINT_RED_L0("export directory path is a file: " << dir_path);
+        return false;
+      }
+    }
+    else
+    {
+      if (!boost::filesystem::create_directory(dir_path))
+      {
+        LOG_PRINT_RED_L0("Failed to create directory " << dir_path);
+        return false;
+      }
+    }
+  }
+
+  m_writer.open(file_path.string(), std::ios_base::binary | std::ios_base::out | std::ios::trunc);
+  if (m_writer.fail())
+    return false;
+
+  std::string header(snapshot_magic, sizeof(snapshot_magic));
+  add_uint(header, snapshot_version, 4);
+  m_writer.write(header.data(), header.size());
+  m_checksum = crypto::cn_fast_hash(header.data(), header.size());
+  m_chunk.clear();
+  return !m_writer.fail();
+}
+
+bool SnapshotFile::write_chunk()
+{
+  std::string size;
+  add_uint(size, m_chunk.size(), 4);
+  m_checksum = chain_checksum(m_checksum, m_chunk);
+  m_writer.write(size.data(), size.size());
+  m_writer.write(m_chunk.data(), m_chunk.size());
+  m_writer.write(m_checksum.data, sizeof(m_checksum));
+  m_chunk.clear();
+  return !m_writer.fail();
+}
+
+bool SnapshotFile::close_writer()
+{
+  if (!m_chunk.empty() && !write_chunk())
+    return false;
+  m_writer.flush();
+  bool ok = !m_writer.fail();
+  m_writer.close();
+  return ok;
+}
+
+void SnapshotFile::add_table(const std::string& table)
+{
+  m_chunk.push_back(entry_table);
+  add_blob(m_chunk, table);
+}
+
+void SnapshotFile::add_record(const std::string& key, const std::string& value)
+{
+  m_chunk.push_back(entry_record);
+  add_blob(m_chunk, key);
+  add_blob(m_chunk, value);
+}
+
+bool SnapshotFile::store_snapshot(BlockchainDB* db, const boost::filesystem::path& output_file)
+{
+  if (!open_writer(output_file))
+  {
+    LOG_PRINT_RED_L0("failed to open snapshot file " << output_file);
+    return false;
+  }
+
+  // the height and top block come from the records themselves, so they
+  // match the rest of the snapshot even if the db is being written to
+  std::string current_table;
+  std::string top_block_blob;
+  uint64_t height = 0;
+  uint64_t num_records = 0;
+  bool ok = db->for_all_records([&](const std::string& table, const std::string& key, const std::string& value) {
+    if (table != current_table)
+    {
+      add_table(table);
+      current_table = table;
+      LOG_PRINT_L0(refresh_string << "exporting " << table);
+    }
+    add_record(key, value);
+    if (table == "blocks")
+    {
+      top_block_blob = value;
+      ++height;
+    }
+    if (++num_records % 100000 == 0)
+    {
+      std::cout << refresh_string;
+      std::cout << "records exported: " << num_records << std::flush;
+    }
+    if (m_chunk.size() >= chunk_size)
+      return write_chunk();
+    return true;
+  });
+  std::cout << refresh_string;
+  if (!ok)
+  {
+    LOG_PRINT_RED_L0("failed to write snapshot file " << output_file);
+    return false;
+  }
+
+  crypto::hash top_hash = null_hash;
+  if (height > 0)
+  {
+    block b;
+    if (!parse_and_validate_block_from_blob(top_block_blob, b))
+    {
+      LOG_PRINT_RED_L0("failed to parse top block");
+      return false;
+    }
+    top_hash = get_block_hash(b);
+  }
+  m_chunk.push_back(entry_end);
+  add_uint(m_chunk, height, 8);
+  m_chunk.append(top_hash.data, sizeof(top_hash));
+
+  if (!close_writer())
+  {
+    LOG_PRINT_RED_L0("failed to write snapshot file " << output_file);
+    return false;
+  }
+
+  LOG_PRINT_L0("Snapshot of " << num_records << " records exported, height " << height << ", top block " << top_hash);
+  return true;
+}
+
+bool SnapshotFile::open_reader(const boost::filesystem::path& file_path)
+{
+  m_reader.open(file_path.string(), std::ios_base::binary | std::ios_base::in);
+  if (m_reader.fail())
+  {
+    LOG_PRINT_RED_L0("failed to open snapshot file " << file_path);
+    return false;
+  }
+
+  std::string header(sizeof(snapshot_magic) + 4, '\0');
+  m_reader.read(&header[0], header.size());
+  if (m_reader.gcount() != (std::streamsize)header.size() || header.compare(0, sizeof(snapshot_magic), snapshot_magic, sizeof(snapshot_magic)))
+  {
+    LOG_PRINT_RED_L0("not a snapshot file: " << file_path);
+    return false;
+  }
+  size_t pos = sizeof(snapshot_magic);
+  uint64_t version;
+  get_uint(header, pos, version, 4);
+  if (version != snapshot_version)
+  {
+    LOG_PRINT_RED_L0("unsupported snapshot version " << version);
+    return false;
+  }
+  m_checksum = crypto::cn_fast_hash(header.data(), header.size());
+  return true;
+}
+
+bool SnapshotFile::read_chunk()
+{
+  std::string size_bytes(4, '\0');
+  m_reader.read(&size_bytes[0], size_bytes.size());
+  if (m_reader.gcount() != (std::streamsize)size_bytes.size())
+  {
+    LOG_PRINT_RED_L0("snapshot file is truncated");
+    return false;
+  }
+  size_t pos = 0;
+  uint64_t size;
+  get_uint(size_bytes, pos, size, 4);
+  if (size > max_chunk_size)
+  {
+    LOG_PRINT_RED_L0("snapshot chunk too large: " << size);
+    return false;
+  }
+
+  m_chunk.resize(size);
+  crypto::hash checksum;
+  m_reader.read(&m_chunk[0], size);
+  bool complete = m_reader.gcount() == (std::streamsize)size;
+  m_reader.read(checksum.data, sizeof(checksum));
+  if (!complete || m_reader.gcount() != sizeof(checksum))
+  {
+    LOG_PRINT_RED_L0("snapshot file is truncated");
+    return false;
+  }
+
+  m_checksum = chain_checksum(m_checksum, m_chunk);
+  if (checksum != m_checksum)
+  {
+    LOG_PRINT_RED_L0("snapshot checksum mismatch, the file is corrupt");
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotFile::flush_records(BlockchainDB* db)
+{
+  if (m_records.empty())
+    return true;
+  try
+  {
+    db->append_records(m_table, m_records);
+  }
+  catch (const std::exception& e)
+  {
+    LOG_PRINT_RED_L0("failed to load records into " << m_table << ": " << e.what());
+    return false;
+  }
+  m_records.clear();
+  m_records_size = 0;
+  return true;
+}
+
+bool SnapshotFile::load_snapshot(BlockchainDB* db, const boost::filesystem::path& input_file, const checkpoints& checkpoints)
+{
+  if (db->height() > 0)
+  {
+    LOG_PRINT_RED_L0("a snapshot can only be loaded into an empty database");
+    return false;
+  }
+
+  if (!open_reader(input_file))
+    return false;
+
+  m_table.clear();
+  m_records.clear();
+  m_records_size = 0;
+
+  uint64_t num_records = 0;
+  uint64_t height = 0;
+  crypto::hash top_hash = null_hash;
+  bool done = false;
+  while (!done)
+  {
+    if (!read_chunk())
+      return false;
+
+    size_t pos = 0;
+    while (pos < m_chunk.size() && !done)
+    {
+      const uint8_t type = m_chunk[pos++];
+      bool malformed = false;
+      if (type == entry_table)
+      {
+        std::string table;
+        malformed = !get_blob(m_chunk, pos, table);
+        if (!malformed)
+        {
+          if (!flush_records(db))
+            return false;
+          m_table = table;
+          LOG_PRINT_L0(refresh_string << "importing " << m_table);
+        }
+      }
+      else if (type == entry_record && !m_table.empty())
+      {
+        std::pair<std::string, std::string> record;
+        malformed = !get_blob(m_chunk, pos, record.first) || !get_blob(m_chunk, pos, record.second);
+        if (!malformed)
+        {
+          m_records_size += record.first.size() + record.second.size();
+          m_records.push_back(std::move(record));
+          if (m_records_size >= records_batch_size && !flush_records(db))
+            return false;
+          if (++num_records % 100000 == 0)
+          {
+            std::cout << refresh_string;
+            std::cout << "records imported: " << num_records << std::flush;
+          }
+        }
+      }
+      else if (type == entry_end)
+      {
+        malformed = !get_uint(m_chunk, pos, height, 8) || m_chunk.size() - pos < sizeof(top_hash);
+        if (!malformed)
+        {
+          memcpy(top_hash.data, m_chunk.data() + pos, sizeof(top_hash));
+          pos += sizeof(top_hash);
+          done = true;
+        }
+      }
+      else
+      {
+        malformed = true;
+      }
+
+      if (malformed)
+      {
+        LOG_PRINT_RED_L0("malformed snapshot entry");
+        return false;
+      }
+    }
+  }
+  std::cout << refresh_string;
+  if (!flush_records(db))
+    return false;
+
+  if (db->height() != height)
+  {
+    LOG_PRINT_RED_L0("loaded chain does not match the snapshot: height " << db->height() << ", expected " << height);
+    return false;
+  }
+
+  // the blocks were not verified, and the hash index came with them, so
+  // every block hash is worked out again from the block itself; from the
+  // top down, each must be the one the block above it names as previous,
+  // and match every checkpoint it reaches
+  const std::map<uint64_t, crypto::hash>& points = checkpoints.get_points();
+  uint64_t checkpointed_height = 0;
+  crypto::hash expected_hash = top_hash;
+  try
+  {
+    for (uint64_t h = height; h-- > 0; )
+    {
+      const block b = db->get_block_from_height(h);
+      const crypto::hash hash = get_block_hash(b);
+      if (hash != expected_hash)
+      {
+        LOG_PRINT_RED_L0("snapshot block " << h << " hashes to " << hash << ", expected " << expected_hash);
+        return false;
+      }
+      if (db->get_block_hash_from_height(h) != hash)
+      {
+        LOG_PRINT_RED_L0("snapshot block " << h << " does not match the hash index: " << hash);
+        return false;
+      }
+      auto point = points.find(h);
+      if (point != points.end())
+      {
+        if (point->second != hash)
+        {
+          LOG_PRINT_RED_L0("snapshot block " << h << " does not match the checkpoint: " << point->second);
+          return false;
+        }
+        checkpointed_height = std::max(checkpointed_height, h + 1);
+      }
+      expected_hash = b.prev_id;
+      if ((height - h) % 100000 == 0)
+      {
+        std::cout << refresh_string;
+        std::cout << "blocks checked: " << height - h << std::flush;
+      }
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cout << refresh_string;
+    LOG_PRINT_RED_L0("failed to read snapshot blocks: " << e.what());
+    return false;
+  }
+  std::cout << refresh_string;
+
+  LOG_PRINT_L0("Snapshot of " << num_records << " records imported, height " << height << ", top block " << top_hash);
+  if (checkpointed_height < height)
+    LOG_PRINT_YELLOW("The last " << height - checkpointed_height << " blocks are past the last checkpoint and were not checked", LOG_LEVEL_0);
+  return true;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crypto/hash.h"
+#include "blockchain_db/blockchain_db.h"
+#include "cryptonote_core/checkpoints.h"
+
+#include "blockchain_utilities.h"
+
+
+// A snapshot is a raw copy of every record of a BlockchainDB, so a node can
+// be set up by loading it in sequence instead of verifying every block.
+//
+// Layout: an 8 byte magic and a 4 byte version, then chunks, each a 4 byte
+// payload size, the payload, and a 32 byte checksum chaining the payload to
+// the previous chunk (or the header, for the first one). Payloads hold a
+// stream of entries: a table name, after which records belong to that
+// table, a key/value record, or, at the very end, the height and top block
+// hash of the snapshot. All integers are little endian; lengths are varints.
+class SnapshotFile
+{
+public:
+
+  bool store_snapshot(cryptonote::BlockchainDB* db, const boost::filesystem::path& output_file);
+  bool load_snapshot(cryptonote::BlockchainDB* db, const boost::filesystem::path& input_file,
+      const cryptonote::checkpoints& checkpoints);
+
+protected:
+
+  bool open_writer(const boost::filesystem::path& file_path);
+  bool write_chunk();
+  bool close_writer();
+
+  bool open_reader(const boost::filesystem::path& file_path);
+  bool read_chunk();
+
+private:
+
+  void add_table(const std::string& table);
+  void add_record(const std::string& key, const std::string& value);
+  bool flush_records(cryptonote::BlockchainDB* db);
+
+  std::ofstream m_writer;
+  std::ifstream m_reader;
+
+  // payload of the chunk being written or read, and the checksum chain so far
+  std::string m_chunk;
+  crypto::hash m_checksum;
+
+  // records read and not yet given to the db, all from m_table
+  std::string m_table;
+  std::vector<std::pair<std::string, std::string>> m_records;
+  uint64_t m_records_size;
+};
@@ -30,6 +30,7 @@
 
 #include "command_line.h"
 #include "string_tools.h"
+#include "cryptonote_config.h"
 
 namespace command_line
 {
@@ -78,8 +79,8 @@ namespace command_line
   };
   const command_line::arg_descriptor<uint64_t> arg_prep_blocks_threads = {
     "prep-blocks-threads"
-  , "Max number of threads to use when preparing block hashes in groups."
-  , 4
+  , "Max number of threads to use when preparing block hashes in groups, 0 to pick based on available cores and memory."
+  , 0
   };
   const command_line::arg_descriptor<uint64_t> arg_db_auto_remove_logs  = {
     "db-auto-remove-logs"
@@ -91,4 +92,9 @@ namespace command_line
   , "Show time-stats when processing blocks/txs and disk synchronization."
   , 0
   };
+  const command_line::arg_descriptor<uint64_t> arg_max_txpool_size  = {
+    "max-txpool-size"
+  , "Set maximum transaction pool size in bytes; the lowest fee per byte transactions are dropped first when it is full."
+  , DEFAULT_TXPOOL_MAX_SIZE
+  };
 }
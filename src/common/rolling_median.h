@@ -0,0 +1,125 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace tools
+{
+
+/**
+ * Median of a sliding window over the last <capacity> values.
+ *
+ * Values enter at the back and the oldest falls off the front once the
+ * window is full. A sorted copy is kept alongside, so the median is read
+ * directly and an update costs a binary search and a short move, rather
+ * than copying and sorting the whole window each time.
+ *
+ * pop_back() and push_front() let the window slide back, e.g. when blocks
+ * are popped. The object is a plain value and can be copied as a snapshot.
+ *
+ * median() returns the same value epee::misc_utils::median would for the
+ * values currently in the window.
+ */
+template<typename T>
+class rolling_median_t
+{
+public:
+  explicit rolling_median_t(size_t capacity): m_capacity(capacity) {}
+
+  void push_back(const T& v)
+  {
+    if (m_values.size() == m_capacity)
+    {
+      erase_sorted(m_values.front());
+      m_values.pop_front();
+    }
+    m_values.push_back(v);
+    insert_sorted(v);
+  }
+
+  // adds an older value; ignored if the window is already full
+  void push_front(const T& v)
+  {
+    if (m_values.size() == m_capacity)
+      return;
+    m_values.push_front(v);
+    insert_sorted(v);
+  }
+
+  void pop_back()
+  {
+    if (m_values.empty())
+      return;
+    erase_sorted(m_values.back());
+    m_values.pop_back();
+  }
+
+  void clear()
+  {
+    m_values.clear();
+    m_sorted.clear();
+  }
+
+  size_t size() const { return m_values.size(); }
+  size_t capacity() const { return m_capacity; }
+  bool empty() const { return m_values.empty(); }
+  bool full() const { return m_values.size() == m_capacity; }
+
+  T median() const
+  {
+    const size_t n = m_sorted.size();
+    if (n == 0)
+      return T();
+    if (n % 2)
+      return m_sorted[n / 2];
+    return (m_sorted[n / 2 - 1] + m_sorted[n / 2]) / 2;
+  }
+
+private:
+  void insert_sorted(const T& v)
+  {
+    m_sorted.insert(std::upper_bound(m_sorted.begin(), m_sorted.end(), v), v);
+  }
+
+  void erase_sorted(const T& v)
+  {
+    auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), v);
+    if (it != m_sorted.end() && !(v < *it))
+      m_sorted.erase(it);
+  }
+
+  size_t m_capacity;
+  std::deque<T> m_values;
+  std::vector<T> m_sorted;
+};
+
+}
@@ -42,6 +42,7 @@ using namespace epee;
 #include <strsafe.h>
 #else 
 #include <sys/utsname.h>
+#include <unistd.h>
 #endif
 #include <boost/filesystem.hpp>
 
@@ -413,4 +414,23 @@ std::string get_nix_version_display_string()
     }
     return false;
   }
+
+  uint64_t get_available_memory()
+  {
+#if defined(WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+      return 0;
+    return status.ullAvailPhys;
+#elif defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0)
+      return 0;
+    return (uint64_t)pages * (uint64_t)page_size;
+#else
+    return 0;
+#endif
+  }
 }
@@ -90,6 +90,12 @@ namespace tools
 
   bool sanitize_locale();
 
+  /*! \brief Returns the amount of physical memory currently available, in bytes
+   *
+   * \details Returns 0 if it cannot be determined on this platform.
+   */
+  uint64_t get_available_memory();
+
   inline crypto::hash get_proof_of_trust_hash(const nodetool::proof_of_trust& pot)
   {
     std::string s;
@@ -75,7 +75,8 @@ void hash_process(union hash_state *state, const uint8_t *buf, size_t count);
 
 enum {
   HASH_SIZE = 32,
-  HASH_DATA_AREA = 136
+  HASH_DATA_AREA = 136,
+  SLOW_HASH_SCRATCHPAD_SIZE = 1 << 21 // per thread, see slow_hash_allocate_state
 };
 
 void cn_fast_hash(const void *data, size_t length, char *hash);
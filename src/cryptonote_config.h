@@ -85,10 +85,19 @@
 
 #define BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT          10000  //by default, blocks ids count in synchronizing
 #define BLOCKS_SYNCHRONIZING_DEFAULT_COUNT              200    //by default, blocks count in blocks downloading
+#define BLOCKS_SYNCHRONIZING_MIN_COUNT                  20     //blocks count bounds in blocks downloading, once sized to the peer
+#define BLOCKS_SYNCHRONIZING_MAX_COUNT                  2000
+#define BLOCKS_SYNCHRONIZING_MAX_SIZE                   (20*1000*1000) //bytes, well under P2P_DEFAULT_PACKET_MAX_SIZE
+#define BLOCKS_SYNCHRONIZING_TARGET_TIME                5      //seconds each blocks request should take the peer
+#define BLOCK_QUEUE_MAX_SIZE                            (100*1024*1024) //bytes of downloaded blocks waiting to be added, before only the next needed ones are fetched
+#define BLOCK_QUEUE_SPAN_TIMEOUT                        60     //seconds a peer has to send the blocks it was asked for, before others may fetch them
+#define BLOCKS_SYNCHRONIZING_SLOW_SOURCE_RATIO          4      //a peer waits while others fetch blocks this many times faster than it does...
+#define BLOCKS_SYNCHRONIZING_MIN_FAST_SOURCES           2      //...as long as there are at least this many of them
 #define CRYPTONOTE_PROTOCOL_HOP_RELAX_COUNT             3      //value of hop, after which we use only announce of new block
 
 #define CRYPTONOTE_MEMPOOL_TX_LIVETIME                    86400 //seconds, one day
 #define CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME     604800 //seconds, one week
+#define DEFAULT_TXPOOL_MAX_SIZE                           648000000ull // 3 days at 300000, in bytes
 
 #define COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT           1000
 
@@ -110,10 +119,28 @@
 #define P2P_IP_FAILS_BEFORE_BLOCK                       10
 #define P2P_IDLE_CONNECTION_KILL_INTERVAL               (5*60) //5 minutes
 
+#define P2P_PEER_SCORE_DEFAULT_RATE                     (64*1024) //bytes/s assumed of a peer not measured yet
+#define P2P_PEER_SCORE_HEIGHT_SCALE                     10     //blocks behind that halve a peer's score
+#define P2P_PEER_SCORE_INVALID_HALF_LIFE                (60*60*24) //seconds after which a peer's count of misbehaving is halved
+#define P2P_PEER_ROTATE_INTERVAL                        (5*60) //seconds between checks for a slow outgoing connection to replace
+#define P2P_PEER_ROTATE_SCORE_RATIO                     4      //the slowest outgoing connection is replaced when the median one scores this many times higher
+#define P2P_PEER_ROTATE_MIN_SCORED                      3      //outgoing connections measured before any is replaced
+
+#define P2P_SUPPORT_FLAG_COMPACT_BLOCKS                 0x01   //peer takes NOTIFY_NEW_COMPACT_BLOCK in place of NOTIFY_NEW_BLOCK
+#define P2P_SUPPORT_FLAG_TX_INVENTORY                   0x02   //peer takes NOTIFY_TX_INVENTORY in place of NOTIFY_NEW_TRANSACTIONS
+#define P2P_SUPPORT_FLAGS                               (P2P_SUPPORT_FLAG_COMPACT_BLOCKS | P2P_SUPPORT_FLAG_TX_INVENTORY)
+
+#define P2P_TX_INVENTORY_MAX_KNOWN                      20000  //tx hashes remembered per peer as known to it
+#define P2P_TX_INVENTORY_MAX_HASHES                     5000   //tx hashes in one announcement or request
+#define P2P_TX_REQUEST_TIMEOUT                          30     //seconds before a tx asked for may be asked for again from another peer
+#define P2P_TX_REQUEST_MAX_PER_PEER                     10000  //txs announced by one peer waiting to come in, past which its announcements are ignored
+#define P2P_TX_REQUEST_MAX                              100000 //txs announced by all peers waiting to come in, past which new ones are ignored
+
 #define ALLOW_DEBUG_COMMANDS
 
 #define CRYPTONOTE_NAME                         "bitmonero"
 #define CRYPTONOTE_POOLDATA_FILENAME            "poolstate.bin"
+#define CRYPTONOTE_POOLDATA_LOG_FILENAME        "poolstate.log"
 #define CRYPTONOTE_BLOCKCHAINDATA_FILENAME      "blockchain.bin"
 #define CRYPTONOTE_BLOCKCHAINDATA_TEMP_FILENAME "blockchain.bin.tmp"
 #define P2P_NET_DATA_FILENAME                   "p2pstate.bin"
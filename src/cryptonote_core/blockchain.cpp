@@ -101,9 +101,10 @@ static const uint64_t testnet_hard_fork_version_1_till = 624633;
 //------------------------------------------------------------------
 Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps_and_difficulties_height(0), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false),
-  m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false), m_max_prepare_blocks_threads(4), m_db_blocks_per_sync(1), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0)
+  m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false), m_max_prepare_blocks_threads(0), m_longhash_threads(1), m_db_blocks_per_sync(1), m_db_sync_mode(db_async), m_fast_sync(true), m_show_time_stats(false), m_sync_counter(0), m_block_sizes_median(CRYPTONOTE_REWARD_BLOCKS_WINDOW), m_block_timestamps_median(BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW), m_block_medians_height(0), m_btc_valid(false)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
+  reset_block_stage_stats();
 }
 //------------------------------------------------------------------
 bool Blockchain::have_tx(const crypto::hash &id) const
@@ -120,6 +121,14 @@ bool Blockchain::have_tx_keyimg_as_spent(const crypto::key_image &key_im) const
   return  m_db->has_key_image(key_im);
 }
 //------------------------------------------------------------------
+bool Blockchain::have_tx_keyimgs_as_spent(const std::vector<crypto::key_image> &key_im, std::vector<bool> &spent) const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  m_db->has_key_images(key_im, spent);
+  return true;
+}
+//------------------------------------------------------------------
 // This function makes sure that each "input" in an input (mixins) exists
 // and collects the public key for each from the transaction it was included in
 // via the visitor passed to it.
@@ -349,6 +358,16 @@ bool Blockchain::init(BlockchainDB* db, const bool testnet, const cryptonote::te
   // we only need 1
   m_async_pool.create_thread(boost::bind(&boost::asio::io_service::run, &m_async_service));
 
+  // PoW hashing pool for incoming block batches
+  m_longhash_threads = get_longhash_threads();
+  if (m_longhash_threads > 1)
+  {
+    m_longhash_work_idle = std::unique_ptr < boost::asio::io_service::work > (new boost::asio::io_service::work(m_longhash_service));
+    for (uint64_t i = 0; i < m_longhash_threads; i++)
+      m_longhash_pool.create_thread(boost::bind(&Blockchain::longhash_thread, this));
+    LOG_PRINT_L1("Using " << m_longhash_threads << " threads to compute block hashes");
+  }
+
 #if defined(PER_BLOCK_CHECKPOINT)
   if (!fakechain)
     load_compiled_in_block_hashes();
@@ -410,6 +429,10 @@ bool Blockchain::deinit()
   m_async_pool.join_all();
   m_async_service.stop();
 
+  m_longhash_work_idle.reset();
+  m_longhash_pool.join_all();
+  m_longhash_service.stop();
+
   // as this should be called if handling a SIGSEGV, need to check
   // if m_db is a NULL pointer (and thus may have caused the illegal
   // memory operation), otherwise we may cause a loop.
@@ -436,68 +459,75 @@ bool Blockchain::deinit()
   return true;
 }
 //------------------------------------------------------------------
-// This function tells BlockchainDB to remove the top block from the
-// blockchain and then returns all transactions (except the miner tx, of course)
-// from it to the tx_pool
-block Blockchain::pop_block_from_blockchain()
+// This function tells BlockchainDB to remove the top <nblocks> blocks from
+// the blockchain in one go, prepends them to <popped> in chain order and
+// then returns all transactions (except the miner txs, of course) from them
+// to the tx_pool
+void Blockchain::pop_blocks_from_blockchain(uint64_t nblocks, std::list<block>& popped)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   m_timestamps_and_difficulties_height = 0;
+  invalidate_block_template_cache();
+
+  if (nblocks == 0)
+    return;
 
-  block popped_block;
-  std::vector<transaction> popped_txs;
+  std::vector<std::pair<block, std::vector<transaction>>> popped_blocks;
 
   try
   {
-    m_db->pop_block(popped_block, popped_txs);
+    m_db->pop_blocks(nblocks, popped_blocks);
   }
   // anything that could cause this to throw is likely catastrophic,
   // so we re-throw
   catch (const std::exception& e)
   {
-    LOG_ERROR("Error popping block from blockchain: " << e.what());
+    LOG_ERROR("Error popping blocks from blockchain: " << e.what());
     throw;
   }
   catch (...)
   {
-    LOG_ERROR("Error popping block from blockchain, throwing!");
+    LOG_ERROR("Error popping blocks from blockchain, throwing!");
     throw;
   }
 
-  // return transactions from popped block to the tx_pool
-  for (transaction& tx : popped_txs)
+  // FIXME: HardFork
+  // Besides the below, popping a block should also remove the last entry
+  // in hf_versions.
+  //
+  // FIXME: HardFork
+  // This is not quite correct, as we really want to add the txes
+  // to the pool based on the version determined after all blocks
+  // are popped.
+  uint8_t version = get_current_hard_fork_version();
+
+  // return transactions from popped blocks to the tx_pool
+  for (auto& popped_block : popped_blocks)
   {
-    if (!is_coinbase(tx))
+    for (transaction& tx : popped_block.second)
     {
-      cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-
-      // FIXME: HardFork
-      // Besides the below, popping a block should also remove the last entry
-      // in hf_versions.
-      //
-      // FIXME: HardFork
-      // This is not quite correct, as we really want to add the txes
-      // to the pool based on the version determined after all blocks
-      // are popped.
-      uint8_t version = get_current_hard_fork_version();
-
-      // We assume that if they were in a block, the transactions are already
-      // known to the network as a whole. However, if we had mined that block,
-      // that might not be always true. Unlikely though, and always relaying
-      // these again might cause a spike of traffic as many nodes re-relay
-      // all the transactions in a popped block when a reorg happens.
-      bool r = m_tx_pool.add_tx(tx, tvc, true, true, version);
-      if (!r)
+      if (!is_coinbase(tx))
       {
-        LOG_ERROR("Error returning transaction to tx_pool");
+        cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+
+        // We assume that if they were in a block, the transactions are already
+        // known to the network as a whole. However, if we had mined that block,
+        // that might not be always true. Unlikely though, and always relaying
+        // these again might cause a spike of traffic as many nodes re-relay
+        // all the transactions in a popped block when a reorg happens.
+        bool r = m_tx_pool.add_tx(tx, tvc, true, true, version);
+        if (!r)
+        {
+          LOG_ERROR("Error returning transaction to tx_pool");
+        }
       }
     }
+    popped.push_front(std::move(popped_block.first));
   }
+  sync_block_medians();
   m_tx_pool.on_blockchain_dec(m_db->height()-1, get_tail_id());
-
-  return popped_block;
 }
 //------------------------------------------------------------------
 bool Blockchain::reset_and_set_genesis_block(const block& b)
@@ -507,6 +537,9 @@ bool Blockchain::reset_and_set_genesis_block(const block& b)
   m_alternative_chains.clear();
   m_db->reset();
   m_hardfork->init();
+  m_timestamps_and_difficulties_height = 0;
+  invalidate_block_template_cache();
+  reset_block_medians();
 
   block_verification_context bvc = boost::value_initialized<block_verification_context>();
   add_new_block(b, bvc);
@@ -553,7 +586,23 @@ bool Blockchain::get_short_chain_history(std::list<crypto::hash>& ids) const
 
   m_db->block_txn_start(true);
   bool genesis_included = false;
-  uint64_t current_back_offset = 1;
+
+  // the first 11 offsets are consecutive heights below the top, so read
+  // them in one sweep, then carry on with the doubling offsets
+  uint64_t sequential = std::min<uint64_t>(sz - 1, 11);
+  if (sequential)
+  {
+    std::vector<crypto::hash> top = m_db->get_hashes_range(sz - sequential, sz - 1);
+    ids.insert(ids.end(), top.rbegin(), top.rend());
+  }
+  i = sequential;
+  uint64_t current_back_offset = sequential + 1;
+  if (i > 10)
+  {
+    current_multiplier *= 2;
+    current_back_offset = sequential + current_multiplier;
+  }
+
   while(current_back_offset < sz)
   {
     ids.push_back(m_db->get_block_hash_from_height(sz - current_back_offset));
@@ -669,49 +718,35 @@ difficulty_type Blockchain::get_difficulty_for_next_block()
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  std::vector<uint64_t> timestamps;
-  std::vector<difficulty_type> difficulties;
   auto height = m_db->height();
   // ND: Speedup
-  // 1. Keep a list of the last 735 (or less) blocks that is used to compute difficulty,
+  // 1. Keep a window of the last 735 (or less) blocks that is used to compute difficulty,
   //    then when the next block difficulty is queried, push the latest height data and
-  //    pop the oldest one from the list. This only requires 1x read per height instead
-  //    of doing 735 (DIFFICULTY_BLOCKS_COUNT).
+  //    evict the oldest one from the window. This only requires 1x read per height instead
+  //    of doing 735 (DIFFICULTY_BLOCKS_COUNT), and the window keeps its timestamps sorted
+  //    so there is no need to copy and sort them for every block.
   if (m_timestamps_and_difficulties_height != 0 && ((height - m_timestamps_and_difficulties_height) == 1))
   {
     uint64_t index = height - 1;
-    m_timestamps.push_back(m_db->get_block_timestamp(index));
-    m_difficulties.push_back(m_db->get_block_cumulative_difficulty(index));
-
-    while (m_timestamps.size() > DIFFICULTY_BLOCKS_COUNT)
-      m_timestamps.erase(m_timestamps.begin());
-    while (m_difficulties.size() > DIFFICULTY_BLOCKS_COUNT)
-      m_difficulties.erase(m_difficulties.begin());
-
+    m_difficulty_window.push_back(m_db->get_block_timestamp(index), m_db->get_block_cumulative_difficulty(index));
     m_timestamps_and_difficulties_height = height;
-    timestamps = m_timestamps;
-    difficulties = m_difficulties;
   }
-  else
+  else if (m_timestamps_and_difficulties_height == 0 || height != m_timestamps_and_difficulties_height)
   {
     size_t offset = height - std::min < size_t > (height, static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT));
     if (offset == 0)
       ++offset;
 
-    timestamps.clear();
-    difficulties.clear();
+    m_difficulty_window.clear();
     for (; offset < height; offset++)
     {
-      timestamps.push_back(m_db->get_block_timestamp(offset));
-      difficulties.push_back(m_db->get_block_cumulative_difficulty(offset));
+      m_difficulty_window.push_back(m_db->get_block_timestamp(offset), m_db->get_block_cumulative_difficulty(offset));
     }
 
     m_timestamps_and_difficulties_height = height;
-    m_timestamps = timestamps;
-    m_difficulties = difficulties;
   }
   size_t target = get_current_hard_fork_version() < 2 ? DIFFICULTY_TARGET_V1 : DIFFICULTY_TARGET_V2;
-  return next_difficulty(timestamps, difficulties, target);
+  return m_difficulty_window.next_difficulty(target);
 }
 //------------------------------------------------------------------
 // This function removes blocks from the blockchain until it gets to the
@@ -731,10 +766,8 @@ bool Blockchain::rollback_blockchain_switching(std::list<block>& original_chain,
   m_timestamps_and_difficulties_height = 0;
 
   // remove blocks from blockchain until we get back to where we should be.
-  while (m_db->height() != rollback_height)
-  {
-    pop_block_from_blockchain();
-  }
+  std::list<block> discarded_chain;
+  pop_blocks_from_blockchain(m_db->height() - rollback_height, discarded_chain);
 
   //return back original chain
   for (auto& bl : original_chain)
@@ -775,14 +808,9 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
 
   // pop blocks from the blockchain until the top block is the parent
   // of the front block of the alt chain.
+  auto split_height = m_db->get_block_height(alt_chain.front()->second.bl.prev_id) + 1;
   std::list<block> disconnected_chain;
-  while (m_db->top_block_hash() != alt_chain.front()->second.bl.prev_id)
-  {
-    block b = pop_block_from_blockchain();
-    disconnected_chain.push_front(b);
-  }
-
-  auto split_height = m_db->height();
+  pop_blocks_from_blockchain(m_db->height() - split_height, disconnected_chain);
 
   //connecting new alternative chain
   for(auto alt_ch_iter = alt_chain.begin(); alt_ch_iter != alt_chain.end(); alt_ch_iter++)
@@ -854,8 +882,7 @@ bool Blockchain::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::
 difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std::list<blocks_ext_by_hash::iterator>& alt_chain, block_extended_info& bei) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  std::vector<uint64_t> timestamps;
-  std::vector<difficulty_type> cumulative_difficulties;
+  difficulty_window window;
 
   // if the alt chain isn't long enough to calculate the difficulty target
   // based on its blocks alone, need to get more blocks from the main chain
@@ -872,38 +899,45 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
     if(!main_chain_start_offset)
       ++main_chain_start_offset; //skip genesis block
 
+    // the main chain window covers the blocks just below the cached height,
+    // so forks near the top can take their main chain part from it rather
+    // than reading it back from the db
+    size_t cached_stop_offset = m_timestamps_and_difficulties_height;
+    size_t cached_start_offset = cached_stop_offset - std::min<size_t>(cached_stop_offset, m_difficulty_window.size());
+    bool use_cache = cached_stop_offset != 0 && cached_start_offset <= main_chain_start_offset && main_chain_stop_offset <= cached_stop_offset;
+
     // get difficulties and timestamps from relevant main chain blocks
     for(; main_chain_start_offset < main_chain_stop_offset; ++main_chain_start_offset)
     {
-      timestamps.push_back(m_db->get_block_timestamp(main_chain_start_offset));
-      cumulative_difficulties.push_back(m_db->get_block_cumulative_difficulty(main_chain_start_offset));
+      if (use_cache)
+      {
+        size_t index = main_chain_start_offset - cached_start_offset;
+        window.push_back(m_difficulty_window.timestamp(index), m_difficulty_window.cumulative_difficulty(index));
+      }
+      else
+      {
+        window.push_back(m_db->get_block_timestamp(main_chain_start_offset), m_db->get_block_cumulative_difficulty(main_chain_start_offset));
+      }
     }
 
     // make sure we haven't accidentally grabbed too many blocks...maybe don't need this check?
-    CHECK_AND_ASSERT_MES((alt_chain.size() + timestamps.size()) <= DIFFICULTY_BLOCKS_COUNT, false, "Internal error, alt_chain.size()[" << alt_chain.size() << "] + vtimestampsec.size()[" << timestamps.size() << "] NOT <= DIFFICULTY_WINDOW[]" << DIFFICULTY_BLOCKS_COUNT);
+    CHECK_AND_ASSERT_MES((alt_chain.size() + window.size()) <= DIFFICULTY_BLOCKS_COUNT, false, "Internal error, alt_chain.size()[" << alt_chain.size() << "] + vtimestampsec.size()[" << window.size() << "] NOT <= DIFFICULTY_WINDOW[]" << DIFFICULTY_BLOCKS_COUNT);
 
     for (auto it : alt_chain)
     {
-      timestamps.push_back(it->second.bl.timestamp);
-      cumulative_difficulties.push_back(it->second.cumulative_difficulty);
+      window.push_back(it->second.bl.timestamp, it->second.cumulative_difficulty);
     }
   }
   // if the alt chain is long enough for the difficulty calc, grab difficulties
   // and timestamps from it alone
   else
   {
-    timestamps.resize(static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT));
-    cumulative_difficulties.resize(static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT));
-    size_t count = 0;
-    size_t max_i = timestamps.size()-1;
     // get difficulties and timestamps from most recent blocks in alt chain
-    BOOST_REVERSE_FOREACH(auto it, alt_chain)
+    auto it = alt_chain.end();
+    std::advance(it, -static_cast<std::ptrdiff_t>(DIFFICULTY_BLOCKS_COUNT));
+    for (; it != alt_chain.end(); ++it)
     {
-      timestamps[max_i - count] = it->second.bl.timestamp;
-      cumulative_difficulties[max_i - count] = it->second.cumulative_difficulty;
-      count++;
-      if(count >= DIFFICULTY_BLOCKS_COUNT)
-        break;
+      window.push_back((*it)->second.bl.timestamp, (*it)->second.cumulative_difficulty);
     }
   }
 
@@ -911,7 +945,7 @@ difficulty_type Blockchain::get_next_difficulty_for_alternative_chain(const std:
   size_t target = get_ideal_hard_fork_version(bei.height) < 2 ? DIFFICULTY_TARGET_V1 : DIFFICULTY_TARGET_V2;
 
   // calculate the difficulty target for the block and return it
-  return next_difficulty(timestamps, cumulative_difficulties, target);
+  return window.next_difficulty(target);
 }
 //------------------------------------------------------------------
 // This function does a sanity check on basic things that all miner
@@ -954,9 +988,8 @@ bool Blockchain::validate_miner_transaction(const block& b, size_t cumulative_bl
     money_in_use += o.amount;
   partial_block_reward = false;
 
-  std::vector<size_t> last_blocks_sizes;
-  get_last_n_blocks_sizes(last_blocks_sizes, CRYPTONOTE_REWARD_BLOCKS_WINDOW);
-  if (!get_block_reward(epee::misc_utils::median(last_blocks_sizes), cumulative_block_size, already_generated_coins, base_reward, get_current_hard_fork_version()))
+  sync_block_medians();
+  if (!get_block_reward(m_block_sizes_median.median(), cumulative_block_size, already_generated_coins, base_reward, get_current_hard_fork_version()))
   {
     LOG_PRINT_L1("block size " << cumulative_block_size << " is bigger than allowed for this blockchain");
     return false;
@@ -988,26 +1021,97 @@ bool Blockchain::validate_miner_transaction(const block& b, size_t cumulative_bl
   return true;
 }
 //------------------------------------------------------------------
-// get the block sizes of the last <count> blocks, starting at <from_height>
-// and return by reference <sz>.
-void Blockchain::get_last_n_blocks_sizes(std::vector<size_t>& sz, size_t count) const
+// Moves <window>, which holds the values of the blocks just below
+// <from_height>, so it holds those just below <to_height>, reading only the
+// blocks that enter it.
+template<typename T, typename F>
+static void slide_block_window(tools::rolling_median_t<T>& window, uint64_t from_height, uint64_t to_height, F get)
+{
+  if (to_height >= from_height)
+  {
+    if (to_height - from_height >= window.capacity())
+    {
+      window.clear();
+      from_height = to_height - window.capacity();
+    }
+    for (uint64_t h = from_height; h < to_height; ++h)
+      window.push_back(get(h));
+    return;
+  }
+
+  if (from_height - to_height >= window.size())
+    window.clear();
+  else
+    for (uint64_t i = to_height; i < from_height; ++i)
+      window.pop_back();
+  while (!window.full() && to_height > window.size())
+    window.push_front(get(to_height - window.size() - 1));
+}
+//------------------------------------------------------------------
+// Brings the block size and timestamp median windows in line with the
+// current chain height. Adding or popping a few blocks only touches those
+// blocks; anything else rebuilds the windows from the db.
+void Blockchain::sync_block_medians()
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  auto h = m_db->height();
-
-  // this function is meaningless for an empty blockchain...granted it should never be empty
-  if(h == 0)
+  uint64_t h = m_db->height();
+  if (h == m_block_medians_height)
     return;
 
-  m_db->block_txn_start(true);
-  // add size of last <count> blocks to vector <sz> (or less, if blockchain size < count)
-  size_t start_offset = h - std::min<size_t>(h, count);
-  for(size_t i = start_offset; i < h; i++)
+  slide_block_window(m_block_sizes_median, m_block_medians_height, h, [this](uint64_t height) { return m_db->get_block_size(height); });
+  slide_block_window(m_block_timestamps_median, m_block_medians_height, h, [this](uint64_t height) { return m_db->get_block_timestamp(height); });
+  m_block_medians_height = h;
+}
+//------------------------------------------------------------------
+void Blockchain::reset_block_medians()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  m_block_sizes_median.clear();
+  m_block_timestamps_median.clear();
+  m_block_medians_height = 0;
+}
+//------------------------------------------------------------------
+void Blockchain::record_block_stage(block_stage stage, uint64_t ms)
+{
+  size_t bucket = 0;
+  while (ms >> bucket && bucket < block_stage_buckets - 1)
+    ++bucket;
+
+  CRITICAL_REGION_LOCAL(m_block_stage_stats_lock);
+  block_stage_stats &stats = m_block_stage_stats[stage];
+  ++stats.count;
+  stats.total += ms;
+  if (ms > stats.max)
+    stats.max = ms;
+  ++stats.histogram[bucket];
+}
+//------------------------------------------------------------------
+std::vector<Blockchain::block_stage_stats> Blockchain::get_block_stage_stats() const
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_block_stage_stats_lock);
+  return std::vector<block_stage_stats>(m_block_stage_stats, m_block_stage_stats + stage_count);
+}
+//------------------------------------------------------------------
+void Blockchain::reset_block_stage_stats()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  static const char * const names[stage_count] = {
+    "output_scan", "pow", "key_images", "tx_checks", "miner_tx", "pool", "db_write", "total"
+  };
+
+  CRITICAL_REGION_LOCAL(m_block_stage_stats_lock);
+  for (size_t i = 0; i < stage_count; ++i)
   {
-    sz.push_back(m_db->get_block_size(i));
+    block_stage_stats &stats = m_block_stage_stats[i];
+    stats.name = names[i];
+    stats.count = 0;
+    stats.total = 0;
+    stats.max = 0;
+    stats.histogram.assign(block_stage_buckets, 0);
   }
-  m_db->block_txn_stop();
 }
 //------------------------------------------------------------------
 uint64_t Blockchain::get_current_cumulative_blocksize_limit() const
@@ -1033,8 +1137,22 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
   size_t median_size;
   uint64_t already_generated_coins;
 
+  uint64_t pool_cookie;
+
   CRITICAL_REGION_BEGIN(m_blockchain_lock);
   height = m_db->height();
+  pool_cookie = m_tx_pool.cookie();
+
+  // pools poll for templates far more often than the chain or the tx pool
+  // change, so hand out a copy of the last one while neither has
+  if (m_btc_valid && m_btc.prev_id == get_tail_id() && m_btc_pool_cookie == pool_cookie && m_btc_nonce == ex_nonce &&
+      m_btc_address.m_spend_public_key == miner_address.m_spend_public_key && m_btc_address.m_view_public_key == miner_address.m_view_public_key)
+  {
+    b = m_btc;
+    b.timestamp = time(NULL);
+    diffic = m_btc_difficulty;
+    return true;
+  }
 
   b.major_version = m_hardfork->get_current_version();
   b.minor_version = m_hardfork->get_ideal_version();
@@ -1157,12 +1275,35 @@ bool Blockchain::create_block_template(block& b, const account_public_address& m
     LOG_PRINT_L1("Creating block template: miner tx size " << coinbase_blob_size <<
         ", cumulative size " << cumulative_size << " is now good");
 #endif
+    cache_block_template(b, miner_address, ex_nonce, diffic, pool_cookie);
     return true;
   }
   LOG_ERROR("Failed to create_block_template with " << 10 << " tries");
   return false;
 }
 //------------------------------------------------------------------
+// The pool cookie is read before the template is filled, so a tx pool change
+// while filling makes the next request rebuild rather than reuse a stale one
+void Blockchain::cache_block_template(const block &b, const cryptonote::account_public_address &address, const blobdata &nonce, const difficulty_type &diff, uint64_t pool_cookie)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  m_btc = b;
+  m_btc_address = address;
+  m_btc_nonce = nonce;
+  m_btc_difficulty = diff;
+  m_btc_pool_cookie = pool_cookie;
+  m_btc_valid = true;
+}
+//------------------------------------------------------------------
+void Blockchain::invalidate_block_template_cache()
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  m_btc_valid = false;
+}
+//------------------------------------------------------------------
 // for an alternate chain, get the timestamps from the main chain to complete
 // the needed number of timestamps for the BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW.
 bool Blockchain::complete_timestamps_vector(uint64_t start_top_height, std::vector<uint64_t>& timestamps)
@@ -1194,7 +1335,6 @@ bool Blockchain::handle_alternative_block(const block& b, const crypto::hash& id
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  m_timestamps_and_difficulties_height = 0;
   uint64_t block_height = get_block_height(b);
   if(0 == block_height)
   {
@@ -1613,12 +1753,8 @@ bool Blockchain::find_blockchain_supplement(const std::list<crypto::hash>& qbloc
   {
     try
     {
-      split_height = m_db->get_block_height(*bl_it);
-      break;
-    }
-    catch (const BLOCK_DNE& e)
-    {
-      continue;
+      if (m_db->block_exists(*bl_it, &split_height))
+        break;
     }
     catch (const std::exception& e)
     {
@@ -1773,11 +1909,9 @@ bool Blockchain::find_blockchain_supplement(const std::list<crypto::hash>& qbloc
   }
 
   resp.total_height = get_current_blockchain_height();
-  size_t count = 0;
-  for(size_t i = resp.start_height; i < resp.total_height && count < BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT; i++, count++)
-  {
-    resp.m_block_ids.push_back(m_db->get_block_hash_from_height(i));
-  }
+  uint64_t stop_height = std::min<uint64_t>(resp.total_height, resp.start_height + BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT);
+  if (resp.start_height < stop_height)
+    resp.m_block_ids = m_db->get_hashes_range(resp.start_height, stop_height - 1);
   return true;
 }
 //------------------------------------------------------------------
@@ -1971,11 +2105,11 @@ bool Blockchain::check_tx_inputs(const transaction& tx, uint64_t& max_used_block
   CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
 #if defined(PER_BLOCK_CHECKPOINT)
-  // check if we're doing per-block checkpointing
-  if (m_db->height() < m_blocks_hash_check.size() && kept_by_block)
+  // skip input verification only for txs committed to by a block whose id
+  // matched the compiled-in hash set (see prepare_handle_incoming_blocks)
+  if (kept_by_block && m_blocks_txs_check.find(get_transaction_hash(tx)) != m_blocks_txs_check.end())
   {
     TIME_MEASURE_START(a);
-    m_blocks_txs_check.push_back(get_transaction_hash(tx));
     max_used_block_id = null_hash;
     max_used_block_height = 0;
     TIME_MEASURE_FINISH(a);
@@ -2092,6 +2226,19 @@ bool Blockchain::check_tx_inputs(const transaction& tx, uint64_t* pmax_used_bloc
     }
   }
 
+  // inputs whose ring signatures preverify_tx_inputs already checked
+  // against the same output keys are not checked again
+  std::vector<std::vector<crypto::public_key>> preverified;
+  {
+    CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+    if (!m_preverified_txs.empty())
+    {
+      auto itp = m_preverified_txs.find(get_transaction_hash(tx));
+      if (itp != m_preverified_txs.end())
+        preverified = itp->second;
+    }
+  }
+
   auto it = m_check_txin_table.find(tx_prefix_hash);
   if(it == m_check_txin_table.end())
   {
@@ -2105,7 +2252,7 @@ bool Blockchain::check_tx_inputs(const transaction& tx, uint64_t* pmax_used_bloc
   std::vector < uint64_t > results;
   results.resize(tx.vin.size(), 0);
 
-  int threads = std::thread::hardware_concurrency();
+  int threads = preverified.empty() ? std::thread::hardware_concurrency() : 1;
 
   boost::asio::io_service ioservice;
   boost::thread_group threadpool;
@@ -2181,6 +2328,13 @@ bool Blockchain::check_tx_inputs(const transaction& tx, uint64_t* pmax_used_bloc
       return false;
     }
 
+    if (sig_index < preverified.size() && preverified[sig_index] == pubkeys[sig_index])
+    {
+      it->second[in_to_key.k_image] = true;
+      sig_index++;
+      continue;
+    }
+
     if (threads > 1)
     {
       // ND: Speedup
@@ -2232,6 +2386,98 @@ bool Blockchain::check_tx_inputs(const transaction& tx, uint64_t* pmax_used_bloc
   return true;
 }
 
+//------------------------------------------------------------------
+void Blockchain::preverify_tx_inputs(const std::vector<std::pair<crypto::hash, const transaction*>>& txs)
+{
+  LOG_PRINT_L3("Blockchain::" << __func__);
+
+  // look up the output keys for all inputs under the lock, then check the
+  // signatures without it, one job per input over the whole batch
+  std::vector<crypto::hash> tx_prefix_hashes(txs.size());
+  std::vector<std::vector<std::vector<crypto::public_key>>> pubkeys(txs.size());
+  std::vector<std::pair<size_t, size_t>> inputs;
+  {
+    CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    for (size_t i = 0; i < txs.size(); ++i)
+    {
+      const transaction &tx = *txs[i].second;
+      if (tx.vin.empty() || tx.signatures.size() < tx.vin.size())
+        continue;
+      tx_prefix_hashes[i] = get_transaction_prefix_hash(tx);
+      pubkeys[i].resize(tx.vin.size());
+      for (size_t n = 0; n < tx.vin.size(); ++n)
+      {
+        uint64_t max_used_block_height = 0;
+        if (tx.vin[n].type() != typeid(txin_to_key) || boost::get<txin_to_key>(tx.vin[n]).key_offsets.empty() ||
+            !check_tx_input(boost::get<txin_to_key>(tx.vin[n]), tx_prefix_hashes[i], tx.signatures[n], pubkeys[i][n], &max_used_block_height))
+        {
+          // left for check_tx_inputs to reject
+          pubkeys[i].clear();
+          break;
+        }
+      }
+      for (size_t n = 0; n < pubkeys[i].size(); ++n)
+        inputs.push_back(std::make_pair(i, n));
+    }
+  }
+
+  std::vector<uint64_t> results(inputs.size(), 0);
+  run_on_pool(inputs.size(), [&](size_t j) {
+    const size_t i = inputs[j].first, n = inputs[j].second;
+    const transaction &tx = *txs[i].second;
+    check_ring_signature(tx_prefix_hashes[i], boost::get<txin_to_key>(tx.vin[n]).k_image, pubkeys[i][n], tx.signatures[n], results[j]);
+  });
+
+  for (size_t j = 0; j < inputs.size(); ++j)
+  {
+    if (!results[j])
+      pubkeys[inputs[j].first].clear();
+  }
+
+  CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+  for (size_t i = 0; i < txs.size(); ++i)
+  {
+    if (!pubkeys[i].empty())
+      m_preverified_txs[txs[i].first] = std::move(pubkeys[i]);
+  }
+}
+//------------------------------------------------------------------
+void Blockchain::drop_preverified_tx(const crypto::hash& tx_hash)
+{
+  CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+  m_preverified_txs.erase(tx_hash);
+}
+//------------------------------------------------------------------
+void Blockchain::run_on_pool(size_t count, const std::function<void(size_t)>& job)
+{
+  uint64_t workers = std::min<uint64_t>(m_longhash_threads, count);
+  if (workers <= 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+      job(i);
+    return;
+  }
+
+  std::atomic<size_t> next_job(0);
+  uint64_t workers_left = workers;
+  boost::mutex workers_mutex;
+  boost::condition_variable workers_done;
+
+  for (uint64_t i = 0; i < workers; i++)
+  {
+    m_longhash_service.dispatch([&]() {
+      for (size_t n = next_job++; n < count; n = next_job++)
+        job(n);
+      boost::unique_lock<boost::mutex> lock(workers_mutex);
+      if (--workers_left == 0)
+        workers_done.notify_one();
+    });
+  }
+
+  boost::unique_lock<boost::mutex> lock(workers_mutex);
+  while (workers_left > 0)
+    workers_done.wait(lock);
+}
 //------------------------------------------------------------------
 void Blockchain::check_ring_signature(const crypto::hash &tx_prefix_hash, const crypto::key_image &key_image, const std::vector<crypto::public_key> &pubkeys, const std::vector<crypto::signature>& sig, uint64_t &result)
 {
@@ -2364,7 +2610,7 @@ bool Blockchain::check_block_timestamp(std::vector<uint64_t>& timestamps, const
 //   true if the block's timestamp is not less than the timestamp of the
 //       median of the selected blocks
 //   false otherwise
-bool Blockchain::check_block_timestamp(const block& b) const
+bool Blockchain::check_block_timestamp(const block& b)
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
   if(b.timestamp > get_adjusted_time() + CRYPTONOTE_BLOCK_FUTURE_TIME_LIMIT)
@@ -2379,17 +2625,16 @@ bool Blockchain::check_block_timestamp(const block& b) const
     return true;
   }
 
-  std::vector<uint64_t> timestamps;
-  auto h = m_db->height();
+  sync_block_medians();
+  uint64_t median_ts = m_block_timestamps_median.median();
 
-  // need most recent 60 blocks, get index of first of those
-  size_t offset = h - BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW;
-  for(;offset < h; ++offset)
+  if(b.timestamp < median_ts)
   {
-    timestamps.push_back(m_db->get_block_timestamp(offset));
+    LOG_PRINT_L1("Timestamp of block with id: " << get_block_hash(b) << ", " << b.timestamp << ", less than median of last " << BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW << " blocks, " << median_ts);
+    return false;
   }
 
-  return check_block_timestamp(timestamps, b);
+  return true;
 }
 //------------------------------------------------------------------
 void Blockchain::return_tx_to_pool(const std::vector<transaction> &txs)
@@ -2572,7 +2817,6 @@ leave:
 
 // XXX old code adds miner tx here
 
-  int tx_index = 0;
   // Iterate over the block's transaction hashes, grabbing each
   // from the tx_pool and validating them.  Each is then added
   // to txs.  Keys spent in each are added to <keys> by the double spend check.
@@ -2627,7 +2871,10 @@ leave:
     TIME_MEASURE_START(cc);
 
 #if defined(PER_BLOCK_CHECKPOINT)
-    if (!fast_check)
+    // ND: if fast_check is enabled for blocks, there is no need to check
+    // the inputs of transactions the block id commits to; anything that did
+    // not come in with a verified batch still gets the full check.
+    if (!fast_check || m_blocks_txs_check.find(tx_id) == m_blocks_txs_check.end())
 #endif
     {
       // validate that transaction inputs and the keys spending them are correct.
@@ -2643,31 +2890,12 @@ leave:
         goto leave;
       }
     }
-#if defined(PER_BLOCK_CHECKPOINT)
-    else
-    {
-      // ND: if fast_check is enabled for blocks, there is no need to check
-      // the transaction inputs, but do some sanity checks anyway.
-      if (memcmp(&m_blocks_txs_check[tx_index++], &tx_id, sizeof(tx_id)) != 0)
-      {
-        LOG_PRINT_L1("Block with id: " << id << " has at least one transaction (id: " << tx_id << ") with wrong inputs.");
-        //TODO: why is this done?  make sure that keeping invalid blocks makes sense.
-        add_block_as_invalid(bl, id);
-        LOG_PRINT_L1("Block with id " << id << " added as invalid because of wrong inputs in transactions");
-        bvc.m_verifivation_failed = true;
-        return_tx_to_pool(txs);
-        goto leave;
-      }
-    }
-#endif
     TIME_MEASURE_FINISH(cc);
     t_checktx += cc;
     fee_summary += fee;
     cumulative_block_size += blob_size;
   }
 
-  m_blocks_txs_check.clear();
-
   TIME_MEASURE_START(vmt);
   uint64_t base_reward = 0;
   uint64_t already_generated_coins = m_db->height() ? m_db->get_block_already_generated_coins(m_db->height() - 1) : 0;
@@ -2729,6 +2957,14 @@ leave:
   update_next_cumulative_size_limit();
 
   LOG_PRINT_L1("+++++ BLOCK SUCCESSFULLY ADDED" << std::endl << "id:\t" << id << std::endl << "PoW:\t" << proof_of_work << std::endl << "HEIGHT " << new_height-1 << ", difficulty:\t" << current_diffic << std::endl << "block reward: " << print_money(fee_summary + base_reward) << "(" << print_money(base_reward) << " + " << print_money(fee_summary) << "), coinbase_blob_size: " << coinbase_blob_size << ", cumulative size: " << cumulative_block_size << ", " << block_processing_time << "(" << target_calculating_time << "/" << longhash_calculating_time << ")ms");
+  record_block_stage(stage_pow, target_calculating_time + longhash_calculating_time);
+  record_block_stage(stage_key_images, t_exists + t_dblspnd);
+  record_block_stage(stage_tx_checks, t_checktx);
+  record_block_stage(stage_miner_tx, vmt);
+  record_block_stage(stage_pool, t_pool);
+  record_block_stage(stage_db_write, addblock);
+  record_block_stage(stage_total, block_processing_time + addblock);
+
   if(m_show_time_stats)
   {
     LOG_PRINT_L0("Height: " << new_height << " blob: " << coinbase_blob_size << " cumm: "
@@ -2752,10 +2988,9 @@ bool Blockchain::update_next_cumulative_size_limit()
   uint64_t full_reward_zone = get_current_hard_fork_version() < 2 ? CRYPTONOTE_BLOCK_GRANTED_FULL_REWARD_ZONE_V1 : CRYPTONOTE_BLOCK_GRANTED_FULL_REWARD_ZONE_V2;
 
   LOG_PRINT_L3("Blockchain::" << __func__);
-  std::vector<size_t> sz;
-  get_last_n_blocks_sizes(sz, CRYPTONOTE_REWARD_BLOCKS_WINDOW);
+  sync_block_medians();
 
-  uint64_t median = epee::misc_utils::median(sz);
+  uint64_t median = m_block_sizes_median.median();
   if(median <= full_reward_zone)
     median = full_reward_zone;
 
@@ -2869,20 +3104,50 @@ void Blockchain::set_enforce_dns_checkpoints(bool enforce_checkpoints)
 }
 
 //------------------------------------------------------------------
-void Blockchain::block_longhash_worker(const uint64_t height, const std::vector<block> &blocks, std::unordered_map<crypto::hash, crypto::hash> &map) const
+// Workers grab the next block to hash from a shared counter rather than
+// each being given a fixed slice of the batch, so a slow thread only holds
+// back the block it is on. Must run on a thread with a slow hash state
+// allocated (see longhash_thread).
+void Blockchain::block_longhash_worker(const uint64_t height, const std::vector<block> &blocks, std::atomic<size_t> &next_block, std::vector<crypto::hash> &hashes) const
+{
+  for (size_t i = next_block++; i < blocks.size(); i = next_block++)
+  {
+    hashes[i] = get_block_longhash(blocks[i], height + i);
+  }
+}
+//------------------------------------------------------------------
+void Blockchain::longhash_thread()
 {
-  TIME_MEASURE_START(t);
   slow_hash_allocate_state();
+  m_longhash_service.run();
+  slow_hash_free_state();
+}
+//------------------------------------------------------------------
+uint64_t Blockchain::get_longhash_threads() const
+{
+  uint64_t threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+
+  // 0 means no user limit
+  if (m_max_prepare_blocks_threads > 0 && threads > m_max_prepare_blocks_threads)
+    threads = m_max_prepare_blocks_threads;
 
-  for (const auto & block : blocks)
+  // keep the scratchpads well within the memory we have left
+  uint64_t available = tools::get_available_memory();
+  if (available > 0)
   {
-    crypto::hash id = get_block_hash(block);
-    crypto::hash pow = get_block_longhash(block, height);
-    map.emplace(id, pow);
+    uint64_t max_threads = available / (4 * crypto::SLOW_HASH_SCRATCHPAD_SIZE);
+    if (max_threads < 1)
+      max_threads = 1;
+    if (threads > max_threads)
+    {
+      LOG_PRINT_L1("Limiting block hashing threads to " << max_threads << " due to available memory");
+      threads = max_threads;
+    }
   }
 
-  slow_hash_free_state();
-  TIME_MEASURE_FINISH(t);
+  return threads;
 }
 
 //------------------------------------------------------------------
@@ -2947,7 +3212,7 @@ void Blockchain::output_scan_worker(const uint64_t amount, const std::vector<uin
 
 //------------------------------------------------------------------
 // ND: Speedups:
-// 1. Thread long_hash computations if possible (m_max_prepare_blocks_threads = nthreads, default = 4)
+// 1. Thread long_hash computations if possible (on the m_longhash_pool threads, sized by get_longhash_threads)
 // 2. Group all amounts (from txs) and related absolute offsets and form a table of tx_prefix_hash
 //    vs [k_image, output_keys] (m_scan_table). This is faster because it takes advantage of bulk queries
 //    and is threaded if possible. The table (m_scan_table) will be used later when querying output
@@ -2961,99 +3226,107 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
   if(blocks_entry.size() == 0)
     return false;
 
+#if defined(PER_BLOCK_CHECKPOINT)
+  // Below the compiled-in hash set, a block whose id matches blocks.dat
+  // commits (through its merkle root) to its tx hashes, so those txs are
+  // trusted and skip input verification. Stop at the first block that does
+  // not chain or does not match; its txs get the full checks.
+  m_blocks_txs_check.clear();
+  if (m_db->height() < m_blocks_hash_check.size())
+  {
+    uint64_t height = m_db->height();
+    crypto::hash prev_id = m_db->top_block_hash();
+    for (const auto &entry : blocks_entry)
+    {
+      if (height >= m_blocks_hash_check.size())
+        break;
+
+      block bl;
+      if (!parse_and_validate_block_from_blob(entry.block, bl) || bl.prev_id != prev_id)
+        break;
+
+      crypto::hash id = get_block_hash(bl);
+      if (id != m_blocks_hash_check[height])
+      {
+        LOG_PRINT_L1("Block " << id << " at height " << height << " does not match the compiled-in hash, verifying it in full");
+        break;
+      }
+
+      m_blocks_txs_check.insert(bl.tx_hashes.begin(), bl.tx_hashes.end());
+      prev_id = id;
+      ++height;
+    }
+  }
+#endif
+
   if ((m_db->height() + blocks_entry.size()) < m_blocks_hash_check.size())
     return true;
 
   bool blocks_exist = false;
-  uint64_t threads = std::thread::hardware_concurrency();
+  uint64_t threads = m_longhash_threads;
 
-  if (blocks_entry.size() > 1 && threads > 1 && m_max_prepare_blocks_threads > 1)
+  if (blocks_entry.size() > 1 && threads > 1)
   {
-    // limit threads, default limit = 4
-    if(threads > m_max_prepare_blocks_threads)
-      threads = m_max_prepare_blocks_threads;
-
     uint64_t height = m_db->height();
-    std::vector<boost::thread *> thread_list;
-    int batches = blocks_entry.size() / threads;
-    int extra = blocks_entry.size() % threads;
-    LOG_PRINT_L1("block_batches: " << batches);
-    std::vector<std::unordered_map<crypto::hash, crypto::hash>> maps(threads);
-    std::vector < std::vector < block >> blocks(threads);
-    auto it = blocks_entry.begin();
+    std::vector<block> blocks;
+    blocks.reserve(blocks_entry.size());
 
-    for (uint64_t i = 0; i < threads; i++)
+    for (const auto &entry : blocks_entry)
     {
-      for (int j = 0; j < batches; j++)
-      {
-        block block;
+      block block;
 
-        if (!parse_and_validate_block_from_blob(it->block, block))
-        {
-          std::advance(it, 1);
-          continue;
-        }
+      if (!parse_and_validate_block_from_blob(entry.block, block))
+        continue;
 
-        // check first block and skip all blocks if its not chained properly
-        if (i == 0 && j == 0)
-        {
-          crypto::hash tophash = m_db->top_block_hash();
-          if (block.prev_id != tophash)
-          {
-            LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
-            return true;
-          }
-        }
-        if (have_block(get_block_hash(block)))
+      // check first block and skip all blocks if its not chained properly
+      if (blocks.empty())
+      {
+        crypto::hash tophash = m_db->top_block_hash();
+        if (block.prev_id != tophash)
         {
-          blocks_exist = true;
-          break;
+          LOG_PRINT_L1("Skipping prepare blocks. New blocks don't belong to chain.");
+          return true;
         }
-
-        blocks[i].push_back(block);
-        std::advance(it, 1);
-      }
-    }
-
-    for (int i = 0; i < extra && !blocks_exist; i++)
-    {
-      block block;
-
-      if (!parse_and_validate_block_from_blob(it->block, block))
-      {
-        std::advance(it, 1);
-        continue;
       }
-
       if (have_block(get_block_hash(block)))
       {
         blocks_exist = true;
         break;
       }
 
-      blocks[i].push_back(block);
-      std::advance(it, 1);
+      blocks.push_back(block);
     }
 
     if (!blocks_exist)
     {
       m_blocks_longhash_table.clear();
-      for (uint64_t i = 0; i < threads; i++)
+
+      std::vector<crypto::hash> hashes(blocks.size());
+      std::atomic<size_t> next_block(0);
+      uint64_t workers = std::min<uint64_t>(threads, blocks.size());
+      uint64_t workers_left = workers;
+      boost::mutex workers_mutex;
+      boost::condition_variable workers_done;
+
+      for (uint64_t i = 0; i < workers; i++)
       {
-        thread_list.push_back(new boost::thread(&Blockchain::block_longhash_worker, this, height + (i * batches), std::cref(blocks[i]), std::ref(maps[i])));
+        m_longhash_service.dispatch([&]() {
+          block_longhash_worker(height, blocks, next_block, hashes);
+          boost::unique_lock<boost::mutex> lock(workers_mutex);
+          if (--workers_left == 0)
+            workers_done.notify_one();
+        });
       }
 
-      for (size_t j = 0; j < thread_list.size(); j++)
       {
-        thread_list[j]->join();
-        delete thread_list[j];
+        boost::unique_lock<boost::mutex> lock(workers_mutex);
+        while (workers_left > 0)
+          workers_done.wait(lock);
       }
 
-      thread_list.clear();
-
-      for (const auto & map : maps)
+      for (size_t i = 0; i < blocks.size(); i++)
       {
-        m_blocks_longhash_table.insert(map.begin(), map.end());
+        m_blocks_longhash_table.emplace(get_block_hash(blocks[i]), hashes[i]);
       }
     }
   }
@@ -3252,6 +3525,7 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::list<block_complete_e
   }
 
   TIME_MEASURE_FINISH(scantable);
+  record_block_stage(stage_output_scan, scantable);
   if (total_txs > 0)
   {
     m_fake_scan_time = scantable / total_txs;
@@ -45,6 +45,7 @@
 #include "string_tools.h"
 #include "cryptonote_basic.h"
 #include "common/util.h"
+#include "common/rolling_median.h"
 #include "cryptonote_protocol/cryptonote_protocol_defs.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 #include "difficulty.h"
@@ -90,6 +91,19 @@ namespace cryptonote
       uint64_t already_generated_coins;
     };
 
+    // timings of one stage of block processing, in ms, sampled once per block
+    // added to the main chain (output_scan once per incoming batch); histogram
+    // bucket 0 counts times under 1 ms, bucket i times in [2^(i-1), 2^i) ms,
+    // and the last bucket everything above
+    struct block_stage_stats
+    {
+      std::string name;
+      uint64_t count;
+      uint64_t total;
+      uint64_t max;
+      std::vector<uint64_t> histogram;
+    };
+
     Blockchain(tx_memory_pool& tx_pool);
 
     bool init(BlockchainDB* db, const bool testnet = false, const cryptonote::test_options *test_options = NULL);
@@ -112,6 +126,8 @@ namespace cryptonote
     bool have_tx(const crypto::hash &id) const;
     bool have_tx_keyimges_as_spent(const transaction &tx) const;
     bool have_tx_keyimg_as_spent(const crypto::key_image &key_im) const;
+    // sets spent[i] to whether key_im[i] is spent, in one db read txn
+    bool have_tx_keyimgs_as_spent(const std::vector<crypto::key_image> &key_im, std::vector<bool> &spent) const;
 
     uint64_t get_current_blockchain_height() const;
     crypto::hash get_tail_id() const;
@@ -134,6 +150,14 @@ namespace cryptonote
 
     bool check_tx_inputs(const transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id, bool kept_by_block = false);
     bool check_tx_outputs(const transaction& tx);
+    // checks the ring signatures of a batch of txs on the worker pool; those
+    // which pass are not checked again by check_tx_inputs until dropped
+    void preverify_tx_inputs(const std::vector<std::pair<crypto::hash, const transaction*>>& txs);
+    void drop_preverified_tx(const crypto::hash& tx_hash);
+    // runs job(0) to job(count - 1) on the worker pool and waits for them;
+    // block hashing waits on that pool under the blockchain lock, so jobs
+    // must not take it
+    void run_on_pool(size_t count, const std::function<void(size_t)>& job);
     uint64_t get_current_cumulative_blocksize_limit() const;
     bool is_storing_blockchain()const{return m_is_blockchain_storing;}
     uint64_t block_difficulty(uint64_t i) const;
@@ -158,6 +182,8 @@ namespace cryptonote
         blockchain_db_sync_mode sync_mode, bool fast_sync);
 
     void set_show_time_stats(bool stats) { m_show_time_stats = stats; }
+    std::vector<block_stage_stats> get_block_stage_stats() const;
+    void reset_block_stage_stats();
 
     HardFork::State get_hard_fork_state() const;
     uint8_t get_current_hard_fork_version() const { return m_hardfork->get_current_version(); }
@@ -183,7 +209,7 @@ namespace cryptonote
         cryptonote::transaction> &txs) const;
 
     void block_longhash_worker(const uint64_t height, const std::vector<block> &blocks,
-        std::unordered_map<crypto::hash, crypto::hash> &map) const;
+        std::atomic<size_t> &next_block, std::vector<crypto::hash> &hashes) const;
   private:
     typedef std::unordered_map<crypto::hash, size_t> blocks_by_id_index;
     typedef std::unordered_map<crypto::hash, transaction_chain_entry> transactions_container;
@@ -193,6 +219,20 @@ namespace cryptonote
     typedef std::unordered_map<crypto::hash, block> blocks_by_hash;
     typedef std::map<uint64_t, std::vector<std::pair<crypto::hash, size_t>>> outputs_container; //crypto::hash - tx hash, size_t - index of out in transaction
 
+    enum block_stage
+    {
+      stage_output_scan,
+      stage_pow,
+      stage_key_images,
+      stage_tx_checks,
+      stage_miner_tx,
+      stage_pool,
+      stage_db_write,
+      stage_total,
+      stage_count
+    };
+    static const size_t block_stage_buckets = 16;
+
     BlockchainDB* m_db;
 
     tx_memory_pool& m_tx_pool;
@@ -207,9 +247,14 @@ namespace cryptonote
     std::unordered_map<crypto::hash, crypto::hash> m_blocks_longhash_table;
     std::unordered_map<crypto::hash, std::unordered_map<crypto::key_image, bool>> m_check_txin_table;
 
+    // txs whose ring signatures preverify_tx_inputs found valid, by tx hash,
+    // with the output keys each input was checked against
+    epee::critical_section m_preverified_txs_lock;
+    std::unordered_map<crypto::hash, std::vector<std::vector<crypto::public_key>>> m_preverified_txs;
+
     // SHA-3 hashes for each block and for fast pow checking
     std::vector<crypto::hash> m_blocks_hash_check;
-    std::vector<crypto::hash> m_blocks_txs_check;
+    std::unordered_set<crypto::hash> m_blocks_txs_check;
 
     blockchain_db_sync_mode m_db_sync_mode;
     bool m_fast_sync;
@@ -219,14 +264,39 @@ namespace cryptonote
     uint64_t m_fake_pow_calc_time;
     uint64_t m_fake_scan_time;
     uint64_t m_sync_counter;
-    std::vector<uint64_t> m_timestamps;
-    std::vector<difficulty_type> m_difficulties;
+    difficulty_window m_difficulty_window;
     uint64_t m_timestamps_and_difficulties_height;
 
+    // block size and timestamp medians over the blocks below m_block_medians_height
+    tools::rolling_median_t<size_t> m_block_sizes_median;
+    tools::rolling_median_t<uint64_t> m_block_timestamps_median;
+    uint64_t m_block_medians_height;
+
+    // per-stage block processing timings, see get_block_stage_stats
+    mutable epee::critical_section m_block_stage_stats_lock;
+    block_stage_stats m_block_stage_stats[stage_count];
+
     boost::asio::io_service m_async_service;
     boost::thread_group m_async_pool;
     std::unique_ptr<boost::asio::io_service::work> m_async_work_idle;
 
+    // threads computing block PoW hashes for prepare_handle_incoming_blocks,
+    // each keeping its slow hash scratchpad for its whole lifetime; also
+    // used for other verification work through run_on_pool
+    boost::asio::io_service m_longhash_service;
+    boost::thread_group m_longhash_pool;
+    std::unique_ptr<boost::asio::io_service::work> m_longhash_work_idle;
+    uint64_t m_longhash_threads;
+
+    // last create_block_template result, reused while the top block, the tx
+    // pool cookie and the requested address and extra nonce are unchanged
+    block m_btc;
+    account_public_address m_btc_address;
+    blobdata m_btc_nonce;
+    difficulty_type m_btc_difficulty;
+    uint64_t m_btc_pool_cookie;
+    bool m_btc_valid;
+
     // all alternative chains
     blocks_ext_by_hash m_alternative_chains; // crypto::hash -> block_extended_info
 
@@ -249,7 +319,9 @@ namespace cryptonote
     bool check_tx_inputs(const transaction& tx, uint64_t* pmax_used_block_height = NULL);
 
     bool switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::iterator>& alt_chain, bool discard_disconnected_chain);
-    block pop_block_from_blockchain();
+    void pop_blocks_from_blockchain(uint64_t nblocks, std::list<block>& popped);
+    void cache_block_template(const block &b, const cryptonote::account_public_address &address, const blobdata &nonce, const difficulty_type &diff, uint64_t pool_cookie);
+    void invalidate_block_template_cache();
 
     bool handle_block_to_main_chain(const block& bl, block_verification_context& bvc);
     bool handle_block_to_main_chain(const block& bl, const crypto::hash& id, block_verification_context& bvc);
@@ -262,12 +334,14 @@ namespace cryptonote
     bool add_transaction_from_block(const transaction& tx, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height);
     bool push_transaction_to_global_outs_index(const transaction& tx, const crypto::hash& tx_id, std::vector<uint64_t>& global_indexes);
     bool pop_transaction_from_global_index(const transaction& tx, const crypto::hash& tx_id);
-    void get_last_n_blocks_sizes(std::vector<size_t>& sz, size_t count) const;
+    void sync_block_medians();
+    void reset_block_medians();
+    void record_block_stage(block_stage stage, uint64_t ms);
     void add_out_to_get_random_outs(COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i) const;
     bool is_tx_spendtime_unlocked(uint64_t unlock_time) const;
     bool add_block_as_invalid(const block& bl, const crypto::hash& h);
     bool add_block_as_invalid(const block_extended_info& bei, const crypto::hash& h);
-    bool check_block_timestamp(const block& b) const;
+    bool check_block_timestamp(const block& b);
     bool check_block_timestamp(std::vector<uint64_t>& timestamps, const block& b) const;
     uint64_t get_adjusted_time() const;
     bool complete_timestamps_vector(uint64_t start_height, std::vector<uint64_t>& timestamps);
@@ -287,5 +361,24 @@ namespace cryptonote
      * a useful state.
      */
     void load_compiled_in_block_hashes();
+
+    /**
+     * @brief picks the number of threads used to compute block PoW hashes
+     *
+     * Uses all available cores, capped by the user's --prep-blocks-threads
+     * setting if any, and by how many slow hash scratchpads fit in the
+     * physical memory currently available.
+     *
+     * @return the number of threads to use
+     */
+    uint64_t get_longhash_threads() const;
+
+    /**
+     * @brief thread function for the PoW hashing pool
+     *
+     * Allocates the thread's slow hash scratchpad once, runs the pool's
+     * io_service, then frees the scratchpad when the pool is shut down.
+     */
+    void longhash_thread();
   };
 }  // namespace cryptonote
@@ -31,6 +31,7 @@
 #pragma once
 #include <unordered_set>
 #include <atomic>
+#include <chrono>
 #include "net/net_utils_base.h"
 #include "copyable_atomic.h"
 
@@ -54,7 +55,14 @@ namespace cryptonote
     uint64_t m_remote_blockchain_height;
     uint64_t m_last_response_height;
     epee::copyable_atomic m_callback_request_count; //in debug purpose: problem with double callback rise
-    //size_t m_score;  TODO: add score calculations
+    // measured over the peer's answers to block requests, to size the next
+    std::chrono::steady_clock::time_point m_sync_request_time;
+    size_t m_sync_batch = 0; // blocks asked for last
+    double m_sync_rate = 0; // bytes/s, including the round trip
+    double m_sync_block_size = 0; // bytes per block
+    double m_sync_latency = 0; // seconds from request to answer
+    uint32_t m_support_flags = 0; // P2P_SUPPORT_FLAG_* from its sync data
+    crypto::hash m_compact_block_pending = crypto::hash(); // compact block whose missing txs were asked for
   };
 
   inline std::string get_protocol_state_string(cryptonote_connection_context::state s)
@@ -145,6 +145,7 @@ namespace cryptonote
     command_line::add_arg(desc, command_line::arg_db_sync_mode);
     command_line::add_arg(desc, command_line::arg_show_time_stats);
     command_line::add_arg(desc, command_line::arg_db_auto_remove_logs);
+    command_line::add_arg(desc, command_line::arg_max_txpool_size);
   }
   //-----------------------------------------------------------------------------------------------
   bool core::handle_command_line(const boost::program_options::variables_map& vm)
@@ -254,7 +255,8 @@ namespace cryptonote
     m_fakechain = test_options != NULL;
     bool r = handle_command_line(vm);
 
-    r = m_mempool.init(m_fakechain ? std::string() : m_config_folder);
+    uint64_t max_txpool_size = command_line::get_arg(vm, command_line::arg_max_txpool_size);
+    r = m_mempool.init(m_fakechain ? std::string() : m_config_folder, max_txpool_size);
     CHECK_AND_ASSERT_MES(r, false, "Failed to initialize memory pool");
 
 #if BLOCKCHAIN_DB == DB_LMDB
@@ -479,11 +481,9 @@ namespace cryptonote
     return false;
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  bool core::handle_incoming_tx_pre(const blobdata& tx_blob, tx_verification_context& tvc, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash, bool keeped_by_block) const
   {
     tvc = boost::value_initialized<tx_verification_context>();
-    //want to process all transactions sequentially
-    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
 
     if(tx_blob.size() > get_max_tx_size())
     {
@@ -492,11 +492,10 @@ namespace cryptonote
       return false;
     }
 
-    crypto::hash tx_hash = null_hash;
-    crypto::hash tx_prefixt_hash = null_hash;
-    transaction tx;
+    tx_hash = null_hash;
+    tx_prefix_hash = null_hash;
 
-    if(!parse_tx_from_blob(tx, tx_hash, tx_prefixt_hash, tx_blob))
+    if(!parse_tx_from_blob(tx, tx_hash, tx_prefix_hash, tx_blob))
     {
       LOG_PRINT_L1("WRONG TRANSACTION BLOB, Failed to parse, rejected");
       tvc.m_verifivation_failed = true;
@@ -518,14 +517,87 @@ namespace cryptonote
       return false;
     }
 
-    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, tx_blob.size(), tvc, keeped_by_block, relayed);
-    if(tvc.m_verifivation_failed)
-    {LOG_PRINT_RED_L1("Transaction verification failed: " << tx_hash);}
-    else if(tvc.m_verifivation_impossible)
-    {LOG_PRINT_RED_L1("Transaction verification impossible: " << tx_hash);}
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<tx_verification_context>& tvc, bool keeped_by_block, bool relayed)
+  {
+    std::vector<const blobdata*> blobs;
+    blobs.reserve(tx_blobs.size());
+    for (const auto& tx_blob : tx_blobs)
+      blobs.push_back(&tx_blob);
+
+    tvc.resize(blobs.size());
+    std::vector<transaction> txs(blobs.size());
+    std::vector<crypto::hash> tx_hashes(blobs.size()), tx_prefix_hashes(blobs.size());
+    std::vector<char> parsed(blobs.size(), 0);
+
+    // parsing and the checks which only look at the tx itself need no lock
+    auto pre = [&](size_t i) {
+      parsed[i] = handle_incoming_tx_pre(*blobs[i], tvc[i], txs[i], tx_hashes[i], tx_prefix_hashes[i], keeped_by_block);
+    };
+
+#if BLOCKCHAIN_DB == DB_LMDB
+    m_blockchain_storage.run_on_pool(blobs.size(), pre);
+
+    // ring signatures are checked concurrently too, so that only the key
+    // image checks and the pool insertion below are done one tx at a time;
+    // txs we already have are skipped, as they are when adding them
+    std::vector<std::pair<crypto::hash, const transaction*>> preverify;
+    if (!keeped_by_block)
+    {
+      for (size_t i = 0; i < blobs.size(); ++i)
+      {
+        if (parsed[i] && !m_mempool.have_tx(tx_hashes[i]) && !m_blockchain_storage.have_tx(tx_hashes[i]))
+          preverify.push_back(std::make_pair(tx_hashes[i], &txs[i]));
+      }
+      m_blockchain_storage.preverify_tx_inputs(preverify);
+    }
+#else
+    for (size_t i = 0; i < blobs.size(); ++i)
+      pre(i);
+#endif
+
+    bool ok = true;
+    {
+      //want to process all transactions sequentially
+      CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+      for (size_t i = 0; i < blobs.size(); ++i)
+      {
+        if (!parsed[i])
+        {
+          ok = false;
+          continue;
+        }
+
+        bool r = add_new_tx(txs[i], tx_hashes[i], tx_prefix_hashes[i], blobs[i]->size(), tvc[i], keeped_by_block, relayed);
+        if(tvc[i].m_verifivation_failed)
+        {LOG_PRINT_RED_L1("Transaction verification failed: " << tx_hashes[i]);}
+        else if(tvc[i].m_verifivation_impossible)
+        {LOG_PRINT_RED_L1("Transaction verification impossible: " << tx_hashes[i]);}
+
+        if(tvc[i].m_added_to_pool)
+          LOG_PRINT_L1("tx added: " << tx_hashes[i]);
+        if (!r)
+          ok = false;
+      }
+    }
 
-    if(tvc.m_added_to_pool)
-      LOG_PRINT_L1("tx added: " << tx_hash);
+#if BLOCKCHAIN_DB == DB_LMDB
+    for (const auto& tx : preverify)
+      m_blockchain_storage.drop_preverified_tx(tx.first);
+#endif
+    return ok;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed)
+  {
+    std::list<blobdata> tx_blobs;
+    tx_blobs.push_back(tx_blob);
+    std::vector<tx_verification_context> tvcs;
+    bool r = handle_incoming_txs(tx_blobs, tvcs, keeped_by_block, relayed);
+    tvc = tvcs[0];
     return r;
   }
   //-----------------------------------------------------------------------------------------------
@@ -600,12 +672,22 @@ namespace cryptonote
   //-----------------------------------------------------------------------------------------------
   bool core::are_key_images_spent(const std::vector<crypto::key_image>& key_im, std::vector<bool> &spent) const
   {
+#if BLOCKCHAIN_DB == DB_LMDB
+    return m_blockchain_storage.have_tx_keyimgs_as_spent(key_im, spent);
+#else
     spent.clear();
     BOOST_FOREACH(auto& ki, key_im)
     {
       spent.push_back(m_blockchain_storage.have_tx_keyimg_as_spent(ki));
     }
     return true;
+#endif
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::are_key_images_spent_in_pool(const std::vector<crypto::key_image>& key_im, std::vector<bool> &spent) const
+  {
+    m_mempool.check_for_key_images(key_im, spent);
+    return true;
   }
   //-----------------------------------------------------------------------------------------------
   bool core::check_tx_inputs_keyimages_diff(const transaction& tx) const
@@ -848,6 +930,16 @@ namespace cryptonote
     return m_mempool.get_transactions_count();
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::get_pool_transaction(const crypto::hash &id, transaction& tx) const
+  {
+    return m_mempool.get_transaction(id, tx);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::have_tx(const crypto::hash &id) const
+  {
+    return m_mempool.have_tx(id) || m_blockchain_storage.have_tx(id);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::have_block(const crypto::hash& id) const
   {
     return m_blockchain_storage.have_block(id);
@@ -869,6 +961,11 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::get_pool_changes_since(uint64_t since, uint64_t &sequence, std::list<std::pair<crypto::hash, blobdata>> &added, std::list<crypto::hash> &removed) const
+  {
+    return m_mempool.get_changes_since(since, sequence, added, removed);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::get_pool_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
   {
     return m_mempool.get_transactions_and_spent_keys_info(tx_infos, key_image_infos);
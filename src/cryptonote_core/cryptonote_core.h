@@ -70,6 +70,7 @@ namespace cryptonote
      bool handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NOTIFY_RESPONSE_GET_OBJECTS::request& rsp, cryptonote_connection_context& context);
      bool on_idle();
      bool handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
+     bool handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<tx_verification_context>& tvc, bool keeped_by_block, bool relayed);
      bool handle_incoming_block(const blobdata& block_blob, block_verification_context& bvc, bool update_miner_blocktemplate = true);
      bool prepare_handle_incoming_blocks(const std::list<block_complete_entry>  &blocks);
      bool cleanup_handle_incoming_blocks(bool force_sync = false);
@@ -117,8 +118,11 @@ namespace cryptonote
      void set_enforce_dns_checkpoints(bool enforce_dns);
 
      bool get_pool_transactions(std::list<transaction>& txs) const;
+     bool get_pool_transaction(const crypto::hash& id, transaction& tx) const;
+     bool have_tx(const crypto::hash& id) const; // in the pool or the chain
      bool get_pool_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const;
      size_t get_pool_transactions_count() const;
+     bool get_pool_changes_since(uint64_t since, uint64_t &sequence, std::list<std::pair<crypto::hash, blobdata>> &added, std::list<crypto::hash> &removed) const;
      size_t get_blockchain_total_transactions() const;
      //bool get_outs(uint64_t amount, std::list<crypto::public_key>& pkeys);
      bool have_block(const crypto::hash& id) const;
@@ -132,6 +136,8 @@ namespace cryptonote
      bool get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res) const;
      void pause_mine();
      void resume_mine();
+     tx_memory_pool& get_pool(){return m_mempool;}
+     const tx_memory_pool& get_pool()const{return m_mempool;}
 #if BLOCKCHAIN_DB == DB_LMDB
      Blockchain& get_blockchain_storage(){return m_blockchain_storage;}
      const Blockchain& get_blockchain_storage()const{return m_blockchain_storage;}
@@ -155,6 +161,7 @@ namespace cryptonote
 
      bool is_key_image_spent(const crypto::key_image& key_im) const;
      bool are_key_images_spent(const std::vector<crypto::key_image>& key_im, std::vector<bool> &spent) const;
+     bool are_key_images_spent_in_pool(const std::vector<crypto::key_image>& key_im, std::vector<bool> &spent) const;
 
    private:
      bool add_new_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefix_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block, bool relayed);
@@ -162,6 +169,7 @@ namespace cryptonote
      bool add_new_block(const block& b, block_verification_context& bvc);
      bool load_state_data();
      bool parse_tx_from_blob(transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash, const blobdata& blob) const;
+     bool handle_incoming_tx_pre(const blobdata& tx_blob, tx_verification_context& tvc, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash, bool keeped_by_block) const;
 
      bool check_tx_syntax(const transaction& tx) const;
      //check correct values, amounts and all lightweight checks not related with database
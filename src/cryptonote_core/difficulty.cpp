@@ -116,24 +116,12 @@ namespace cryptonote {
     return !carry;
   }
 
-  difficulty_type next_difficulty(vector<uint64_t> timestamps, vector<difficulty_type> cumulative_difficulties, size_t target_seconds) {
-    //cutoff DIFFICULTY_LAG
-    if(timestamps.size() > DIFFICULTY_WINDOW)
-    {
-      timestamps.resize(DIFFICULTY_WINDOW);
-      cumulative_difficulties.resize(DIFFICULTY_WINDOW);
-    }
-
-
-    size_t length = timestamps.size();
-    assert(length == cumulative_difficulties.size());
+  static bool get_cut(size_t length, size_t &cut_begin, size_t &cut_end) {
     if (length <= 1) {
-      return 1;
+      return false;
     }
     static_assert(DIFFICULTY_WINDOW >= 2, "Window is too small");
     assert(length <= DIFFICULTY_WINDOW);
-    sort(timestamps.begin(), timestamps.end());
-    size_t cut_begin, cut_end;
     static_assert(2 * DIFFICULTY_CUT <= DIFFICULTY_WINDOW - 2, "Cut length is too large");
     if (length <= DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT) {
       cut_begin = 0;
@@ -143,11 +131,13 @@ namespace cryptonote {
       cut_end = cut_begin + (DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT);
     }
     assert(/*cut_begin >= 0 &&*/ cut_begin + 2 <= cut_end && cut_end <= length);
-    uint64_t time_span = timestamps[cut_end - 1] - timestamps[cut_begin];
+    return true;
+  }
+
+  static difficulty_type difficulty_from_span(uint64_t time_span, difficulty_type total_work, size_t target_seconds) {
     if (time_span == 0) {
       time_span = 1;
     }
-    difficulty_type total_work = cumulative_difficulties[cut_end - 1] - cumulative_difficulties[cut_begin];
     assert(total_work > 0);
     uint64_t low, high;
     mul(total_work, target_seconds, low, high);
@@ -157,4 +147,73 @@ namespace cryptonote {
     return (low + time_span - 1) / time_span;
   }
 
+  difficulty_type next_difficulty(vector<uint64_t> timestamps, vector<difficulty_type> cumulative_difficulties, size_t target_seconds) {
+    //cutoff DIFFICULTY_LAG
+    if(timestamps.size() > DIFFICULTY_WINDOW)
+    {
+      timestamps.resize(DIFFICULTY_WINDOW);
+      cumulative_difficulties.resize(DIFFICULTY_WINDOW);
+    }
+
+
+    size_t length = timestamps.size();
+    assert(length == cumulative_difficulties.size());
+    size_t cut_begin, cut_end;
+    if (!get_cut(length, cut_begin, cut_end)) {
+      return 1;
+    }
+    sort(timestamps.begin(), timestamps.end());
+    uint64_t time_span = timestamps[cut_end - 1] - timestamps[cut_begin];
+    difficulty_type total_work = cumulative_difficulties[cut_end - 1] - cumulative_difficulties[cut_begin];
+    return difficulty_from_span(time_span, total_work, target_seconds);
+  }
+
+  difficulty_window::difficulty_window() {
+    m_sorted_timestamps.reserve(DIFFICULTY_WINDOW);
+  }
+
+  void difficulty_window::sorted_insert(uint64_t timestamp) {
+    m_sorted_timestamps.insert(std::upper_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), timestamp), timestamp);
+  }
+
+  void difficulty_window::sorted_erase(uint64_t timestamp) {
+    auto it = std::lower_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), timestamp);
+    assert(it != m_sorted_timestamps.end() && *it == timestamp);
+    m_sorted_timestamps.erase(it);
+  }
+
+  void difficulty_window::push_back(uint64_t timestamp, difficulty_type cumulative_difficulty) {
+    // only the oldest DIFFICULTY_WINDOW entries are indexed, the newer
+    // DIFFICULTY_LAG ones enter the index as older ones get evicted
+    m_timestamps.push_back(timestamp);
+    m_cumulative_difficulties.push_back(cumulative_difficulty);
+    if (m_timestamps.size() <= DIFFICULTY_WINDOW) {
+      sorted_insert(timestamp);
+    }
+    if (m_timestamps.size() > DIFFICULTY_BLOCKS_COUNT) {
+      sorted_erase(m_timestamps.front());
+      m_timestamps.pop_front();
+      m_cumulative_difficulties.pop_front();
+      sorted_insert(m_timestamps[DIFFICULTY_WINDOW - 1]);
+    }
+    assert(m_sorted_timestamps.size() == std::min<size_t>(m_timestamps.size(), DIFFICULTY_WINDOW));
+  }
+
+  void difficulty_window::clear() {
+    m_timestamps.clear();
+    m_cumulative_difficulties.clear();
+    m_sorted_timestamps.clear();
+  }
+
+  difficulty_type difficulty_window::next_difficulty(size_t target_seconds) const {
+    size_t length = m_sorted_timestamps.size();
+    size_t cut_begin, cut_end;
+    if (!get_cut(length, cut_begin, cut_end)) {
+      return 1;
+    }
+    uint64_t time_span = m_sorted_timestamps[cut_end - 1] - m_sorted_timestamps[cut_begin];
+    difficulty_type total_work = m_cumulative_difficulties[cut_end - 1] - m_cumulative_difficulties[cut_begin];
+    return difficulty_from_span(time_span, total_work, target_seconds);
+  }
+
 }
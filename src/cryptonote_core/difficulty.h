@@ -31,6 +31,7 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 #include <vector>
 
 #include "crypto/hash.h"
@@ -41,4 +42,48 @@ namespace cryptonote
 
     bool check_hash(const crypto::hash &hash, difficulty_type difficulty);
     difficulty_type next_difficulty(std::vector<std::uint64_t> timestamps, std::vector<difficulty_type> cumulative_difficulties, size_t target_seconds);
+
+    /**
+     * @brief sliding window of block timestamps and cumulative difficulties
+     *
+     * Holds up to DIFFICULTY_BLOCKS_COUNT entries in chain order and keeps
+     * the timestamps of the oldest DIFFICULTY_WINDOW entries (the ones
+     * next_difficulty looks at, the rest being the lag) in a sorted index,
+     * so adding a block and evicting the oldest one costs a binary search
+     * and a short move instead of a full copy and sort of the window.
+     *
+     * next_difficulty() on a window gives the same result as the free
+     * function called with the window's contents.
+     */
+    class difficulty_window
+    {
+    public:
+      difficulty_window();
+
+      /**
+       * @brief appends the next block, evicting the oldest entry if full
+       *
+       * @param timestamp the block's timestamp
+       * @param cumulative_difficulty the cumulative difficulty up to and including the block
+       */
+      void push_back(std::uint64_t timestamp, difficulty_type cumulative_difficulty);
+
+      void clear();
+
+      size_t size() const { return m_timestamps.size(); }
+      bool empty() const { return m_timestamps.empty(); }
+
+      std::uint64_t timestamp(size_t index) const { return m_timestamps[index]; }
+      difficulty_type cumulative_difficulty(size_t index) const { return m_cumulative_difficulties[index]; }
+
+      difficulty_type next_difficulty(size_t target_seconds) const;
+
+    private:
+      void sorted_insert(std::uint64_t timestamp);
+      void sorted_erase(std::uint64_t timestamp);
+
+      std::deque<std::uint64_t> m_timestamps;
+      std::deque<difficulty_type> m_cumulative_difficulties;
+      std::vector<std::uint64_t> m_sorted_timestamps;
+    };
 }
@@ -30,6 +30,7 @@
 
 #include <algorithm>
 #include <boost/filesystem.hpp>
+#include <chrono>
 #include <unordered_set>
 #include <vector>
 
@@ -58,6 +59,7 @@ namespace cryptonote
     size_t const TRANSACTION_SIZE_LIMIT_V2 = (((CRYPTONOTE_BLOCK_GRANTED_FULL_REWARD_ZONE_V2 * 125) / 100) - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE);
     time_t const MIN_RELAY_TIME = (60 * 5); // only start re-relaying transactions after that many seconds
     time_t const MAX_RELAY_TIME = (60 * 60 * 4); // at most that many seconds between resends
+    size_t const MAX_CHANGE_LOG_ENTRIES = 100000; // txs entering or leaving the pool kept for get_changes_since
 
     // a kind of increasing backoff within min/max bounds
     time_t get_relay_delay(time_t now, time_t received)
@@ -67,16 +69,45 @@ namespace cryptonote
         d = MAX_RELAY_TIME;
       return d;
     }
+
+    tx_by_fee_entry get_sorted_entry(const crypto::hash &id, size_t blob_size, uint64_t fee)
+    {
+      return tx_by_fee_entry((double)fee / blob_size, id);
+    }
+
+    // a rough estimate of the memory a pool tx takes: the parsed tx is about
+    // as large as its blob, then there are its details and the index nodes
+    // for it in the tx map, the fee set and, per input, the key image map
+    size_t get_tx_memory_size(const transaction &tx, size_t blob_size)
+    {
+      static const size_t node_overhead = 4 * sizeof(void*);
+      return blob_size + sizeof(tx_memory_pool::tx_details) + sizeof(crypto::hash) + node_overhead
+        + sizeof(tx_by_fee_entry) + node_overhead
+        + tx.vin.size() * (sizeof(crypto::key_image) + sizeof(crypto::hash) + 2 * node_overhead);
+    }
+
+    tx_pool_log_meta get_log_meta(const tx_memory_pool::tx_details &txd)
+    {
+      tx_pool_log_meta meta;
+      meta.fee = txd.fee;
+      meta.max_used_block_id = txd.max_used_block_id;
+      meta.max_used_block_height = txd.max_used_block_height;
+      meta.receive_time = txd.receive_time;
+      meta.last_relayed_time = txd.last_relayed_time;
+      meta.kept_by_block = txd.kept_by_block;
+      meta.relayed = txd.relayed;
+      return meta;
+    }
   }
   //---------------------------------------------------------------------------------
 #if BLOCKCHAIN_DB == DB_LMDB
   //---------------------------------------------------------------------------------
-  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_blockchain(bchs)
+  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_cookie(0), m_change_sequence(0), m_changes_base(0), m_chain_generation(0), m_txpool_size(0), m_txpool_max_size(DEFAULT_TXPOOL_MAX_SIZE), m_evicted_count(0), m_rejected_count(0), m_blockchain(bchs)
   {
 
   }
 #else
-  tx_memory_pool::tx_memory_pool(blockchain_storage& bchs): m_blockchain(bchs)
+  tx_memory_pool::tx_memory_pool(blockchain_storage& bchs): m_cookie(0), m_change_sequence(0), m_changes_base(0), m_chain_generation(0), m_txpool_size(0), m_txpool_max_size(DEFAULT_TXPOOL_MAX_SIZE), m_evicted_count(0), m_rejected_count(0), m_blockchain(bchs)
   {
 
   }
@@ -161,6 +192,14 @@ namespace cryptonote
     bool ch_inp_res = m_blockchain.check_tx_inputs(tx, max_used_block_height, max_used_block_id);
 #endif
     CRITICAL_REGION_LOCAL(m_transactions_lock);
+    const size_t tx_size = get_tx_memory_size(tx, blob_size);
+    // txs from blocks are always taken, they are only waiting for a reorg
+    if (ch_inp_res && !kept_by_block && !make_room(tx_size, (double)fee / blob_size))
+    {
+      LOG_PRINT_L1("Transaction with id= "<< id << " rejected, the pool is full of transactions paying more per byte");
+      ++m_rejected_count;
+      return false;
+    }
     if(!ch_inp_res)
     {
       if(kept_by_block)
@@ -222,7 +261,12 @@ namespace cryptonote
 
     tvc.m_verifivation_failed = false;
 
-    m_txs_by_fee.emplace((double)blob_size / fee, id);
+    m_txs_by_fee.emplace(get_sorted_entry(id, blob_size, fee));
+    m_txpool_size += tx_size;
+    if (m_pool_log.is_open())
+      m_pool_log.add_tx(id, get_log_meta(m_transactions[id]), tx_to_blob(tx));
+    note_change(id, true);
+    ++m_cookie;
     //succeed
     return true;
   }
@@ -282,23 +326,71 @@ namespace cryptonote
     fee = it->second.fee;
     relayed = it->second.relayed;
     remove_transaction_keyimages(it->second.tx);
+    m_txpool_size -= get_tx_memory_size(it->second.tx, it->second.blob_size);
     m_transactions.erase(it);
     m_txs_by_fee.erase(sorted_it);
+    m_ready_cache.erase(id);
+    m_pool_log.remove_tx(id);
+    note_change(id, false);
+    ++m_cookie;
     return true;
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::on_idle()
   {
     m_remove_stuck_tx_interval.do_call([this](){return remove_stuck_transactions();});
+    m_compact_pool_log_interval.do_call([this](){return compact_pool_log();});
   }
   //---------------------------------------------------------------------------------
   sorted_tx_container::iterator tx_memory_pool::find_tx_in_sorted_container(const crypto::hash& id) const
   {
-    return std::find_if( m_txs_by_fee.begin(), m_txs_by_fee.end()
-                       , [&](const sorted_tx_container::value_type& a){
-                         return a.second == id;
-                       }
-    );
+    auto it = m_transactions.find(id);
+    if (it == m_transactions.end())
+      return m_txs_by_fee.end();
+    return m_txs_by_fee.find(get_sorted_entry(id, it->second.blob_size, it->second.fee));
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::make_room(size_t tx_size, double fee_per_byte)
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (m_txpool_size + tx_size <= m_txpool_max_size)
+      return true;
+
+    // pick the txs paying less per byte than the new one, worst first, and
+    // only drop them if that frees enough room
+    const uint64_t needed = m_txpool_size + tx_size - m_txpool_max_size;
+    uint64_t freed = 0;
+    std::vector<crypto::hash> evicted;
+    for (auto it = m_txs_by_fee.rbegin(); it != m_txs_by_fee.rend() && freed < needed; ++it)
+    {
+      if (it->first >= fee_per_byte)
+        break;
+      auto tx_it = m_transactions.find(it->second);
+      if (tx_it == m_transactions.end() || tx_it->second.kept_by_block)
+        continue;
+      freed += get_tx_memory_size(tx_it->second.tx, tx_it->second.blob_size);
+      evicted.push_back(it->second);
+    }
+    if (freed < needed)
+      return false;
+
+    BOOST_FOREACH(const crypto::hash &id, evicted)
+    {
+      auto it = m_transactions.find(id);
+      LOG_PRINT_L1("Tx " << id << " removed from tx pool to make room for better paying txs");
+      remove_transaction_keyimages(it->second.tx);
+      auto sorted_it = find_tx_in_sorted_container(id);
+      if (sorted_it != m_txs_by_fee.end())
+        m_txs_by_fee.erase(sorted_it);
+      m_ready_cache.erase(id);
+      m_txpool_size -= get_tx_memory_size(it->second.tx, it->second.blob_size);
+      m_pool_log.remove_tx(id);
+      note_change(id, false);
+      m_transactions.erase(it);
+      ++m_evicted_count;
+    }
+    ++m_cookie;
+    return true;
   }
   //---------------------------------------------------------------------------------
   //proper tx_pool handling courtesy of CryptoZoidberg and Boolberry
@@ -323,15 +415,30 @@ namespace cryptonote
         {
           m_txs_by_fee.erase(sorted_it);
         }
+        m_ready_cache.erase(it->first);
+        m_txpool_size -= get_tx_memory_size(it->second.tx, it->second.blob_size);
+        m_pool_log.remove_tx(it->first);
+        note_change(it->first, false);
         m_timed_out_transactions.insert(it->first);
         auto pit = it++;
         m_transactions.erase(pit);
+        ++m_cookie;
       }else
         ++it;
     }
     return true;
   }
   //---------------------------------------------------------------------------------
+  void tx_memory_pool::note_change(const crypto::hash &id, bool added)
+  {
+    m_changes.push_back({++m_change_sequence, id, added});
+    while (m_changes.size() > MAX_CHANGE_LOG_ENTRIES)
+    {
+      m_changes_base = m_changes.front().sequence;
+      m_changes.pop_front();
+    }
+  }
+  //---------------------------------------------------------------------------------
   bool tx_memory_pool::get_relayable_transactions(std::list<std::pair<crypto::hash, cryptonote::transaction>> &txs) const
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -363,7 +470,10 @@ namespace cryptonote
     {
       auto i = m_transactions.find(it->first);
       if (i != m_transactions.end())
+      {
         i->second.last_relayed_time = now;
+        m_pool_log.update_tx(i->first, get_log_meta(i->second));
+      }
     }
   }
   //---------------------------------------------------------------------------------
@@ -380,6 +490,42 @@ namespace cryptonote
       txs.push_back(tx_vt.second.tx);
   }
   //------------------------------------------------------------------
+  bool tx_memory_pool::get_changes_since(uint64_t since, uint64_t &sequence, std::list<std::pair<crypto::hash, blobdata>> &added, std::list<crypto::hash> &removed) const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    sequence = m_change_sequence;
+    if (since == 0 || since < m_changes_base || since > m_change_sequence)
+    {
+      for (const auto& tx_vt : m_transactions)
+        added.push_back(std::make_pair(tx_vt.first, tx_to_blob(tx_vt.second.tx)));
+      return false;
+    }
+
+    // only the net effect matters: whether each tx was in the pool at since
+    // (its first change is leaving) and whether it is now (its last change
+    // is entering)
+    std::unordered_map<crypto::hash, std::pair<bool, bool>> net;
+    auto it = std::upper_bound(m_changes.begin(), m_changes.end(), since, [](uint64_t s, const tx_change &c) { return s < c.sequence; });
+    for (; it != m_changes.end(); ++it)
+    {
+      auto i = net.insert(std::make_pair(it->id, std::make_pair(!it->added, it->added)));
+      if (!i.second)
+        i.first->second.second = it->added;
+    }
+    for (const auto& e : net)
+    {
+      if (e.second.first)
+        removed.push_back(e.first);
+      if (e.second.second)
+      {
+        auto tx_it = m_transactions.find(e.first);
+        if (tx_it != m_transactions.end())
+          added.push_back(std::make_pair(e.first, tx_to_blob(tx_it->second.tx)));
+      }
+    }
+    return true;
+  }
+  //------------------------------------------------------------------
   bool tx_memory_pool::get_transactions_and_spent_keys_info(std::vector<tx_info>& tx_infos, std::vector<spent_key_image_info>& key_image_infos) const
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -426,11 +572,13 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_inc(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    ++m_chain_generation;
     return true;
   }
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::on_blockchain_dec(uint64_t new_block_height, const crypto::hash& top_block_id)
   {
+    ++m_chain_generation;
     return true;
   }
   //---------------------------------------------------------------------------------
@@ -460,6 +608,14 @@ namespace cryptonote
     return m_spent_key_images.end() != m_spent_key_images.find(key_im);
   }
   //---------------------------------------------------------------------------------
+  void tx_memory_pool::check_for_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    spent.resize(key_images.size());
+    for (size_t i = 0; i < key_images.size(); ++i)
+      spent[i] = m_spent_key_images.find(key_images[i]) != m_spent_key_images.end();
+  }
+  //---------------------------------------------------------------------------------
   void tx_memory_pool::lock() const
   {
     m_transactions_lock.lock();
@@ -512,6 +668,19 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::is_transaction_ready_to_go(const crypto::hash& id, tx_details& txd)
+  {
+    // read first, so a chain change while checking gets the tx checked again
+    const uint64_t generation = m_chain_generation;
+    auto it = m_ready_cache.find(id);
+    if (it != m_ready_cache.end() && it->second.first == generation)
+      return it->second.second;
+
+    const bool ready = is_transaction_ready_to_go(txd);
+    m_ready_cache[id] = std::make_pair(generation, ready);
+    return ready;
+  }
+  //---------------------------------------------------------------------------------
   bool tx_memory_pool::have_key_images(const std::unordered_set<crypto::key_image>& k_images, const transaction& tx)
   {
     for(size_t i = 0; i!= tx.vin.size(); i++)
@@ -575,6 +744,11 @@ namespace cryptonote
     auto sorted_it = m_txs_by_fee.begin();
     while (sorted_it != m_txs_by_fee.end())
     {
+      // If we've exceeded the penalty free size,
+      // stop including more tx
+      if (total_size > median_size)
+        break;
+
       auto tx_it = m_transactions.find(sorted_it->second);
 
       // Can not exceed maximum block size
@@ -595,15 +769,10 @@ namespace cryptonote
         continue;
       }
 
-      // If we've exceeded the penalty free size,
-      // stop including more tx
-      if (total_size > median_size)
-        break;
-
       // Skip transactions that are not ready to be
       // included into the blockchain or that are
       // missing key images
-      if (!is_transaction_ready_to_go(tx_it->second) || have_key_images(k_images, tx_it->second.tx))
+      if (!is_transaction_ready_to_go(tx_it->first, tx_it->second) || have_key_images(k_images, tx_it->second.tx))
       {
         sorted_it++;
         continue;
@@ -636,8 +805,13 @@ namespace cryptonote
         {
           m_txs_by_fee.erase(sorted_it);
         }
+        m_ready_cache.erase(it->first);
+        m_txpool_size -= get_tx_memory_size(it->second.tx, it->second.blob_size);
+        m_pool_log.remove_tx(it->first);
+        note_change(it->first, false);
         auto pit = it++;
         m_transactions.erase(pit);
+        ++m_cookie;
         ++n_removed;
         continue;
       }
@@ -646,33 +820,84 @@ namespace cryptonote
     return n_removed;
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::init(const std::string& config_folder)
+  bool tx_memory_pool::init(const std::string& config_folder, uint64_t max_txpool_size)
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
 
+    m_txpool_max_size = max_txpool_size;
+    m_txpool_size = 0;
+
+    m_changes.clear();
+    m_change_sequence = m_changes_base = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
     m_config_folder = config_folder;
     if (m_config_folder.empty())
       return true;
 
+    if (!tools::create_directories_if_necessary(m_config_folder))
+    {
+      LOG_PRINT_L1("Failed to create data directory: " << m_config_folder);
+      return false;
+    }
+
+    // a pool stored as a whole by an older version is loaded once, then
+    // written to a new log
+    std::string log_file_path = config_folder + "/" + CRYPTONOTE_POOLDATA_LOG_FILENAME;
     std::string state_file_path = config_folder + "/" + CRYPTONOTE_POOLDATA_FILENAME;
     boost::system::error_code ec;
-    if(!boost::filesystem::exists(state_file_path, ec))
-      return true;
-    bool res = tools::unserialize_obj_from_file(*this, state_file_path);
-    if(!res)
+    const bool upgrade = !boost::filesystem::exists(log_file_path, ec) && boost::filesystem::exists(state_file_path, ec);
+    if (upgrade)
     {
-      LOG_PRINT_L1("Failed to load memory pool from file " << state_file_path);
+      bool res = tools::unserialize_obj_from_file(*this, state_file_path);
+      if(!res)
+      {
+        LOG_PRINT_L1("Failed to load memory pool from file " << state_file_path);
 
-      m_transactions.clear();
-      m_txs_by_fee.clear();
-      m_spent_key_images.clear();
+        m_transactions.clear();
+        m_txs_by_fee.clear();
+        m_spent_key_images.clear();
+      }
     }
 
+    bool r = m_pool_log.open(log_file_path, [this](const crypto::hash &id, const tx_pool_log_meta &meta, const blobdata &blob) {
+      transaction tx;
+      if (!parse_and_validate_tx_from_blob(blob, tx))
+      {
+        LOG_PRINT_L1("Failed to parse tx " << id << " from the pool log, skipping it");
+        return;
+      }
+      tx_details &txd = m_transactions[id];
+      txd.tx = tx;
+      txd.blob_size = blob.size();
+      txd.fee = meta.fee;
+      txd.max_used_block_id = meta.max_used_block_id;
+      txd.max_used_block_height = meta.max_used_block_height;
+      txd.kept_by_block = meta.kept_by_block;
+      txd.last_failed_height = 0;
+      txd.last_failed_id = null_hash;
+      txd.receive_time = meta.receive_time;
+      txd.last_relayed_time = meta.last_relayed_time;
+      txd.relayed = meta.relayed;
+      for (const auto &in : tx.vin)
+      {
+        if (in.type() == typeid(txin_to_key))
+          m_spent_key_images[boost::get<txin_to_key>(in).k_image].insert(id);
+      }
+    });
+    if (!r)
+      LOG_ERROR("Failed to open the pool log, the pool will not be kept across restarts");
+
+    if (upgrade && r && rewrite_pool_log())
+      boost::filesystem::remove(state_file_path, ec);
+
     // no need to store queue of sorted transactions, as it's easy to generate.
+    m_ready_cache.clear();
     for (const auto& tx : m_transactions)
     {
-      m_txs_by_fee.emplace((double)tx.second.blob_size / tx.second.fee, tx.first);
+      m_txs_by_fee.emplace(get_sorted_entry(tx.first, tx.second.blob_size, tx.second.fee));
+      m_txpool_size += get_tx_memory_size(tx.second.tx, tx.second.blob_size);
     }
+    ++m_cookie;
 
     // Ignore deserialization error
     return true;
@@ -681,21 +906,34 @@ namespace cryptonote
   //---------------------------------------------------------------------------------
   bool tx_memory_pool::deinit()
   {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
     if (m_config_folder.empty())
       return true;
 
-    if (!tools::create_directories_if_necessary(m_config_folder))
-    {
-      LOG_PRINT_L1("Failed to create data directory: " << m_config_folder);
+    // the log is already up to date, this only keeps the next load short
+    compact_pool_log();
+    m_pool_log.close();
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::compact_pool_log()
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_pool_log.needs_compaction())
+      return true;
+    return rewrite_pool_log();
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_memory_pool::rewrite_pool_log()
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+    if (!m_pool_log.start_rewrite())
       return false;
-    }
-
-    std::string state_file_path = m_config_folder + "/" + CRYPTONOTE_POOLDATA_FILENAME;
-    bool res = tools::serialize_obj_to_file(*this, state_file_path);
-    if(!res)
+    for (const auto& tx : m_transactions)
     {
-      LOG_PRINT_L1("Failed to serialize memory pool to file " << state_file_path);
+      if (!m_pool_log.rewrite_tx(tx.first, get_log_meta(tx.second), tx_to_blob(tx.second.tx)))
+        break;
     }
-    return true;
+    return m_pool_log.finish_rewrite();
   }
 }
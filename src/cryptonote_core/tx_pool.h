@@ -31,6 +31,9 @@
 #pragma once
 #include "include_base_utils.h"
 
+#include <atomic>
+#include <cstring>
+#include <deque>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
@@ -43,6 +46,7 @@
 #include "math_helper.h"
 #include "cryptonote_basic_impl.h"
 #include "verification_context.h"
+#include "tx_pool_log.h"
 #include "crypto/hash.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 
@@ -57,17 +61,18 @@ namespace cryptonote
   /*                                                                      */
   /************************************************************************/
 
+  // fee per byte, tx id
   typedef std::pair<double, crypto::hash> tx_by_fee_entry;
   class txCompare
   {
   public:
-    bool operator()(const tx_by_fee_entry& a, const tx_by_fee_entry& b)
+    bool operator()(const tx_by_fee_entry& a, const tx_by_fee_entry& b) const
     {
-      // sort by greatest first, not least
+      // sort by greatest first, not least, then by id so that entries can
+      // be looked up directly
       if (a.first > b.first) return true;
       else if (a.first < b.first) return false;
-      else if (a.second != b.second) return true;
-      else return false;
+      return memcmp(a.second.data, b.second.data, sizeof(a.second.data)) < 0;
     }
   };
 
@@ -95,7 +100,7 @@ namespace cryptonote
     void unlock() const;
 
     // load/store operations
-    bool init(const std::string& config_folder);
+    bool init(const std::string& config_folder, uint64_t max_txpool_size = DEFAULT_TXPOOL_MAX_SIZE);
     bool deinit();
     bool fill_block_template(block &bl, size_t median_size, uint64_t already_generated_coins, size_t &total_size, uint64_t &fee);
     void get_transactions(std::list<transaction>& txs) const;
@@ -106,6 +111,24 @@ namespace cryptonote
     size_t get_transactions_count() const;
     std::string print_pool(bool short_format) const;
     size_t validate(uint8_t version);
+    // sets spent[i] to whether a pool tx spends key_images[i]
+    void check_for_key_images(const std::vector<crypto::key_image>& key_images, std::vector<bool>& spent) const;
+    // changes whenever a transaction enters or leaves the pool
+    uint64_t cookie() const { return m_cookie; }
+    // Gets how the pool changed after change number since: the txs which
+    // came in, with their blobs, and the ids of the txs which left. sequence
+    // is set to the latest change number, to pass as since next time.
+    // Returns false, with the whole pool in added, when since is 0 or older
+    // than the change log goes back.
+    bool get_changes_since(uint64_t since, uint64_t &sequence, std::list<std::pair<crypto::hash, blobdata>> &added, std::list<crypto::hash> &removed) const;
+
+    // estimated memory held by the pool, and the limit enforced on it
+    uint64_t get_txpool_size() const { return m_txpool_size; }
+    uint64_t get_max_txpool_size() const { return m_txpool_max_size; }
+    // txs dropped to make room for better paying ones, and txs turned away
+    // because the pool was full of better paying ones
+    uint64_t get_evicted_count() const { return m_evicted_count; }
+    uint64_t get_rejected_count() const { return m_rejected_count; }
 
     /*bool flush_pool(const std::strig& folder);
     bool inflate_pool(const std::strig& folder);*/
@@ -142,13 +165,19 @@ namespace cryptonote
 
   private:
     bool remove_stuck_transactions();
+    void note_change(const crypto::hash &id, bool added);
     bool have_tx_keyimg_as_spent(const crypto::key_image& key_im) const;
     bool have_tx_keyimges_as_spent(const transaction& tx) const;
     bool remove_transaction_keyimages(const transaction& tx);
     static bool have_key_images(const std::unordered_set<crypto::key_image>& kic, const transaction& tx);
     static bool append_key_images(std::unordered_set<crypto::key_image>& kic, const transaction& tx);
 
+    bool make_room(size_t tx_size, double fee_per_byte);
+    bool compact_pool_log();
+    bool rewrite_pool_log();
+
     bool is_transaction_ready_to_go(tx_details& txd) const;
+    bool is_transaction_ready_to_go(const crypto::hash& id, tx_details& txd);
     typedef std::unordered_map<crypto::hash, tx_details > transactions_container;
     typedef std::unordered_map<crypto::key_image, std::unordered_set<crypto::hash> > key_images_container;
 
@@ -157,14 +186,46 @@ namespace cryptonote
     key_images_container m_spent_key_images;
     epee::math_helper::once_a_time_seconds<30> m_remove_stuck_tx_interval;
 
-    //TODO: add fee_per_kb element to type tx_details and replace this
-    //functionality by just making m_transactions a std::set
+    // txs by fee per byte, best first; the worst is at the back
     sorted_tx_container m_txs_by_fee;
 
     sorted_tx_container::iterator find_tx_in_sorted_container(const crypto::hash& id) const;
 
     std::unordered_set<crypto::hash> m_timed_out_transactions;
 
+    // every tx entering or leaving the pool is written here as it happens,
+    // so the pool is reloaded from it on startup
+    tx_pool_log m_pool_log;
+    epee::math_helper::once_a_time_seconds<60> m_compact_pool_log_interval;
+
+    std::atomic<uint64_t> m_cookie;
+
+    // a tx entering or leaving the pool, numbered in order
+    struct tx_change
+    {
+      uint64_t sequence;
+      crypto::hash id;
+      bool added;
+    };
+    // the latest changes, covering those numbered after m_changes_base up
+    // to m_change_sequence. Numbering starts from the time the pool was
+    // loaded, in microseconds, so it keeps going up across restarts.
+    std::deque<tx_change> m_changes;
+    uint64_t m_change_sequence;
+    uint64_t m_changes_base;
+
+    // whether a tx was ready to go as of a given chain generation, which
+    // on_blockchain_inc/dec bump, so that building block templates only goes
+    // back to the db for txs it has not looked at since the chain changed
+    std::unordered_map<crypto::hash, std::pair<uint64_t, bool>> m_ready_cache;
+    std::atomic<uint64_t> m_chain_generation;
+
+    // estimated bytes held by the txs in the pool, see get_tx_memory_size
+    std::atomic<uint64_t> m_txpool_size;
+    uint64_t m_txpool_max_size;
+    std::atomic<uint64_t> m_evicted_count;
+    std::atomic<uint64_t> m_rejected_count;
+
     //transactions_container m_alternative_transactions;
 
     std::string m_config_folder;
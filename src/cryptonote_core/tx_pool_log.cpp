@@ -0,0 +1,381 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <cstring>
+
+#include "tx_pool_log.h"
+#include "misc_log_ex.h"
+
+namespace cryptonote
+{
+  namespace
+  {
+    const char LOG_MAGIC[8] = { 'X', 'M', 'R', 'P', 'O', 'O', 'L', '\0' };
+    const uint32_t LOG_VERSION = 1;
+    const size_t LOG_HEADER_SIZE = sizeof(LOG_MAGIC) + sizeof(LOG_VERSION);
+
+    enum record_type : uint8_t
+    {
+      record_add = 1,
+      record_update = 2,
+      record_remove = 3,
+    };
+
+    // type, tx hash and payload size, then the payload, then a CRC32
+    const size_t RECORD_HEADER_SIZE = 1 + sizeof(crypto::hash) + sizeof(uint32_t);
+    const size_t RECORD_OVERHEAD = RECORD_HEADER_SIZE + sizeof(uint32_t);
+
+    // leave small logs alone even when they are mostly dead records
+    const uint64_t COMPACTION_MIN_DEAD_SIZE = 16 * 1024 * 1024;
+
+    // pool txs are much smaller than this, anything bigger is corruption
+    const uint32_t MAX_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+    struct log_tx
+    {
+      tx_pool_log_meta meta;
+      blobdata blob;
+      uint64_t record_size;
+    };
+
+    uint32_t checksum(const std::string& data)
+    {
+      boost::crc_32_type crc;
+      crc.process_bytes(data.data(), data.size());
+      return crc.checksum();
+    }
+
+    bool write_header(std::ofstream& file)
+    {
+      file.write(LOG_MAGIC, sizeof(LOG_MAGIC));
+      file.write((const char*)&LOG_VERSION, sizeof(LOG_VERSION));
+      file.flush();
+      return file.good();
+    }
+  }
+  //---------------------------------------------------------------------------------
+  tx_pool_log::tx_pool_log(): m_failed(false), m_file_size(0), m_live_size(0), m_rewrite_size(0)
+  {
+  }
+  //---------------------------------------------------------------------------------
+  tx_pool_log::~tx_pool_log()
+  {
+    close();
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::open(const std::string& path, const tx_handler& f)
+  {
+    close();
+    m_path = path;
+    m_failed = false;
+    m_file_size = 0;
+    m_live_size = 0;
+    m_live.clear();
+
+    // replay what is there, up to the first bad record
+    std::unordered_map<crypto::hash, log_tx> txs;
+    uint64_t good_size = 0;
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(path, ec))
+    {
+      std::ifstream in(path, std::ios_base::binary | std::ios_base::in);
+      if (!in.is_open())
+      {
+        LOG_ERROR("Failed to open tx pool log " << path);
+        return false;
+      }
+
+      char magic[sizeof(LOG_MAGIC)];
+      uint32_t version = 0;
+      in.read(magic, sizeof(magic));
+      in.read((char*)&version, sizeof(version));
+      if (in.good() && !memcmp(magic, LOG_MAGIC, sizeof(magic)) && version == LOG_VERSION)
+      {
+        good_size = LOG_HEADER_SIZE;
+        std::string record;
+        while (true)
+        {
+          record.resize(RECORD_HEADER_SIZE);
+          if (!in.read(&record[0], RECORD_HEADER_SIZE))
+            break;
+          const uint8_t type = record[0];
+          crypto::hash id;
+          uint32_t payload_size;
+          memcpy(&id, &record[1], sizeof(id));
+          memcpy(&payload_size, &record[1 + sizeof(id)], sizeof(payload_size));
+          if (payload_size > MAX_PAYLOAD_SIZE)
+            break;
+          record.resize(RECORD_HEADER_SIZE + payload_size);
+          uint32_t crc;
+          if (!in.read(&record[RECORD_HEADER_SIZE], payload_size) || !in.read((char*)&crc, sizeof(crc)) || crc != checksum(record))
+            break;
+
+          const char* payload = record.data() + RECORD_HEADER_SIZE;
+          if (type == record_add && payload_size >= sizeof(tx_pool_log_meta))
+          {
+            log_tx& tx = txs[id];
+            memcpy(&tx.meta, payload, sizeof(tx.meta));
+            tx.blob.assign(payload + sizeof(tx.meta), payload_size - sizeof(tx.meta));
+            tx.record_size = record.size() + sizeof(crc);
+          }
+          else if (type == record_update && payload_size == sizeof(tx_pool_log_meta))
+          {
+            auto it = txs.find(id);
+            if (it != txs.end())
+              memcpy(&it->second.meta, payload, sizeof(it->second.meta));
+          }
+          else if (type == record_remove)
+          {
+            txs.erase(id);
+          }
+          else
+          {
+            break;
+          }
+          good_size += record.size() + sizeof(crc);
+        }
+      }
+      else
+      {
+        LOG_PRINT_L0("Tx pool log " << path << " has a bad header, starting from an empty pool");
+      }
+    }
+
+    if (good_size > 0)
+    {
+      if (good_size < boost::filesystem::file_size(path, ec))
+      {
+        LOG_PRINT_L0("Tx pool log " << path << " has a bad record at offset " << good_size << ", dropping the rest");
+        boost::filesystem::resize_file(path, good_size, ec);
+        if (ec)
+        {
+          LOG_ERROR("Failed to truncate tx pool log " << path << ": " << ec.message());
+          return false;
+        }
+      }
+      m_file.open(path, std::ios_base::binary | std::ios_base::out | std::ios_base::app);
+    }
+    else
+    {
+      m_file.open(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+      if (m_file.is_open() && !write_header(m_file))
+        m_file.close();
+      good_size = LOG_HEADER_SIZE;
+    }
+    if (!m_file.is_open())
+    {
+      LOG_ERROR("Failed to open tx pool log " << path << " for writing");
+      return false;
+    }
+    m_file_size = good_size;
+
+    for (const auto& tx : txs)
+    {
+      m_live.emplace(tx.first, tx.second.record_size);
+      m_live_size += tx.second.record_size;
+      f(tx.first, tx.second.meta, tx.second.blob);
+    }
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  void tx_pool_log::close()
+  {
+    if (m_rewrite_file.is_open())
+    {
+      m_rewrite_file.close();
+      boost::system::error_code ec;
+      boost::filesystem::remove(m_path + ".tmp", ec);
+    }
+    if (m_file.is_open())
+      m_file.close();
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::append(std::ofstream& file, uint8_t type, const crypto::hash& id, const tx_pool_log_meta* meta, const blobdata* blob)
+  {
+    const uint32_t payload_size = (meta ? sizeof(*meta) : 0) + (blob ? blob->size() : 0);
+    std::string record;
+    record.reserve(RECORD_OVERHEAD + payload_size);
+    record.push_back(type);
+    record.append((const char*)&id, sizeof(id));
+    record.append((const char*)&payload_size, sizeof(payload_size));
+    if (meta)
+      record.append((const char*)meta, sizeof(*meta));
+    if (blob)
+      record.append(*blob);
+    const uint32_t crc = checksum(record);
+    record.append((const char*)&crc, sizeof(crc));
+
+    // one write per record, flushed, so a crash leaves at worst a torn last
+    // record, which open() cuts off
+    file.write(record.data(), record.size());
+    file.flush();
+    return file.good();
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::add_tx(const crypto::hash& id, const tx_pool_log_meta& meta, const blobdata& blob)
+  {
+    if (!m_file.is_open() || m_failed)
+      return false;
+    if (!append(m_file, record_add, id, &meta, &blob))
+    {
+      LOG_ERROR("Failed to write to tx pool log " << m_path);
+      m_failed = true;
+      return false;
+    }
+    const uint64_t record_size = RECORD_OVERHEAD + sizeof(meta) + blob.size();
+    m_file_size += record_size;
+    auto it = m_live.find(id);
+    if (it != m_live.end())
+    {
+      m_live_size -= it->second;
+      it->second = record_size;
+    }
+    else
+    {
+      m_live.emplace(id, record_size);
+    }
+    m_live_size += record_size;
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::update_tx(const crypto::hash& id, const tx_pool_log_meta& meta)
+  {
+    if (!m_file.is_open() || m_failed)
+      return false;
+    if (!append(m_file, record_update, id, &meta, NULL))
+    {
+      LOG_ERROR("Failed to write to tx pool log " << m_path);
+      m_failed = true;
+      return false;
+    }
+    m_file_size += RECORD_OVERHEAD + sizeof(meta);
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::remove_tx(const crypto::hash& id)
+  {
+    if (!m_file.is_open() || m_failed)
+      return false;
+    if (!append(m_file, record_remove, id, NULL, NULL))
+    {
+      LOG_ERROR("Failed to write to tx pool log " << m_path);
+      m_failed = true;
+      return false;
+    }
+    m_file_size += RECORD_OVERHEAD;
+    auto it = m_live.find(id);
+    if (it != m_live.end())
+    {
+      m_live_size -= it->second;
+      m_live.erase(it);
+    }
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::needs_compaction() const
+  {
+    if (!m_file.is_open())
+      return false;
+    if (m_failed)
+      return true;
+    const uint64_t dead_size = m_file_size - LOG_HEADER_SIZE - m_live_size;
+    return dead_size > m_live_size && dead_size > COMPACTION_MIN_DEAD_SIZE;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::start_rewrite()
+  {
+    if (!m_file.is_open())
+      return false;
+    m_rewrite_file.open(m_path + ".tmp", std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    if (!m_rewrite_file.is_open() || !write_header(m_rewrite_file))
+    {
+      LOG_ERROR("Failed to create " << m_path << ".tmp");
+      m_rewrite_file.close();
+      return false;
+    }
+    m_rewrite_size = LOG_HEADER_SIZE;
+    m_rewrite_live.clear();
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::rewrite_tx(const crypto::hash& id, const tx_pool_log_meta& meta, const blobdata& blob)
+  {
+    if (!m_rewrite_file.is_open())
+      return false;
+    if (!append(m_rewrite_file, record_add, id, &meta, &blob))
+      return false;
+    const uint64_t record_size = RECORD_OVERHEAD + sizeof(meta) + blob.size();
+    m_rewrite_size += record_size;
+    m_rewrite_live[id] = record_size;
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool tx_pool_log::finish_rewrite()
+  {
+    if (!m_rewrite_file.is_open())
+      return false;
+    const bool good = m_rewrite_file.good();
+    m_rewrite_file.close();
+    const std::string tmp_path = m_path + ".tmp";
+    boost::system::error_code ec;
+    if (!good)
+    {
+      LOG_ERROR("Failed to write " << tmp_path);
+      boost::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+
+    // the rename is atomic, a crash leaves either the old or the new log
+    m_file.close();
+    boost::filesystem::rename(tmp_path, m_path, ec);
+    const bool renamed = !ec;
+    if (!renamed)
+    {
+      LOG_ERROR("Failed to replace tx pool log " << m_path << ": " << ec.message());
+      boost::filesystem::remove(tmp_path, ec);
+    }
+    m_file.open(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::app);
+    if (!m_file.is_open())
+    {
+      LOG_ERROR("Failed to open tx pool log " << m_path << " for writing");
+      m_failed = true;
+      return false;
+    }
+    if (!renamed)
+      return false;
+
+    m_failed = false;
+    m_file_size = m_rewrite_size;
+    m_live_size = m_rewrite_size - LOG_HEADER_SIZE;
+    m_live.swap(m_rewrite_live);
+    m_rewrite_live.clear();
+    return true;
+  }
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "crypto/hash.h"
+#include "cryptonote_protocol/blobdatatype.h"
+
+namespace cryptonote
+{
+#pragma pack(push, 1)
+  // what the pool keeps about a tx besides its blob
+  struct tx_pool_log_meta
+  {
+    uint64_t fee;
+    crypto::hash max_used_block_id;
+    uint64_t max_used_block_height;
+    uint64_t receive_time;
+    uint64_t last_relayed_time;
+    uint8_t kept_by_block;
+    uint8_t relayed;
+  };
+#pragma pack(pop)
+
+  /************************************************************************/
+  /*                                                                      */
+  /************************************************************************/
+  // Append-only log of the txs entering and leaving the pool, so the pool
+  // survives restarts and crashes without being written out as a whole.
+  //
+  // Layout: an 8 byte magic and a 4 byte version, then records, each a
+  // 1 byte type (add, update, remove), the 32 byte tx hash, a 4 byte payload
+  // size, the payload (meta and blob for add, meta for update, nothing for
+  // remove) and a 4 byte CRC32 of all that. All integers are little endian.
+  // A torn or corrupt tail, as left by a crash, is cut off when opening.
+  //
+  // Once removed and superseded records make up most of the file, the
+  // owner rewrites it with just the live txs, see needs_compaction.
+  class tx_pool_log
+  {
+  public:
+    typedef std::function<void(const crypto::hash&, const tx_pool_log_meta&, const blobdata&)> tx_handler;
+
+    tx_pool_log();
+    ~tx_pool_log();
+
+    // replays the log at <path>, creating it if needed, calls <f> for each
+    // tx still in it, and leaves it open for appending
+    bool open(const std::string& path, const tx_handler& f);
+    void close();
+    bool is_open() const { return m_file.is_open(); }
+
+    bool add_tx(const crypto::hash& id, const tx_pool_log_meta& meta, const blobdata& blob);
+    bool update_tx(const crypto::hash& id, const tx_pool_log_meta& meta);
+    bool remove_tx(const crypto::hash& id);
+
+    bool needs_compaction() const;
+    // writes a new log holding only the txs given to rewrite_tx, then
+    // replaces the current one with it
+    bool start_rewrite();
+    bool rewrite_tx(const crypto::hash& id, const tx_pool_log_meta& meta, const blobdata& blob);
+    bool finish_rewrite();
+
+  private:
+    bool append(std::ofstream& file, uint8_t type, const crypto::hash& id, const tx_pool_log_meta* meta, const blobdata* blob);
+
+    std::string m_path;
+    std::ofstream m_file;
+    std::ofstream m_rewrite_file;
+    // set when a write failed, the log then waits to be rewritten
+    bool m_failed;
+
+    // bytes in the file, and bytes of the add record of each live tx
+    uint64_t m_file_size;
+    uint64_t m_live_size;
+    uint64_t m_rewrite_size;
+    std::unordered_map<crypto::hash, uint64_t> m_live;
+    std::unordered_map<crypto::hash, uint64_t> m_rewrite_live;
+  };
+}
@@ -0,0 +1,173 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <limits>
+#include "block_queue.h"
+
+namespace cryptonote
+{
+  //---------------------------------------------------------------------------------
+  bool block_queue::reserve_span(uint64_t first_height, const std::list<crypto::hash> &hashes, size_t max_blocks, size_t max_size, const boost::uuids::uuid &connection_id, uint64_t &start_height, std::list<crypto::hash> &span_hashes)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    uint64_t height = first_height;
+    auto hash_it = hashes.begin();
+
+    // walk past the heights queued spans cover, from the one starting at or
+    // before first_height, if any
+    auto span_it = m_spans.upper_bound(height);
+    if (span_it != m_spans.begin())
+      --span_it;
+    while (hash_it != hashes.end())
+    {
+      while (span_it != m_spans.end() && span_it->first + span_it->second.hashes.size() <= height)
+        ++span_it;
+      if (span_it == m_spans.end() || span_it->first > height)
+        break;
+      const uint64_t end = span_it->first + span_it->second.hashes.size();
+      while (height < end && hash_it != hashes.end())
+      {
+        ++height;
+        ++hash_it;
+      }
+    }
+    if (hash_it == hashes.end())
+      return false;
+    if (m_data_size >= max_size && !m_spans.empty() && height > m_spans.begin()->first)
+      return false;
+
+    // up to the next span, if any
+    const uint64_t limit = span_it == m_spans.end() ? std::numeric_limits<uint64_t>::max() : span_it->first;
+    span s;
+    s.start_height = height;
+    while (hash_it != hashes.end() && s.hashes.size() < max_blocks && height < limit)
+    {
+      s.hashes.push_back(*hash_it++);
+      ++height;
+    }
+    s.connection_id = connection_id;
+    s.size = 0;
+    s.reserved_time = time(NULL);
+
+    start_height = s.start_height;
+    span_hashes = s.hashes;
+    m_spans.insert(std::make_pair(s.start_height, std::move(s)));
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool block_queue::add_blocks(const boost::uuids::uuid &connection_id, std::list<block_complete_entry> &blocks, size_t size)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    for (auto &s : m_spans)
+    {
+      if (s.second.connection_id == connection_id && s.second.blocks.empty())
+      {
+        s.second.blocks.swap(blocks);
+        s.second.size = size;
+        m_data_size += size;
+        return true;
+      }
+    }
+    return false;
+  }
+  //---------------------------------------------------------------------------------
+  bool block_queue::get_next_span(uint64_t height, span &s)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    if (m_spans.empty())
+      return false;
+    auto it = m_spans.begin();
+    if (it->second.blocks.empty() || it->first > height)
+      return false;
+    s = std::move(it->second);
+    m_data_size -= s.size;
+    m_spans.erase(it);
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  bool block_queue::has_next_span(uint64_t height) const
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    if (m_spans.empty())
+      return false;
+    auto it = m_spans.begin();
+    return !it->second.blocks.empty() && it->first <= height;
+  }
+  //---------------------------------------------------------------------------------
+  void block_queue::flush_spans(const boost::uuids::uuid &connection_id, bool all)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    for (auto it = m_spans.begin(); it != m_spans.end(); )
+    {
+      if (it->second.connection_id == connection_id && (all || it->second.blocks.empty()))
+      {
+        m_data_size -= it->second.size;
+        it = m_spans.erase(it);
+      }
+      else
+        ++it;
+    }
+  }
+  //---------------------------------------------------------------------------------
+  size_t block_queue::flush_stale_spans(time_t timeout)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    const time_t now = time(NULL);
+    size_t n_flushed = 0;
+    for (auto it = m_spans.begin(); it != m_spans.end(); )
+    {
+      if (it->second.blocks.empty() && now - it->second.reserved_time > timeout)
+      {
+        it = m_spans.erase(it);
+        ++n_flushed;
+      }
+      else
+        ++it;
+    }
+    return n_flushed;
+  }
+  //---------------------------------------------------------------------------------
+  void block_queue::clear()
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    m_spans.clear();
+    m_data_size = 0;
+  }
+  //---------------------------------------------------------------------------------
+  size_t block_queue::get_data_size() const
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    return m_data_size;
+  }
+  //---------------------------------------------------------------------------------
+  size_t block_queue::get_num_spans() const
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    return m_spans.size();
+  }
+}
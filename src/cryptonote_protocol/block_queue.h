@@ -0,0 +1,92 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <boost/uuid/uuid.hpp>
+#include "crypto/hash.h"
+#include "cryptonote_protocol_defs.h"
+#include "syncobj.h"
+
+namespace cryptonote
+{
+  /**
+   * Blocks being downloaded from several peers at once.
+   *
+   * The heights to fetch are split into spans, each reserved by the one
+   * connection downloading it, so peers fetch disjoint ranges in parallel.
+   * Spans arrive in any order and are handed back in height order, once the
+   * one at the front has arrived, to be added to the chain.
+   */
+  class block_queue
+  {
+  public:
+    struct span
+    {
+      uint64_t start_height;
+      std::list<crypto::hash> hashes;
+      std::list<block_complete_entry> blocks; // empty until it arrives
+      boost::uuids::uuid connection_id;
+      size_t size; // bytes of blocks and txs, once arrived
+      time_t reserved_time;
+    };
+
+    block_queue(): m_data_size(0) {}
+
+    // Reserves, for connection_id, the lowest run of at most max_blocks of
+    // the heights of hashes, the first of which is at first_height, that no
+    // span covers yet. Once max_size bytes have arrived and are waiting, only
+    // a run below all the queued spans is given out, as that is what holds
+    // them up. Returns false if there is nothing to give out.
+    bool reserve_span(uint64_t first_height, const std::list<crypto::hash> &hashes, size_t max_blocks, size_t max_size, const boost::uuids::uuid &connection_id, uint64_t &start_height, std::list<crypto::hash> &span_hashes);
+    // fills the span connection_id is downloading; false if it was dropped
+    bool add_blocks(const boost::uuids::uuid &connection_id, std::list<block_complete_entry> &blocks, size_t size);
+    // moves out the span at the front if it has arrived and starts at or
+    // below height, i.e. it can be added to a chain that high
+    bool get_next_span(uint64_t height, span &s);
+    bool has_next_span(uint64_t height) const;
+    // drops the spans connection_id is still downloading, or all its spans
+    void flush_spans(const boost::uuids::uuid &connection_id, bool all = false);
+    // drops the spans reserved more than timeout seconds ago which have not
+    // arrived yet, returns how many
+    size_t flush_stale_spans(time_t timeout);
+    void clear();
+
+    size_t get_data_size() const;
+    size_t get_num_spans() const;
+
+  private:
+    // by start height, not overlapping
+    std::map<uint64_t, span> m_spans;
+    size_t m_data_size;
+    mutable epee::critical_section m_lock;
+  };
+}
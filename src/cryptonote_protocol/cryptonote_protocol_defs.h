@@ -70,6 +70,10 @@ namespace cryptonote
 	uint64_t avg_upload;
 	uint64_t current_upload;
 
+    uint64_t sync_batch; // blocks asked for at a time
+    uint64_t sync_rate; // kB/s its blocks come at
+    uint64_t sync_latency; // ms a blocks request takes
+
     BEGIN_KV_SERIALIZE_MAP()
       KV_SERIALIZE(incoming)
       KV_SERIALIZE(localhost)
@@ -87,6 +91,9 @@ namespace cryptonote
       KV_SERIALIZE(current_download)
       KV_SERIALIZE(avg_upload)
       KV_SERIALIZE(current_upload)
+      KV_SERIALIZE(sync_batch)
+      KV_SERIALIZE(sync_rate)
+      KV_SERIALIZE(sync_latency)
     END_KV_SERIALIZE_MAP()
   };
 
@@ -185,10 +192,12 @@ namespace cryptonote
   {
     uint64_t current_height;
     crypto::hash  top_id;
+    uint32_t support_flags = 0; // P2P_SUPPORT_FLAG_*, left 0 by older peers
 
     BEGIN_KV_SERIALIZE_MAP()
       KV_SERIALIZE(current_height)
       KV_SERIALIZE_VAL_POD_AS_BLOB(top_id)
+      KV_SERIALIZE(support_flags)
     END_KV_SERIALIZE_MAP()
   };
 
@@ -214,7 +223,7 @@ namespace cryptonote
     {
       uint64_t start_height;
       uint64_t total_height;
-      std::list<crypto::hash> m_block_ids;
+      std::vector<crypto::hash> m_block_ids;
 
       BEGIN_KV_SERIALIZE_MAP()
         KV_SERIALIZE(start_height)
@@ -224,4 +233,78 @@ namespace cryptonote
     };
   };
 
+  /************************************************************************/
+  /* Block relayed without the transactions the receiver most likely     */
+  /* already has in its pool: b.block alone, whose tx_hashes name them.   */
+  /* Also the answer to NOTIFY_REQUEST_COMPACT_MISSING_TXS, then with     */
+  /* b.txs holding the transactions asked for.                            */
+  /************************************************************************/
+  struct NOTIFY_NEW_COMPACT_BLOCK
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 8;
+
+    struct request
+    {
+      block_complete_entry b;
+      uint64_t current_blockchain_height;
+      uint32_t hop;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(b)
+        KV_SERIALIZE(current_blockchain_height)
+        KV_SERIALIZE(hop)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct NOTIFY_REQUEST_COMPACT_MISSING_TXS
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 9;
+
+    struct request
+    {
+      crypto::hash block_hash;
+      uint64_t current_blockchain_height;
+      std::vector<uint64_t> missing_tx_indices; // into the block's tx_hashes
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_VAL_POD_AS_BLOB(block_hash)
+        KV_SERIALIZE(current_blockchain_height)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(missing_tx_indices)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  /************************************************************************/
+  /* Hashes of new txs, the peer asks for those it lacks with             */
+  /* NOTIFY_REQUEST_TXS and gets them as NOTIFY_NEW_TRANSACTIONS.         */
+  /************************************************************************/
+  struct NOTIFY_TX_INVENTORY
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 10;
+
+    struct request
+    {
+      std::vector<crypto::hash> tx_hashes;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(tx_hashes)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct NOTIFY_REQUEST_TXS
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 11;
+
+    struct request
+    {
+      std::vector<crypto::hash> tx_hashes;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(tx_hashes)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
 }
@@ -71,7 +71,7 @@
 #include <boost/asio/ip/unicast.hpp>
 
 #include "../../src/cryptonote_protocol/cryptonote_protocol_handler.h"
-#include "../../src/p2p/network_throttle.hpp"
+#include "../../src/p2p/network_throttle-detail.hpp"
 
 #include "../../contrib/otshell_utils/utils.hpp"
 using namespace nOT::nUtils;
@@ -144,13 +144,8 @@ void cryptonote_protocol_handler_base::handler_response_blocks_now(size_t packet
 			return;
 		}*/
 
-		{ 
-	  	CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-			delay = network_throttle_manager::get_global_throttle_out().get_sleep_time_after_tick( packet_size ); // decission from global
-		}
+		delay = network_throttle_manager::get_global_bucket_out().get_delay( packet_size ); // decission from global
 
-		
-		delay *= 0.50;
 		//delay = 0; // XXX
 		if (delay > 0) {
 			//delay += rand2*0.1;
@@ -163,12 +158,7 @@ void cryptonote_protocol_handler_base::handler_response_blocks_now(size_t packet
 	} while(delay > 0);
 
 // XXX LATER XXX
-	{
-	  CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-		network_throttle_manager::get_global_throttle_out().handle_trafic_tcp( packet_size ); // increase counter - global
-		//epee::critical_region_t<decltype(m_throttle_global_lock)> guard(m_throttle_global_lock); // *** critical *** 
-		//m_throttle_global.m_out.handle_trafic_tcp( packet_size ); // increase counter - global
-	}
+	network_throttle_manager::get_global_bucket_out().consume( packet_size ); // increase counter - global
 }
 
 } // namespace
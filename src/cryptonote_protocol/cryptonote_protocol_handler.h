@@ -37,11 +37,18 @@
 #include <boost/program_options/variables_map.hpp>
 #include <string>
 #include <ctime>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "storages/levin_abstract_invoke2.h"
 #include "warnings.h"
 #include "cryptonote_protocol_defs.h"
 #include "cryptonote_protocol_handler_common.h"
+#include "block_queue.h"
 #include "cryptonote_core/connection_context.h"
 #include "cryptonote_core/cryptonote_stat_info.h"
 #include "cryptonote_core/verification_context.h"
@@ -91,6 +98,10 @@ namespace cryptonote
       HANDLE_NOTIFY_T2(NOTIFY_RESPONSE_GET_OBJECTS, &cryptonote_protocol_handler::handle_response_get_objects)
       HANDLE_NOTIFY_T2(NOTIFY_REQUEST_CHAIN, &cryptonote_protocol_handler::handle_request_chain)
       HANDLE_NOTIFY_T2(NOTIFY_RESPONSE_CHAIN_ENTRY, &cryptonote_protocol_handler::handle_response_chain_entry)
+      HANDLE_NOTIFY_T2(NOTIFY_NEW_COMPACT_BLOCK, &cryptonote_protocol_handler::handle_notify_new_compact_block)
+      HANDLE_NOTIFY_T2(NOTIFY_REQUEST_COMPACT_MISSING_TXS, &cryptonote_protocol_handler::handle_request_compact_missing_txs)
+      HANDLE_NOTIFY_T2(NOTIFY_TX_INVENTORY, &cryptonote_protocol_handler::handle_notify_tx_inventory)
+      HANDLE_NOTIFY_T2(NOTIFY_REQUEST_TXS, &cryptonote_protocol_handler::handle_request_txs)
     END_INVOKE_MAP2()
 
     bool on_idle();
@@ -103,10 +114,16 @@ namespace cryptonote
     bool get_payload_sync_data(CORE_SYNC_DATA& hshd);
     bool get_stat_info(core_stat_info& stat_inf);
     bool on_callback(cryptonote_connection_context& context);
+    void on_connection_close(cryptonote_connection_context& context);
+    // what was measured of the peer, for the p2p layer to rank peers by
+    void get_peer_score(const cryptonote_connection_context& context, nodetool::peer_score& score);
     t_core& get_core(){return m_core;}
     bool is_synchronized(){return m_synchronized;}
     void log_connections();
     std::list<connection_info> get_connections();
+    // asks the next peer which announced them for the txs the peer asked
+    // did not send by now; on_idle
+    void request_timed_out_txs(time_t now);
   private:
     //----------------- commands handlers ----------------------------------------------
     int handle_notify_new_block(int command, NOTIFY_NEW_BLOCK::request& arg, cryptonote_connection_context& context);
@@ -115,6 +132,10 @@ namespace cryptonote
     int handle_response_get_objects(int command, NOTIFY_RESPONSE_GET_OBJECTS::request& arg, cryptonote_connection_context& context);
     int handle_request_chain(int command, NOTIFY_REQUEST_CHAIN::request& arg, cryptonote_connection_context& context);
     int handle_response_chain_entry(int command, NOTIFY_RESPONSE_CHAIN_ENTRY::request& arg, cryptonote_connection_context& context);
+    int handle_notify_new_compact_block(int command, NOTIFY_NEW_COMPACT_BLOCK::request& arg, cryptonote_connection_context& context);
+    int handle_request_compact_missing_txs(int command, NOTIFY_REQUEST_COMPACT_MISSING_TXS::request& arg, cryptonote_connection_context& context);
+    int handle_notify_tx_inventory(int command, NOTIFY_TX_INVENTORY::request& arg, cryptonote_connection_context& context);
+    int handle_request_txs(int command, NOTIFY_REQUEST_TXS::request& arg, cryptonote_connection_context& context);
 
 
     //----------------- i_bc_protocol_layout ---------------------------------------
@@ -123,6 +144,23 @@ namespace cryptonote
     //----------------------------------------------------------------------------------
     //bool get_payload_sync_data(HANDSHAKE_DATA::request& hshd, cryptonote_connection_context& context);
     bool request_missing_objects(cryptonote_connection_context& context, bool check_having_blocks);
+    // sizes block requests to a peer by how fast its blocks come, and how large
+    void update_sync_stats(cryptonote_connection_context& context, size_t bytes, size_t blocks);
+    size_t get_sync_batch_count(const cryptonote_connection_context& context) const;
+    // false if enough others fetch blocks much faster, so this one should wait
+    bool is_good_sync_source(const cryptonote_connection_context& context);
+    // adds the downloaded spans which are next, returns false if context was dropped
+    bool process_queued_blocks(cryptonote_connection_context& context);
+    bool add_span_blocks(const block_queue::span& span, bool& add_fail);
+    void wake_parked_connections();
+    void drop_connection(const boost::uuids::uuid& connection_id, bool add_fail);
+    void add_known_txs(const boost::uuids::uuid& connection_id, const std::vector<crypto::hash>& tx_hashes);
+    // with m_tx_inventory_lock held, the tx no longer waits on the peers
+    // which announced it
+    void release_tx_announcer(const boost::uuids::uuid& connection_id);
+    void erase_requested_tx(const crypto::hash& tx_hash);
+    // sends the announcements queued since the last call, on_idle
+    void announce_queued_txs();
     size_t get_synchronizing_connections_count();
     bool on_connection_synchronized();
     t_core& m_core;
@@ -133,6 +171,47 @@ namespace cryptonote
     std::atomic<bool> m_synchronized;
     bool m_one_request = true;
 
+    // blocks downloaded from the synchronizing connections, each fetching
+    // its own span, waiting to be added in order under m_sync_lock
+    block_queue m_block_queue;
+    std::mutex m_sync_lock;
+    // connections with nothing to fetch until spans are added or given up on
+    epee::critical_section m_parked_lock;
+    std::set<boost::uuids::uuid> m_parked_connections;
+
+    // per peer taking tx announcements, the txs it is known to have, the
+    // oldest forgotten first, those to announce to it next and how many of
+    // the txs asked for it announced; with the txs asked for, when, and the
+    // peers which announced them, the one asked first
+    struct tx_inventory
+    {
+      std::unordered_set<crypto::hash> known;
+      std::deque<crypto::hash> known_order;
+      std::vector<crypto::hash> queued;
+      size_t requested = 0;
+
+      bool add_known(const crypto::hash& tx_hash)
+      {
+        if(!known.insert(tx_hash).second)
+          return false;
+        known_order.push_back(tx_hash);
+        if(known_order.size() > P2P_TX_INVENTORY_MAX_KNOWN)
+        {
+          known.erase(known_order.front());
+          known_order.pop_front();
+        }
+        return true;
+      }
+    };
+    struct tx_request
+    {
+      time_t time = 0;
+      std::deque<boost::uuids::uuid> announcers;
+    };
+    epee::critical_section m_tx_inventory_lock;
+    std::map<boost::uuids::uuid, tx_inventory> m_tx_inventory;
+    std::unordered_map<crypto::hash, tx_request> m_requested_txs;
+
 		// static std::ofstream m_logreq;
     std::mutex m_buffer_mutex;
     double get_avg_block_size();
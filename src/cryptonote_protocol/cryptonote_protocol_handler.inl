@@ -36,7 +36,9 @@
 // developer rfree: this code is caller of our new network code, and is modded; e.g. for rate limiting
 
 #include <boost/interprocess/detail/atomic.hpp>
+#include <boost/make_shared.hpp>
 #include <list>
+#include <unordered_map>
 
 #include "cryptonote_core/cryptonote_format_utils.h"
 #include "profile_tools.h"
@@ -87,6 +89,16 @@ namespace cryptonote
       m_p2p = p2p;
     else
       m_p2p = &m_p2p_stub;
+
+    // so that a new block is not stuck behind sync responses in a peer's send queue
+    m_p2p->set_command_priority(NOTIFY_NEW_BLOCK::ID, epee::net_utils::e_send_priority_block);
+    m_p2p->set_command_priority(NOTIFY_NEW_COMPACT_BLOCK::ID, epee::net_utils::e_send_priority_block);
+    m_p2p->set_command_priority(NOTIFY_REQUEST_COMPACT_MISSING_TXS::ID, epee::net_utils::e_send_priority_block);
+    m_p2p->set_command_priority(NOTIFY_NEW_TRANSACTIONS::ID, epee::net_utils::e_send_priority_tx);
+    m_p2p->set_command_priority(NOTIFY_TX_INVENTORY::ID, epee::net_utils::e_send_priority_tx);
+    m_p2p->set_command_priority(NOTIFY_REQUEST_TXS::ID, epee::net_utils::e_send_priority_tx);
+    m_p2p->set_command_priority(NOTIFY_RESPONSE_GET_OBJECTS::ID, epee::net_utils::e_send_priority_bulk);
+    m_p2p->set_command_priority(NOTIFY_RESPONSE_CHAIN_ENTRY::ID, epee::net_utils::e_send_priority_bulk);
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
@@ -98,6 +110,12 @@ namespace cryptonote
 
     if(context.m_state == cryptonote_connection_context::state_synchronizing)
     {
+      if(context.m_needed_objects.size() && context.m_requested_objects.empty())
+      {
+        // woken up, there may be something to fetch now
+        request_missing_objects(context, true);
+        return true;
+      }
       NOTIFY_REQUEST_CHAIN::request r = boost::value_initialized<NOTIFY_REQUEST_CHAIN::request>();
       m_core.get_short_chain_history(r.block_ids);
       LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_CHAIN: m_block_ids.size()=" << r.block_ids.size() );
@@ -246,6 +264,10 @@ namespace cryptonote
       cnx.current_download = cntxt.m_current_speed_down / 1024;
       cnx.current_upload = cntxt.m_current_speed_up / 1024;
 
+      cnx.sync_batch = cntxt.m_sync_batch;
+      cnx.sync_rate = cntxt.m_sync_rate / 1024;
+      cnx.sync_latency = cntxt.m_sync_latency * 1000;
+
       connections.push_back(cnx);
 
       return true;
@@ -260,6 +282,8 @@ namespace cryptonote
     if(context.m_state == cryptonote_connection_context::state_befor_handshake && !is_inital)
       return true;
 
+    context.m_support_flags = hshd.support_flags;
+
     if(context.m_state == cryptonote_connection_context::state_synchronizing)
       return true;
 
@@ -296,6 +320,7 @@ namespace cryptonote
   {
     m_core.get_blockchain_top(hshd.current_height, hshd.top_id);
     hshd.current_height +=1;
+    hshd.support_flags = P2P_SUPPORT_FLAGS;
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -360,23 +385,155 @@ namespace cryptonote
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_new_compact_block(int command, NOTIFY_NEW_COMPACT_BLOCK::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_NEW_COMPACT_BLOCK (hop " << arg.hop << ", " << arg.b.txs.size() << " txs)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+
+    block b;
+    if(!parse_and_validate_block_from_blob(arg.b.block, b))
+    {
+      LOG_ERROR_CCONTEXT("sent wrong compact block: failed to parse and validate block, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+    const crypto::hash block_hash = get_block_hash(b);
+    const bool is_answer = context.m_compact_block_pending == block_hash;
+    context.m_compact_block_pending = null_hash;
+    if(m_core.have_block(block_hash))
+      return 1;
+
+    // the txs sent along are those we asked for, the rest should be in our pool
+    std::unordered_map<crypto::hash, blobdata> sent_txs;
+    BOOST_FOREACH(auto& tx_blob, arg.b.txs)
+      sent_txs.emplace(get_blob_hash(tx_blob), std::move(tx_blob));
+
+    NOTIFY_NEW_BLOCK::request full = boost::value_initialized<NOTIFY_NEW_BLOCK::request>();
+    NOTIFY_REQUEST_COMPACT_MISSING_TXS::request missing = boost::value_initialized<NOTIFY_REQUEST_COMPACT_MISSING_TXS::request>();
+    for(size_t i = 0; i < b.tx_hashes.size(); ++i)
+    {
+      auto it = sent_txs.find(b.tx_hashes[i]);
+      if(it != sent_txs.end())
+      {
+        full.b.txs.push_back(std::move(it->second));
+        continue;
+      }
+      transaction tx;
+      if(m_core.get_pool_transaction(b.tx_hashes[i], tx))
+        full.b.txs.push_back(tx_to_blob(tx));
+      else
+        missing.missing_tx_indices.push_back(i);
+    }
+
+    if(!missing.missing_tx_indices.empty())
+    {
+      if(is_answer)
+      {
+        // it could not fill in the block, fetch it whole the usual way
+        LOG_PRINT_CCONTEXT_L1("Compact block " << block_hash << " still misses " << missing.missing_tx_indices.size() << " txs, requesting chain");
+        context.m_state = cryptonote_connection_context::state_synchronizing;
+        NOTIFY_REQUEST_CHAIN::request r = boost::value_initialized<NOTIFY_REQUEST_CHAIN::request>();
+        m_core.get_short_chain_history(r.block_ids);
+        LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_CHAIN: m_block_ids.size()=" << r.block_ids.size() );
+        post_notify<NOTIFY_REQUEST_CHAIN>(r, context);
+        return 1;
+      }
+      missing.block_hash = block_hash;
+      missing.current_blockchain_height = m_core.get_current_blockchain_height();
+      context.m_compact_block_pending = block_hash;
+      LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_COMPACT_MISSING_TXS: " << missing.missing_tx_indices.size() << " of " << b.tx_hashes.size() << " txs");
+      post_notify<NOTIFY_REQUEST_COMPACT_MISSING_TXS>(missing, context);
+      return 1;
+    }
+
+    full.b.block = std::move(arg.b.block);
+    full.current_blockchain_height = arg.current_blockchain_height;
+    full.hop = arg.hop;
+    return handle_notify_new_block(NOTIFY_NEW_BLOCK::ID, full, context);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_request_compact_missing_txs(int command, NOTIFY_REQUEST_COMPACT_MISSING_TXS::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_REQUEST_COMPACT_MISSING_TXS (" << arg.missing_tx_indices.size() << " txs)");
+    block b;
+    if(!m_core.get_block_by_hash(arg.block_hash, b))
+    {
+      // reorganized away meanwhile, the peer will get the chain instead
+      LOG_PRINT_CCONTEXT_L1("Requested txs of unknown compact block " << arg.block_hash);
+      return 1;
+    }
+    if(arg.missing_tx_indices.size() > b.tx_hashes.size())
+    {
+      LOG_ERROR_CCONTEXT("requested more txs than compact block " << arg.block_hash << " has, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+
+    std::vector<crypto::hash> tx_ids;
+    BOOST_FOREACH(uint64_t index, arg.missing_tx_indices)
+    {
+      if(index >= b.tx_hashes.size())
+      {
+        LOG_ERROR_CCONTEXT("requested tx " << index << " out of compact block " << arg.block_hash << ", dropping connection");
+        m_p2p->drop_connection(context);
+        return 1;
+      }
+      tx_ids.push_back(b.tx_hashes[index]);
+    }
+
+    std::list<transaction> txs;
+    std::list<crypto::hash> missed_txs;
+    m_core.get_transactions(tx_ids, txs, missed_txs);
+    BOOST_FOREACH(const auto& tx_id, missed_txs)
+    {
+      transaction tx;
+      if(m_core.get_pool_transaction(tx_id, tx))
+        txs.push_back(tx);
+    }
+
+    // anything still missing is left out, the peer then falls back to a full download
+    NOTIFY_NEW_COMPACT_BLOCK::request rsp = boost::value_initialized<NOTIFY_NEW_COMPACT_BLOCK::request>();
+    rsp.b.block = block_to_blob(b);
+    BOOST_FOREACH(const auto& tx, txs)
+      rsp.b.txs.push_back(tx_to_blob(tx));
+    rsp.current_blockchain_height = m_core.get_current_blockchain_height();
+    rsp.hop = 0;
+    LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_NEW_COMPACT_BLOCK: " << rsp.b.txs.size() << " of " << tx_ids.size() << " requested txs");
+    post_notify<NOTIFY_NEW_COMPACT_BLOCK>(rsp, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
   int t_cryptonote_protocol_handler<t_core>::handle_notify_new_transactions(int command, NOTIFY_NEW_TRANSACTIONS::request& arg, cryptonote_connection_context& context)
   {
     LOG_PRINT_CCONTEXT_L2("NOTIFY_NEW_TRANSACTIONS");
     if(context.m_state != cryptonote_connection_context::state_normal)
       return 1;
 
-    for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end();)
+    std::vector<crypto::hash> tx_hashes;
+    BOOST_FOREACH(const auto& tx_blob, arg.txs)
+      tx_hashes.push_back(get_blob_hash(tx_blob));
+    add_known_txs(context.m_connection_id, tx_hashes);
     {
-      cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-      m_core.handle_incoming_tx(*tx_blob_it, tvc, false, true);
-      if(tvc.m_verifivation_failed)
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      BOOST_FOREACH(const auto& tx_hash, tx_hashes)
+        erase_requested_tx(tx_hash);
+    }
+
+    std::vector<cryptonote::tx_verification_context> tvc;
+    m_core.handle_incoming_txs(arg.txs, tvc, false, true);
+    size_t i = 0;
+    for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end(); ++i)
+    {
+      if(tvc[i].m_verifivation_failed)
       {
         LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
         m_p2p->drop_connection(context);
         return 1;
       }
-      if(tvc.m_should_be_relayed)
+      if(tvc[i].m_should_be_relayed)
         ++tx_blob_it;
       else
         arg.txs.erase(tx_blob_it++);
@@ -392,6 +549,112 @@ namespace cryptonote
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_tx_inventory(int command, NOTIFY_TX_INVENTORY::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_TX_INVENTORY (" << arg.tx_hashes.size() << " txs)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+    if(arg.tx_hashes.size() > P2P_TX_INVENTORY_MAX_HASHES)
+    {
+      LOG_ERROR_CCONTEXT("announced " << arg.tx_hashes.size() << " txs at once, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+
+    add_known_txs(context.m_connection_id, arg.tx_hashes);
+
+    NOTIFY_REQUEST_TXS::request r = boost::value_initialized<NOTIFY_REQUEST_TXS::request>();
+    BOOST_FOREACH(const auto& tx_hash, arg.tx_hashes)
+    {
+      if(!m_core.have_tx(tx_hash))
+        r.tx_hashes.push_back(tx_hash);
+    }
+    {
+      // one peer at a time is asked for a tx, until it takes too long; the
+      // others which announced it are asked in turn after that, as they will
+      // not announce it again. Past the caps, what a peer announces is
+      // ignored until txs it announced come in or time out
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      const time_t now = time(NULL);
+      tx_inventory& inventory = m_tx_inventory[context.m_connection_id];
+      size_t ignored = 0;
+      auto it = std::remove_if(r.tx_hashes.begin(), r.tx_hashes.end(), [&](const crypto::hash& tx_hash){
+        const bool is_new = m_requested_txs.find(tx_hash) == m_requested_txs.end();
+        if(is_new && m_requested_txs.size() >= P2P_TX_REQUEST_MAX)
+        {
+          ++ignored;
+          return true;
+        }
+        tx_request& request = m_requested_txs[tx_hash];
+        std::deque<boost::uuids::uuid>& announcers = request.announcers;
+        auto announcer = std::find(announcers.begin(), announcers.end(), context.m_connection_id);
+        if(announcer == announcers.end())
+        {
+          if(inventory.requested >= P2P_TX_REQUEST_MAX_PER_PEER)
+          {
+            if(is_new)
+              m_requested_txs.erase(tx_hash);
+            ++ignored;
+            return true;
+          }
+          ++inventory.requested;
+        }
+        if(!announcers.empty() && now < request.time + P2P_TX_REQUEST_TIMEOUT)
+        {
+          if(announcer == announcers.end())
+            announcers.push_back(context.m_connection_id);
+          return true;
+        }
+        if(announcer != announcers.end())
+          announcers.erase(announcer);
+        announcers.push_front(context.m_connection_id);
+        request.time = now;
+        return false;
+      });
+      r.tx_hashes.erase(it, r.tx_hashes.end());
+      if(ignored)
+        LOG_PRINT_CCONTEXT_L1("Ignored " << ignored << " announced txs, " << inventory.requested << " it announced and " << m_requested_txs.size() << " in all are still to come in");
+    }
+    if(r.tx_hashes.empty())
+      return 1;
+
+    LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_TXS: " << r.tx_hashes.size() << " txs");
+    post_notify<NOTIFY_REQUEST_TXS>(r, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_request_txs(int command, NOTIFY_REQUEST_TXS::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_REQUEST_TXS (" << arg.tx_hashes.size() << " txs)");
+    if(arg.tx_hashes.size() > P2P_TX_INVENTORY_MAX_HASHES)
+    {
+      LOG_ERROR_CCONTEXT("requested " << arg.tx_hashes.size() << " txs at once, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+
+    // txs mined or dropped since they were announced are left out
+    NOTIFY_NEW_TRANSACTIONS::request rsp;
+    std::vector<crypto::hash> sent;
+    BOOST_FOREACH(const auto& tx_hash, arg.tx_hashes)
+    {
+      transaction tx;
+      if(!m_core.get_pool_transaction(tx_hash, tx))
+        continue;
+      rsp.txs.push_back(tx_to_blob(tx));
+      sent.push_back(tx_hash);
+    }
+    if(rsp.txs.empty())
+      return 1;
+
+    add_known_txs(context.m_connection_id, sent);
+    LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_NEW_TRANSACTIONS: " << rsp.txs.size() << " of " << arg.tx_hashes.size() << " requested txs");
+    post_notify<NOTIFY_NEW_TRANSACTIONS>(rsp, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
   int t_cryptonote_protocol_handler<t_core>::handle_request_get_objects(int command, NOTIFY_REQUEST_GET_OBJECTS::request& arg, cryptonote_connection_context& context)
   {
     LOG_PRINT_CCONTEXT_L2("NOTIFY_REQUEST_GET_OBJECTS");
@@ -478,10 +741,8 @@ namespace cryptonote
 
     context.m_remote_blockchain_height = arg.current_blockchain_height;
 
-    size_t count = 0;
     BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
     {
-      ++count;
       block b;
       if(!parse_and_validate_block_from_blob(block_entry.block, b))
       {
@@ -490,18 +751,6 @@ namespace cryptonote
         m_p2p->drop_connection(context);
         return 1;
       }
-      //to avoid concurrency in core between connections, suspend connections which delivered block later then first one
-      if(count == 2)
-      {
-        if(m_core.have_block(get_block_hash(b)))
-        {
-          context.m_state = cryptonote_connection_context::state_idle;
-          context.m_needed_objects.clear();
-          context.m_requested_objects.clear();
-          LOG_PRINT_CCONTEXT_L1("Connection set to idle state.");
-          return 1;
-        }
-      }
 
       auto req_it = context.m_requested_objects.find(get_block_hash(b));
       if(req_it == context.m_requested_objects.end())
@@ -530,86 +779,398 @@ namespace cryptonote
       return 1;
     }
 
+    LOG_PRINT_CCONTEXT_YELLOW( "Got NEW BLOCKS inside of " << __FUNCTION__ << ": size: " << arg.blocks.size() , LOG_LEVEL_1);
+    update_sync_stats(context, size, arg.blocks.size());
 
-    {
-      m_core.pause_mine();
-      epee::misc_utils::auto_scope_leave_caller scope_exit_handler = epee::misc_utils::create_scope_leave_handler(
-        boost::bind(&t_core::resume_mine, &m_core));
+    if (m_core.get_test_drop_download() && m_core.get_test_drop_download_height()) { // DISCARD BLOCKS for testing
+      // other peers may be fetching the blocks before these, so they wait
+      // in the queue until those are in
+      if (!m_block_queue.add_blocks(context.m_connection_id, arg.blocks, size))
+        LOG_PRINT_CCONTEXT_L1("Blocks arrived after being given to another peer to fetch, ignoring them");
+      if (!process_queued_blocks(context))
+        return 1;
+    } // if not DISCARD BLOCK
 
-      LOG_PRINT_CCONTEXT_YELLOW( "Got NEW BLOCKS inside of " << __FUNCTION__ << ": size: " << arg.blocks.size() , LOG_LEVEL_1);
+    request_missing_objects(context, true);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::update_sync_stats(cryptonote_connection_context& context, size_t bytes, size_t blocks)
+  {
+    if (!blocks)
+      return;
+    const double elapsed = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - context.m_sync_request_time).count(), 0.001);
+    auto smooth = [](double &avg, double sample) { avg = avg > 0 ? avg * 0.7 + sample * 0.3 : sample; };
+    smooth(context.m_sync_rate, bytes / elapsed);
+    smooth(context.m_sync_block_size, (double)bytes / blocks);
+    smooth(context.m_sync_latency, elapsed);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  size_t t_cryptonote_protocol_handler<t_core>::get_sync_batch_count(const cryptonote_connection_context& context) const
+  {
+    if (context.m_sync_rate <= 0 || context.m_sync_block_size <= 0)
+      return BLOCKS_SYNCHRONIZING_DEFAULT_COUNT;
+
+    // as many blocks as the peer sends in the target time, so small blocks
+    // are asked for in large batches and slow peers get small requests that
+    // do not time out. The rate includes the round trip, which weighs less
+    // the larger the batch, so batches grow at most twofold at a time while
+    // that plays out.
+    const double bytes = std::min(context.m_sync_rate * BLOCKS_SYNCHRONIZING_TARGET_TIME, (double)BLOCKS_SYNCHRONIZING_MAX_SIZE);
+    size_t count = bytes / context.m_sync_block_size;
+    if (context.m_sync_batch)
+      count = std::min(count, context.m_sync_batch * 2);
+    return std::max<size_t>(std::min<size_t>(count, BLOCKS_SYNCHRONIZING_MAX_COUNT), BLOCKS_SYNCHRONIZING_MIN_COUNT);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::is_good_sync_source(const cryptonote_connection_context& context)
+  {
+    if (context.m_sync_rate <= 0)
+      return true; // not measured yet, it gets its chance
+
+    // a slow peer holding the span needed next stalls everyone behind it,
+    // so it leaves the blocks to the fast ones while there are enough of
+    // them; it is woken up like the other parked ones, and fetches again
+    // once they are gone or done
+    size_t faster = 0;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& cntxt, nodetool::peerid_type peer_id)->bool{
+      if(cntxt.m_state == cryptonote_connection_context::state_synchronizing
+         && cntxt.m_sync_rate > context.m_sync_rate * BLOCKS_SYNCHRONIZING_SLOW_SOURCE_RATIO)
+        ++faster;
+      return faster < BLOCKS_SYNCHRONIZING_MIN_FAST_SOURCES;
+    });
+    return faster < BLOCKS_SYNCHRONIZING_MIN_FAST_SOURCES;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::get_peer_score(const cryptonote_connection_context& context, nodetool::peer_score& score)
+  {
+    score.rate = context.m_sync_rate;
+    score.latency = context.m_sync_latency;
+    // against the best height heard of, which takes no lock, as this is
+    // called for every connection while they are being iterated
+    const uint64_t height = m_core.get_target_blockchain_height();
+    score.height_behind = context.m_remote_blockchain_height < height ? height - context.m_remote_blockchain_height : 0;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::process_queued_blocks(cryptonote_connection_context& context)
+  {
+    bool keep_context = true;
+    do
+    {
+      // one connection at a time adds blocks, taking the spans the others
+      // left in the queue along with its own
+      if (!m_sync_lock.try_lock())
+        break;
+      std::lock_guard<std::mutex> sync_lock(m_sync_lock, std::adopt_lock);
+
+      block_queue::span span;
+      while (m_block_queue.get_next_span(m_core.get_current_blockchain_height(), span))
+      {
+        bool add_fail = false;
+        if (add_span_blocks(span, add_fail))
+          continue;
+        // nothing else from that peer can be trusted either
+        m_block_queue.flush_spans(span.connection_id, true);
+        if (span.connection_id == context.m_connection_id)
+        {
+          m_p2p->drop_connection(context);
+          if (add_fail)
+            m_p2p->add_peer_fail(context);
+          keep_context = false;
+        }
+        else
+        {
+          drop_connection(span.connection_id, add_fail);
+        }
+      }
+      // the lock is released here, so if another connection queued a span
+      // after the last look but could not get the lock, go round again
+    } while (m_block_queue.has_next_span(m_core.get_current_blockchain_height()));
 
-      if (m_core.get_test_drop_download() && m_core.get_test_drop_download_height()) { // DISCARD BLOCKS for testing
+    wake_parked_connections();
+    return keep_context;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::add_span_blocks(const block_queue::span& span, bool& add_fail)
+  {
+    m_core.pause_mine();
+    epee::misc_utils::auto_scope_leave_caller scope_exit_handler = epee::misc_utils::create_scope_leave_handler(
+      boost::bind(&t_core::resume_mine, &m_core));
 
-        uint64_t previous_height = m_core.get_current_blockchain_height();
+    uint64_t previous_height = m_core.get_current_blockchain_height();
 
-        m_core.prepare_handle_incoming_blocks(arg.blocks);
-        BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
+    m_core.prepare_handle_incoming_blocks(span.blocks);
+    BOOST_FOREACH(const block_complete_entry& block_entry, span.blocks)
+    {
+      // process transactions
+      TIME_MEASURE_START(transactions_process_time);
+      BOOST_FOREACH(auto& tx_blob, block_entry.txs)
+      {
+        tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+        m_core.handle_incoming_tx(tx_blob, tvc, true, true);
+        if(tvc.m_verifivation_failed)
         {
-          // process transactions
-          TIME_MEASURE_START(transactions_process_time);
-          BOOST_FOREACH(auto& tx_blob, block_entry.txs)
-          {
-            tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-            m_core.handle_incoming_tx(tx_blob, tvc, true, true);
-            if(tvc.m_verifivation_failed)
-            {
-              LOG_ERROR_CCONTEXT("transaction verification failed on NOTIFY_RESPONSE_GET_OBJECTS, \r\ntx_id = "
-                  << epee::string_tools::pod_to_hex(get_blob_hash(tx_blob)) << ", dropping connection");
-              m_p2p->drop_connection(context);
-              m_core.cleanup_handle_incoming_blocks();
-              return 1;
-            }
-          }
-          TIME_MEASURE_FINISH(transactions_process_time);
+          LOG_ERROR("transaction verification failed on NOTIFY_RESPONSE_GET_OBJECTS, \r\ntx_id = "
+              << epee::string_tools::pod_to_hex(get_blob_hash(tx_blob)) << ", dropping connection");
+          m_core.cleanup_handle_incoming_blocks();
+          return false;
+        }
+      }
+      TIME_MEASURE_FINISH(transactions_process_time);
 
-          // process block
+      // process block
 
-          TIME_MEASURE_START(block_process_time);
-          block_verification_context bvc = boost::value_initialized<block_verification_context>();
+      TIME_MEASURE_START(block_process_time);
+      block_verification_context bvc = boost::value_initialized<block_verification_context>();
 
-          m_core.handle_incoming_block(block_entry.block, bvc, false); // <--- process block
+      m_core.handle_incoming_block(block_entry.block, bvc, false); // <--- process block
 
-          if(bvc.m_verifivation_failed)
-          {
-            LOG_PRINT_CCONTEXT_L1("Block verification failed, dropping connection");
-            m_p2p->drop_connection(context);
-            m_p2p->add_ip_fail(context.m_remote_ip);
-            m_core.cleanup_handle_incoming_blocks();
-            return 1;
-          }
-          if(bvc.m_marked_as_orphaned)
-          {
-            LOG_PRINT_CCONTEXT_L1("Block received at sync phase was marked as orphaned, dropping connection");
-            m_p2p->drop_connection(context);
-            m_p2p->add_ip_fail(context.m_remote_ip);
-            m_core.cleanup_handle_incoming_blocks();
-            return 1;
-          }
+      if(bvc.m_verifivation_failed)
+      {
+        LOG_PRINT_L1("Block verification failed, dropping connection");
+        add_fail = true;
+        m_core.cleanup_handle_incoming_blocks();
+        return false;
+      }
+      if(bvc.m_marked_as_orphaned)
+      {
+        // may only be that this peer is on another fork than the one which
+        // sent the blocks before, so it is not held against it
+        LOG_PRINT_L1("Block received at sync phase was marked as orphaned, dropping connection");
+        m_core.cleanup_handle_incoming_blocks();
+        return false;
+      }
 
-          TIME_MEASURE_FINISH(block_process_time);
-          LOG_PRINT_CCONTEXT_L2("Block process time: " << block_process_time + transactions_process_time << "(" << transactions_process_time << "/" << block_process_time << ")ms");
+      TIME_MEASURE_FINISH(block_process_time);
+      LOG_PRINT_L2("Block process time: " << block_process_time + transactions_process_time << "(" << transactions_process_time << "/" << block_process_time << ")ms");
 
-          epee::net_utils::data_logger::get_instance().add_data("calc_time", block_process_time + transactions_process_time);
-          epee::net_utils::data_logger::get_instance().add_data("block_processing", 1);
+      epee::net_utils::data_logger::get_instance().add_data("calc_time", block_process_time + transactions_process_time);
+      epee::net_utils::data_logger::get_instance().add_data("block_processing", 1);
 
-        } // each download block
-        m_core.cleanup_handle_incoming_blocks();
+    } // each download block
+    m_core.cleanup_handle_incoming_blocks();
 
-        if (m_core.get_current_blockchain_height() > previous_height)
+    if (m_core.get_current_blockchain_height() > previous_height)
+    {
+      LOG_PRINT_YELLOW( "Synced " << m_core.get_current_blockchain_height() << "/" << m_core.get_target_blockchain_height() , LOG_LEVEL_0);
+    }
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::wake_parked_connections()
+  {
+    std::set<boost::uuids::uuid> parked;
+    {
+      CRITICAL_REGION_LOCAL(m_parked_lock);
+      parked.swap(m_parked_connections);
+    }
+    if (parked.empty())
+      return;
+    // they look again for something to fetch from their own threads
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if (parked.find(context.m_connection_id) != parked.end())
+      {
+        ++context.m_callback_request_count;
+        m_p2p->request_callback(context);
+      }
+      return true;
+    });
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::drop_connection(const boost::uuids::uuid& connection_id, bool add_fail)
+  {
+    std::list<epee::net_utils::connection_context_base> found;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if (context.m_connection_id != connection_id)
+        return true;
+      found.push_back(context);
+      return false;
+    });
+    BOOST_FOREACH(const auto& context, found)
+    {
+      m_p2p->drop_connection(context);
+      if (add_fail)
+        m_p2p->add_peer_fail(context);
+    }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::add_known_txs(const boost::uuids::uuid& connection_id, const std::vector<crypto::hash>& tx_hashes)
+  {
+    CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+    tx_inventory& inventory = m_tx_inventory[connection_id];
+    BOOST_FOREACH(const auto& tx_hash, tx_hashes)
+      inventory.add_known(tx_hash);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::release_tx_announcer(const boost::uuids::uuid& connection_id)
+  {
+    auto it = m_tx_inventory.find(connection_id);
+    if(it != m_tx_inventory.end() && it->second.requested)
+      --it->second.requested;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::erase_requested_tx(const crypto::hash& tx_hash)
+  {
+    auto it = m_requested_txs.find(tx_hash);
+    if(it == m_requested_txs.end())
+      return;
+    BOOST_FOREACH(const auto& connection_id, it->second.announcers)
+      release_tx_announcer(connection_id);
+    m_requested_txs.erase(it);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::announce_queued_txs()
+  {
+    std::map<boost::uuids::uuid, epee::net_utils::connection_context_base> peers;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(peer_id && (context.m_support_flags & P2P_SUPPORT_FLAG_TX_INVENTORY))
+        peers.emplace(context.m_connection_id, context);
+      return true;
+    });
+
+    std::list<std::pair<epee::net_utils::connection_context_base, std::vector<crypto::hash>>> announcements;
+    {
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      for(auto it = m_tx_inventory.begin(); it != m_tx_inventory.end(); )
+      {
+        auto peer = peers.find(it->first);
+        if(peer == peers.end())
+        {
+          m_tx_inventory.erase(it++);
+          continue;
+        }
+        if(!it->second.queued.empty())
         {
-          LOG_PRINT_CCONTEXT_YELLOW( "Synced " << m_core.get_current_blockchain_height() << "/" << m_core.get_target_blockchain_height() , LOG_LEVEL_0);
+          announcements.emplace_back(peer->second, std::vector<crypto::hash>());
+          announcements.back().second.swap(it->second.queued);
         }
-      } // if not DISCARD BLOCK
+        ++it;
+      }
+    }
 
+    BOOST_FOREACH(auto& announcement, announcements)
+    {
+      const std::vector<crypto::hash>& tx_hashes = announcement.second;
+      for(size_t i = 0; i < tx_hashes.size(); i += P2P_TX_INVENTORY_MAX_HASHES)
+      {
+        NOTIFY_TX_INVENTORY::request r = boost::value_initialized<NOTIFY_TX_INVENTORY::request>();
+        r.tx_hashes.assign(tx_hashes.begin() + i, tx_hashes.begin() + std::min(tx_hashes.size(), i + P2P_TX_INVENTORY_MAX_HASHES));
+        std::string blob;
+        epee::serialization::store_t_to_binary(r, blob);
+        m_p2p->invoke_notify_to_peer(NOTIFY_TX_INVENTORY::ID, blob, announcement.first);
+      }
+    }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::request_timed_out_txs(time_t now)
+  {
+    std::map<boost::uuids::uuid, epee::net_utils::connection_context_base> peers;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(peer_id && (context.m_support_flags & P2P_SUPPORT_FLAG_TX_INVENTORY))
+        peers.emplace(context.m_connection_id, context);
+      return true;
+    });
 
+    std::map<boost::uuids::uuid, std::vector<crypto::hash>> requests;
+    {
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      for(auto it = m_requested_txs.begin(); it != m_requested_txs.end(); )
+      {
+        tx_request& request = it->second;
+        if(now < request.time + P2P_TX_REQUEST_TIMEOUT)
+        {
+          ++it;
+          continue;
+        }
+        // the one asked did not send it, on to the next still connected
+        std::deque<boost::uuids::uuid>& announcers = request.announcers;
+        if(!announcers.empty())
+        {
+          release_tx_announcer(announcers.front());
+          announcers.pop_front();
+        }
+        while(!announcers.empty() && peers.find(announcers.front()) == peers.end())
+        {
+          release_tx_announcer(announcers.front());
+          announcers.pop_front();
+        }
+        if(announcers.empty())
+        {
+          it = m_requested_txs.erase(it);
+          continue;
+        }
+        request.time = now;
+        requests[announcers.front()].push_back(it->first);
+        ++it;
+      }
+    }
+
+    std::vector<crypto::hash> had;
+    BOOST_FOREACH(auto& request, requests)
+    {
+      std::vector<crypto::hash>& tx_hashes = request.second;
+      auto it = std::remove_if(tx_hashes.begin(), tx_hashes.end(), [&](const crypto::hash& tx_hash){
+        if(!m_core.have_tx(tx_hash))
+          return false;
+        had.push_back(tx_hash);
+        return true;
+      });
+      tx_hashes.erase(it, tx_hashes.end());
+      for(size_t i = 0; i < tx_hashes.size(); i += P2P_TX_INVENTORY_MAX_HASHES)
+      {
+        NOTIFY_REQUEST_TXS::request r = boost::value_initialized<NOTIFY_REQUEST_TXS::request>();
+        r.tx_hashes.assign(tx_hashes.begin() + i, tx_hashes.begin() + std::min(tx_hashes.size(), i + P2P_TX_INVENTORY_MAX_HASHES));
+        LOG_PRINT_L2("[" << epee::net_utils::print_connection_context_short(peers[request.first]) << "] -->>NOTIFY_REQUEST_TXS: " << r.tx_hashes.size() << " txs, timed out elsewhere");
+        std::string blob;
+        epee::serialization::store_t_to_binary(r, blob);
+        m_p2p->invoke_notify_to_peer(NOTIFY_REQUEST_TXS::ID, blob, peers[request.first]);
+      }
+    }
+    if(!had.empty())
+    {
+      // came in some other way meanwhile, such as in a block
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      BOOST_FOREACH(const auto& tx_hash, had)
+        erase_requested_tx(tx_hash);
     }
-    request_missing_objects(context, true);
-    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::on_connection_close(cryptonote_connection_context& context)
+  {
+    {
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      m_tx_inventory.erase(context.m_connection_id);
+    }
+    // what it was still fetching is up for grabs again
+    m_block_queue.flush_spans(context.m_connection_id);
+    {
+      CRITICAL_REGION_LOCAL(m_parked_lock);
+      m_parked_connections.erase(context.m_connection_id);
+    }
+    wake_parked_connections();
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
   bool t_cryptonote_protocol_handler<t_core>::on_idle()
   {
+    if (m_block_queue.flush_stale_spans(BLOCK_QUEUE_SPAN_TIMEOUT))
+      wake_parked_connections();
+    announce_queued_txs();
+    request_timed_out_txs(time(NULL));
     return m_core.on_idle();
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -640,27 +1201,43 @@ namespace cryptonote
       auto time_from_epoh = point.time_since_epoch();
       auto sec = duration_cast< seconds >( time_from_epoh ).count();*/
 
+    // m_needed_objects are the ids the peer has after the last one we had
+    // then, up to m_last_response_height. They stay until we have them, as
+    // the peer may yet have to fetch those another connection gives up on.
+    while(check_having_blocks && context.m_needed_objects.size() && m_core.have_block(context.m_needed_objects.front()))
+      context.m_needed_objects.pop_front();
+
     if(context.m_needed_objects.size())
     {
-      //we know objects that we need, request this objects
+      //we know objects that we need, request those no other connection is fetching
       NOTIFY_REQUEST_GET_OBJECTS::request req;
-      size_t count = 0;
-      auto it = context.m_needed_objects.begin();
+      const uint64_t first_height = context.m_last_response_height + 1 - context.m_needed_objects.size();
+      uint64_t start_height = 0;
 
-      size_t count_limit = BLOCKS_SYNCHRONIZING_DEFAULT_COUNT;
+      size_t count_limit = get_sync_batch_count(context);
       _note_c("net/req-calc" , "Setting count_limit: " << count_limit);
-      while(it != context.m_needed_objects.end() && count < BLOCKS_SYNCHRONIZING_DEFAULT_COUNT)
       {
-        if( !(check_having_blocks && m_core.have_block(*it)))
+        // parked under the same lock the queue and the other connections
+        // are looked at, so a wake up coming just after cannot be missed
+        CRITICAL_REGION_LOCAL(m_parked_lock);
+        if(!is_good_sync_source(context))
+        {
+          LOG_PRINT_CCONTEXT_L2("Faster connections are fetching blocks, waiting");
+          m_parked_connections.insert(context.m_connection_id);
+          return true;
+        }
+        if(!m_block_queue.reserve_span(first_height, context.m_needed_objects, count_limit, BLOCK_QUEUE_MAX_SIZE, context.m_connection_id, start_height, req.blocks))
         {
-          req.blocks.push_back(*it);
-          ++count;
-          context.m_requested_objects.insert(*it);
+          LOG_PRINT_CCONTEXT_L2("Other connections are fetching the blocks needed next, waiting");
+          m_parked_connections.insert(context.m_connection_id);
+          return true;
         }
-        context.m_needed_objects.erase(it++);
       }
+      context.m_requested_objects.insert(req.blocks.begin(), req.blocks.end());
+      context.m_sync_batch = count_limit;
+      context.m_sync_request_time = std::chrono::steady_clock::now();
       LOG_PRINT_CCONTEXT_L1("-->>NOTIFY_REQUEST_GET_OBJECTS: blocks.size()=" << req.blocks.size() << ", txs.size()=" << req.txs.size()
-          << "requested blocks count=" << count << " / " << count_limit);
+          << "requested blocks count=" << req.blocks.size() << " / " << count_limit << " from height " << start_height);
       //epee::net_utils::network_throttle_manager::get_global_throttle_inreq().logger_handle_net("log/dr-monero/net/req-all.data", sec, get_avg_block_size());
 
       post_notify<NOTIFY_REQUEST_GET_OBJECTS>(req, context);
@@ -737,7 +1314,7 @@ namespace cryptonote
     {
       LOG_ERROR_CCONTEXT("sent empty m_block_ids, dropping connection");
       m_p2p->drop_connection(context);
-      m_p2p->add_ip_fail(context.m_remote_ip);
+      m_p2p->add_peer_fail(context);
       return 1;
     }
 
@@ -746,7 +1323,7 @@ namespace cryptonote
       LOG_ERROR_CCONTEXT("sent m_block_ids starting from unknown id: "
                                               << epee::string_tools::pod_to_hex(arg.m_block_ids.front()) << " , dropping connection");
       m_p2p->drop_connection(context);
-      m_p2p->add_ip_fail(context.m_remote_ip);
+      m_p2p->add_peer_fail(context);
       return 1;
     }
 
@@ -760,10 +1337,13 @@ namespace cryptonote
       m_p2p->drop_connection(context);
     }
 
+    // from the first one we do not have, so their heights follow on
+    context.m_needed_objects.clear();
     BOOST_FOREACH(auto& bl_id, arg.m_block_ids)
     {
-      if(!m_core.have_block(bl_id))
-        context.m_needed_objects.push_back(bl_id);
+      if(context.m_needed_objects.empty() && m_core.have_block(bl_id))
+        continue;
+      context.m_needed_objects.push_back(bl_id);
     }
 
     request_missing_objects(context, false);
@@ -773,13 +1353,80 @@ namespace cryptonote
   template<class t_core>
   bool t_cryptonote_protocol_handler<t_core>::relay_block(NOTIFY_NEW_BLOCK::request& arg, cryptonote_connection_context& exclude_context)
   {
-    return relay_post_notify<NOTIFY_NEW_BLOCK>(arg, exclude_context);
+    LOG_PRINT_L2("[" << epee::net_utils::print_connection_context_short(exclude_context) << "] post relay " << typeid(NOTIFY_NEW_BLOCK).name() << " -->");
+    // peers which take compact blocks get the block alone, and fill in its txs from their pool
+    std::list<boost::uuids::uuid> full_peers, compact_peers;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(!peer_id || context.m_connection_id == exclude_context.m_connection_id)
+        return true;
+      if(context.m_support_flags & P2P_SUPPORT_FLAG_COMPACT_BLOCKS)
+        compact_peers.push_back(context.m_connection_id);
+      else
+        full_peers.push_back(context.m_connection_id);
+      return true;
+    });
+
+    // each serialized once, and shared by the send queues of all these peers
+    if(!compact_peers.empty())
+    {
+      NOTIFY_NEW_COMPACT_BLOCK::request compact = boost::value_initialized<NOTIFY_NEW_COMPACT_BLOCK::request>();
+      compact.b.block = arg.b.block;
+      compact.current_blockchain_height = arg.current_blockchain_height;
+      compact.hop = arg.hop;
+      std::string blob;
+      epee::serialization::store_t_to_binary(compact, blob);
+      m_p2p->relay_notify_to_list(NOTIFY_NEW_COMPACT_BLOCK::ID, boost::make_shared<std::string>(std::move(blob)), compact_peers);
+    }
+    if(!full_peers.empty())
+    {
+      std::string blob;
+      epee::serialization::store_t_to_binary(arg, blob);
+      m_p2p->relay_notify_to_list(NOTIFY_NEW_BLOCK::ID, boost::make_shared<std::string>(std::move(blob)), full_peers);
+    }
+    return true;
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
   bool t_cryptonote_protocol_handler<t_core>::relay_transactions(NOTIFY_NEW_TRANSACTIONS::request& arg, cryptonote_connection_context& exclude_context)
   {
-    return relay_post_notify<NOTIFY_NEW_TRANSACTIONS>(arg, exclude_context);
+    LOG_PRINT_L2("[" << epee::net_utils::print_connection_context_short(exclude_context) << "] post relay " << typeid(NOTIFY_NEW_TRANSACTIONS).name() << " -->");
+    // peers which take announcements get the hashes in the next batch,
+    // unless they are known to have the tx, the others get it all now
+    std::vector<crypto::hash> tx_hashes;
+    BOOST_FOREACH(const auto& tx_blob, arg.txs)
+      tx_hashes.push_back(get_blob_hash(tx_blob));
+
+    std::list<boost::uuids::uuid> full_peers, inventory_peers;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(!peer_id || context.m_connection_id == exclude_context.m_connection_id)
+        return true;
+      if(context.m_support_flags & P2P_SUPPORT_FLAG_TX_INVENTORY)
+        inventory_peers.push_back(context.m_connection_id);
+      else
+        full_peers.push_back(context.m_connection_id);
+      return true;
+    });
+
+    {
+      CRITICAL_REGION_LOCAL(m_tx_inventory_lock);
+      BOOST_FOREACH(const auto& connection_id, inventory_peers)
+      {
+        tx_inventory& inventory = m_tx_inventory[connection_id];
+        BOOST_FOREACH(const auto& tx_hash, tx_hashes)
+        {
+          if(inventory.add_known(tx_hash))
+            inventory.queued.push_back(tx_hash);
+        }
+      }
+    }
+
+    if(!full_peers.empty())
+    {
+      std::string blob;
+      epee::serialization::store_t_to_binary(arg, blob);
+      m_p2p->relay_notify_to_list(NOTIFY_NEW_TRANSACTIONS::ID, boost::make_shared<std::string>(std::move(blob)), full_peers);
+    }
+    return true;
   }
 
   /// @deprecated
@@ -439,5 +439,18 @@ bool t_command_parser_executor::flush_txpool(const std::vector<std::string>& arg
   return m_executor.flush_txpool(txid);
 }
 
+bool t_command_parser_executor::print_block_stats(const std::vector<std::string>& args)
+{
+  if (args.size() > 1) return false;
+
+  bool reset = false;
+  if (args.size() == 1)
+  {
+    if (args[0] != "reset") return false;
+    reset = true;
+  }
+  return m_executor.print_block_stats(reset);
+}
+
 
 } // namespace daemonize
@@ -114,6 +114,8 @@ public:
   bool unban(const std::vector<std::string>& args);
 
   bool flush_txpool(const std::vector<std::string>& args);
+
+  bool print_block_stats(const std::vector<std::string>& args);
 };
 
 } // namespace daemonize
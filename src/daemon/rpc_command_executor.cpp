@@ -36,6 +36,7 @@
 #include "cryptonote_core/hardfork.h"
 #include <boost/format.hpp>
 #include <ctime>
+#include <sstream>
 #include <string>
 
 namespace daemonize {
@@ -361,6 +362,9 @@ bool t_rpc_command_executor::print_connections() {
       << std::setw(14) << "Down(now)"
       << std::setw(10) << "Up (kB/s)" 
       << std::setw(13) << "Up(now)"
+      << std::setw(10) << "Batch"
+      << std::setw(12) << "Sync (kB/s)"
+      << std::setw(12) << "Latency(ms)"
       << std::endl;
 
   for (auto & info : res.connections)
@@ -379,7 +383,10 @@ bool t_rpc_command_executor::print_connections() {
      << std::setw(14) << info.current_download
      << std::setw(10) << info.avg_upload
      << std::setw(13) << info.current_upload
-     
+     << std::setw(10) << info.sync_batch
+     << std::setw(12) << info.sync_rate
+     << std::setw(12) << info.sync_latency
+
      << std::left << (info.localhost ? "[LOCALHOST]" : "")
      << std::left << (info.local_ip ? "[LAN]" : "");
     //tools::msg_writer() << boost::format("%-25s peer_id: %-25s %s") % address % info.peer_id % in_out;
@@ -1203,5 +1210,55 @@ bool t_rpc_command_executor::flush_txpool(const std::string &txid)
     return true;
 }
 
+bool t_rpc_command_executor::print_block_stats(bool reset)
+{
+    cryptonote::COMMAND_RPC_GET_BLOCK_PROCESSING_STATS::request req;
+    cryptonote::COMMAND_RPC_GET_BLOCK_PROCESSING_STATS::response res;
+    std::string fail_message = "Unsuccessful";
+    epee::json_rpc::error error_resp;
+
+    req.reset = reset;
+
+    if (m_is_rpc)
+    {
+        if (!m_rpc_client->json_rpc_request(req, res, "get_block_processing_stats", fail_message.c_str()))
+        {
+            return true;
+        }
+    }
+    else
+    {
+        if (!m_rpc_server->on_get_block_processing_stats(req, res, error_resp) || res.status != CORE_RPC_STATUS_OK)
+        {
+            tools::fail_msg_writer() << fail_message.c_str();
+            return true;
+        }
+    }
+
+    tools::msg_writer() << boost::format("%-12s %10s %10s %10s %10s") % "stage" % "count" % "total ms" % "avg ms" % "max ms";
+    for (const auto &stage: res.stages)
+    {
+        tools::msg_writer() << boost::format("%-12s %10u %10u %10.2f %10u") % stage.name % stage.count % stage.total
+            % (stage.count ? (double)stage.total / stage.count : 0.0) % stage.max;
+
+        std::stringstream ss;
+        for (size_t i = 0; i < stage.histogram.size(); ++i)
+        {
+            if (!stage.histogram[i])
+                continue;
+            if (i == 0)
+                ss << " <1:";
+            else if (i + 1 == stage.histogram.size())
+                ss << " >=" << (1 << (i - 1)) << ":";
+            else
+                ss << " " << (1 << (i - 1)) << "-" << ((1 << i) - 1) << ":";
+            ss << stage.histogram[i];
+        }
+        if (!ss.str().empty())
+            tools::msg_writer() << "  ms" << ss.str();
+    }
+
+    return true;
+}
 
 }// namespace daemonize
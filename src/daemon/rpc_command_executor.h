@@ -132,6 +132,8 @@ public:
   bool unban(const std::string &ip);
 
   bool flush_txpool(const std::string &txid);
+
+  bool print_block_stats(bool reset);
 };
 
 } // namespace daemonize
@@ -118,6 +118,12 @@ class connection_basic_pimpl {
 		network_throttle_bw m_throttle; // per-perr
     critical_section m_throttle_lock;
 
+		// per-connection limits, on top of the global ones
+		static std::atomic<uint64_t> m_rate_up_limit_per_connection;
+		static std::atomic<uint64_t> m_rate_down_limit_per_connection;
+		network_token_bucket m_bucket_out;
+		network_token_bucket m_bucket_in;
+
 		int m_peer_number; // e.g. for debug/stats
 };
 
@@ -146,6 +152,8 @@ connection_basic_pimpl::connection_basic_pimpl(const std::string &name) : m_thro
 
 // static variables:
 int connection_basic_pimpl::m_default_tos;
+std::atomic<uint64_t> connection_basic_pimpl::m_rate_up_limit_per_connection(0);
+std::atomic<uint64_t> connection_basic_pimpl::m_rate_down_limit_per_connection(0);
 
 // methods:
 connection_basic::connection_basic(boost::asio::io_service& io_service, std::atomic<long> &ref_sock_count, std::atomic<long> &sock_number)
@@ -175,23 +183,12 @@ connection_basic::~connection_basic() {
 }
 
 void connection_basic::set_rate_up_limit(uint64_t limit) {
-	
-	// TODO remove __SCALING_FACTOR...
-	const double SCALING_FACTOR = 2.1; // to acheve the best performance
-	limit *= SCALING_FACTOR;
-	{
-		CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-		network_throttle_manager::get_global_throttle_out().set_target_speed(limit);
-		network_throttle_manager::get_global_throttle_out().set_real_target_speed(limit / SCALING_FACTOR);
-	}
+	network_throttle_manager::get_global_bucket_out().set_rate(limit);
 	save_limit_to_file(limit);
 }
 
 void connection_basic::set_rate_down_limit(uint64_t limit) {
-	{
-	  CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_in );
-		network_throttle_manager::get_global_throttle_in().set_target_speed(limit);
-	}
+	network_throttle_manager::get_global_bucket_in().set_rate(limit);
 
 	{
 	  CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_inreq );
@@ -201,21 +198,19 @@ void connection_basic::set_rate_down_limit(uint64_t limit) {
 }
 
 uint64_t connection_basic::get_rate_up_limit() {
-    uint64_t limit;
-    {
-         CRITICAL_REGION_LOCAL( network_throttle_manager::m_lock_get_global_throttle_out );
-         limit = network_throttle_manager::get_global_throttle_out().get_target_speed();
-	}
-    return limit;
+    return network_throttle_manager::get_global_bucket_out().get_rate();
 }
 
 uint64_t connection_basic::get_rate_down_limit() {
-    uint64_t limit;
-    {
-         CRITICAL_REGION_LOCAL( network_throttle_manager::m_lock_get_global_throttle_in );
-         limit = network_throttle_manager::get_global_throttle_in().get_target_speed();
-	}
-    return limit;
+    return network_throttle_manager::get_global_bucket_in().get_rate();
+}
+
+void connection_basic::set_rate_up_limit_per_connection(uint64_t limit) {
+	connection_basic_pimpl::m_rate_up_limit_per_connection = limit;
+}
+
+void connection_basic::set_rate_down_limit_per_connection(uint64_t limit) {
+	connection_basic_pimpl::m_rate_down_limit_per_connection = limit;
 }
 
 void connection_basic::save_limit_to_file(int limit) {
@@ -223,15 +218,8 @@ void connection_basic::save_limit_to_file(int limit) {
     if (!epee::net_utils::data_logger::m_save_graph)
 		return;
 
-    {
-         CRITICAL_REGION_LOCAL(        network_throttle_manager::m_lock_get_global_throttle_out );
-               epee::net_utils::data_logger::get_instance().add_data("upload_limit", network_throttle_manager::get_global_throttle_out().get_target_speed() / 1024);
-	}
-	
-    {
-         CRITICAL_REGION_LOCAL(        network_throttle_manager::m_lock_get_global_throttle_in );
-               epee::net_utils::data_logger::get_instance().add_data("download_limit", network_throttle_manager::get_global_throttle_in().get_target_speed() / 1024);
-	}
+    epee::net_utils::data_logger::get_instance().add_data("upload_limit", network_throttle_manager::get_global_bucket_out().get_rate() / 1024);
+    epee::net_utils::data_logger::get_instance().add_data("download_limit", network_throttle_manager::get_global_bucket_in().get_rate() / 1024);
 }
  
 void connection_basic::set_tos_flag(int tos) {
@@ -242,53 +230,41 @@ int connection_basic::get_tos_flag() {
 	return connection_basic_pimpl::m_default_tos;
 }
 
-void connection_basic::sleep_before_packet(size_t packet_size, int phase,  int q_len) {
-	double delay=0; // will be calculated
-	do
-	{ // rate limiting
-		if (m_was_shutdown) { 
-			_dbg2("m_was_shutdown - so abort sleep");
-			return;
-		}
-
-		{ 
-			CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-			delay = network_throttle_manager::get_global_throttle_out().get_sleep_time_after_tick( packet_size ); // decission from global
-		}
-
-		delay *= 0.50;
-		if (delay > 0) {
-            long int ms = (long int)(delay * 1000);
-			_info_c("net/sleep", "Sleeping in " << __FUNCTION__ << " for " << ms << " ms before packet_size="<<packet_size); // debug sleep
-			_dbg1("sleep in sleep_before_packet");
-			epee::net_utils::data_logger::get_instance().add_data("sleep_up", ms);
-			boost::this_thread::sleep(boost::posix_time::milliseconds( ms ) );
-		}
-	} while(delay > 0);
-
-// XXX LATER XXX
-	{
-	  CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-		network_throttle_manager::get_global_throttle_out().handle_trafic_exact( packet_size * 700); // increase counter - global
-	}
+double connection_basic::get_send_delay(size_t packet_size) {
+	const uint64_t limit = connection_basic_pimpl::m_rate_up_limit_per_connection;
+	if (mI->m_bucket_out.get_rate() != limit)
+		mI->m_bucket_out.set_rate(limit);
 
-}
-void connection_basic::set_start_time() {
-	CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-	m_start_time = network_throttle_manager::get_global_throttle_out().get_time_seconds();
+	double delay = std::max(network_throttle_manager::get_global_bucket_out().get_delay(packet_size), mI->m_bucket_out.get_delay(packet_size));
+	if (delay > 0) {
+		long int ms = (long int)(delay * 1000);
+		_info_c("net/sleep", "Delaying send in " << __FUNCTION__ << " for " << ms << " ms before packet_size="<<packet_size);
+		epee::net_utils::data_logger::get_instance().add_data("sleep_up", ms);
+	}
+	return delay;
 }
 
-void connection_basic::do_send_handler_write(const void* ptr , size_t cb ) {
-	sleep_before_packet(cb,1,-1);
-	_info_c("net/out/size", "handler_write (direct) - before ASIO write, for packet="<<cb<<" B (after sleep)");
-	set_start_time();
+void connection_basic::count_send(size_t packet_size) {
+	network_throttle_manager::get_global_bucket_out().consume(packet_size);
+	mI->m_bucket_out.consume(packet_size);
 }
 
-void connection_basic::do_send_handler_write_from_queue( const boost::system::error_code& e, size_t cb, int q_len ) {
-	sleep_before_packet(cb,2,q_len);
-	_info_c("net/out/size", "handler_write (after write, from queue="<<q_len<<") - before ASIO write, for packet="<<cb<<" B (after sleep)");
+double connection_basic::get_recv_delay(size_t packet_size) {
+	const uint64_t limit = connection_basic_pimpl::m_rate_down_limit_per_connection;
+	if (mI->m_bucket_in.get_rate() != limit)
+		mI->m_bucket_in.set_rate(limit);
+
+	double delay = std::max(network_throttle_manager::get_global_bucket_in().get_delay(packet_size), mI->m_bucket_in.get_delay(packet_size));
+	if (delay > 0) {
+		long int ms = (long int)(delay * 1000);
+		epee::net_utils::data_logger::get_instance().add_data("sleep_down", ms);
+	}
+	return delay;
+}
 
-	set_start_time();
+void connection_basic::count_recv(size_t packet_size) {
+	network_throttle_manager::get_global_bucket_in().consume(packet_size);
+	mI->m_bucket_in.consume(packet_size);
 }
 
 void connection_basic::logger_handle_net_read(size_t size) { // network data read
@@ -302,9 +278,7 @@ void connection_basic::logger_handle_net_write(size_t size) {
 }
 
 double connection_basic::get_sleep_time(size_t cb) {
-	CRITICAL_REGION_LOCAL(epee::net_utils::network_throttle_manager::network_throttle_manager::m_lock_get_global_throttle_out);
-    auto t = network_throttle_manager::get_global_throttle_out().get_sleep_time(cb);
-    return t;
+    return network_throttle_manager::get_global_bucket_out().get_delay(cb);
 }
 
 void connection_basic::set_save_graph(bool save_graph) {
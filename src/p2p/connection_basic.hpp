@@ -74,6 +74,29 @@ namespace net_utils
 
 class connection_basic_pimpl; // PIMPL for this class
 
+  // a part of a message waiting to be sent: bytes of its own (a levin
+  // header, or the data of a plain do_send) then a slice of a shared
+  // buffer, written together
+  struct send_que_entry
+  {
+    std::string head;
+    shared_buffer data;
+    size_t data_offset = 0;
+    size_t data_size = 0;
+    t_send_priority priority = e_send_priority_bulk;
+    bool message_start = false; // first part of a do_send_shared() message, others may be queued before it
+
+    size_t size() const { return head.size() + data_size; }
+    boost::array<boost::asio::const_buffer, 2> buffers() const
+    {
+      boost::array<boost::asio::const_buffer, 2> bufs = {{
+        boost::asio::buffer(head),
+        data ? boost::asio::buffer(data->data() + data_offset, data_size) : boost::asio::const_buffer()
+      }};
+      return bufs;
+    }
+  };
+
   enum t_connection_type { // type of the connection (of this server), e.g. so that we will know how to limit it
 	  e_connection_type_NET = 0, // default (not used?)
 	  e_connection_type_RPC = 1, // the rpc commands  (probably not rate limited, not chunked, etc)
@@ -90,9 +113,8 @@ class connection_basic { // not-templated base class for rapid developmet of som
     volatile uint32_t m_want_close_connection;
     std::atomic<bool> m_was_shutdown;
     critical_section m_send_que_lock;
-    std::list<std::string> m_send_que;
+    std::list<send_que_entry> m_send_que;
     volatile bool m_is_multithreaded;
-    double m_start_time;
     /// Strand to ensure the connection's handlers are not called concurrently.
     boost::asio::io_service::strand strand_;
     /// Socket for the connection.
@@ -105,14 +127,9 @@ class connection_basic { // not-templated base class for rapid developmet of som
 
 		virtual ~connection_basic();
 
-		// various handlers to be called from connection class:
-		void do_send_handler_write(const void * ptr , size_t cb);
-		void do_send_handler_write_from_queue(const boost::system::error_code& e, size_t cb , int q_len); // from handle_write, sending next part
-
 		void logger_handle_net_write(size_t size); // network data written
 		void logger_handle_net_read(size_t size); // network data read
 
-		void set_start_time();
 
 		// config for rate limit
 		
@@ -120,13 +137,19 @@ class connection_basic { // not-templated base class for rapid developmet of som
 		static void set_rate_down_limit(uint64_t limit);
 		static uint64_t get_rate_up_limit();
 		static uint64_t get_rate_down_limit();
+		static void set_rate_up_limit_per_connection(uint64_t limit); ///< 0 for none
+		static void set_rate_down_limit_per_connection(uint64_t limit); ///< ditto
 
 		// config misc
 		static void set_tos_flag(int tos); // ToS / QoS flag
 		static int get_tos_flag();
 
-		// handlers and sleep
-		void sleep_before_packet(size_t packet_size, int phase, int q_len); // execute a sleep ; phase is not really used now(?)
+		// rate limits: seconds to wait, on a timer, before sending packet_size
+		// bytes, or before reading again after packet_size bytes came in
+		double get_send_delay(size_t packet_size);
+		double get_recv_delay(size_t packet_size);
+		void count_send(size_t packet_size); // packet_size bytes are being sent now
+		void count_recv(size_t packet_size); // packet_size bytes were read
 		static void save_limit_to_file(int limit); ///< for dr-monero
 		static double get_sleep_time(size_t cb);
 		
@@ -170,12 +170,15 @@ namespace nodetool
     virtual void callback(p2p_connection_context& context);
     //----------------- i_p2p_endpoint -------------------------------------------------------------
     virtual bool relay_notify_to_all(int command, const std::string& data_buff, const epee::net_utils::connection_context_base& context);
+    virtual bool relay_notify_to_list(int command, const epee::net_utils::shared_buffer& data_buff, const std::list<boost::uuids::uuid>& connections);
     virtual bool invoke_command_to_peer(int command, const std::string& req_buff, std::string& resp_buff, const epee::net_utils::connection_context_base& context);
     virtual bool invoke_notify_to_peer(int command, const std::string& req_buff, const epee::net_utils::connection_context_base& context);
     virtual bool drop_connection(const epee::net_utils::connection_context_base& context);
     virtual void request_callback(const epee::net_utils::connection_context_base& context);
     virtual void for_each_connection(std::function<bool(typename t_payload_net_handler::connection_context&, peerid_type)> f);
     virtual bool add_ip_fail(uint32_t address);
+    virtual bool add_peer_fail(const epee::net_utils::connection_context_base& context);
+    virtual void set_command_priority(int command, epee::net_utils::t_send_priority priority);
     //----------------- i_connection_filter  --------------------------------------------------------
     virtual bool is_remote_ip_allowed(uint32_t adress);
     //-----------------------------------------------------------------------------------------------
@@ -194,12 +197,16 @@ namespace nodetool
 
     bool connections_maker();
     bool peer_sync_idle_maker();
+    // drops the outgoing connection scoring far below the others, so a
+    // better peer from the peerlist can take its place
+    bool rotate_slow_connections();
     bool do_handshake_with_peer(peerid_type& pi, p2p_connection_context& context, bool just_take_peerlist = false);
     bool do_peer_timed_sync(const epee::net_utils::connection_context_base& context, peerid_type peer_id);
 
     bool make_new_connection_from_peerlist(bool use_white_list);
     bool try_to_connect_and_handshake_with_new_peer(const net_address& na, bool just_take_peerlist = false, uint64_t last_seen_stamp = 0, bool white = true);
     size_t get_random_index_with_fixed_probability(size_t max_index);
+    double get_white_peer_score(size_t index);
     bool is_peer_used(const peerlist_entry& peer);
     bool is_addr_connected(const net_address& peer);
     template<class t_callback>
@@ -220,6 +227,7 @@ namespace nodetool
 
     bool set_rate_up_limit(const boost::program_options::variables_map& vm, int64_t limit);
     bool set_rate_down_limit(const boost::program_options::variables_map& vm, int64_t limit);
+    bool set_rate_limit_per_peer(const boost::program_options::variables_map& vm, int64_t limit_up, int64_t limit_down);
     bool set_rate_limit(const boost::program_options::variables_map& vm, int64_t limit);
 
     void kill() { ///< will be called e.g. from deinit()
@@ -280,6 +288,7 @@ namespace nodetool
     epee::math_helper::once_a_time_seconds<P2P_DEFAULT_HANDSHAKE_INTERVAL> m_peer_handshake_idle_maker_interval;
     epee::math_helper::once_a_time_seconds<1> m_connections_maker_interval;
     epee::math_helper::once_a_time_seconds<60*30, false> m_peerlist_store_interval;
+    epee::math_helper::once_a_time_seconds<P2P_PEER_ROTATE_INTERVAL, false> m_peer_rotate_interval;
 
     std::string m_bind_ip;
     std::string m_port;
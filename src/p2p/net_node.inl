@@ -35,6 +35,7 @@
 #include <algorithm>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/make_shared.hpp>
 #include <atomic>
 
 #include "version.h"
@@ -98,6 +99,8 @@ namespace nodetool
     const command_line::arg_descriptor<int64_t> arg_limit_rate_up = {"limit-rate-up", "set limit-rate-up [kB/s]", -1};
     const command_line::arg_descriptor<int64_t> arg_limit_rate_down = {"limit-rate-down", "set limit-rate-down [kB/s]", -1};
     const command_line::arg_descriptor<int64_t> arg_limit_rate = {"limit-rate", "set limit-rate [kB/s]", -1};
+    const command_line::arg_descriptor<int64_t> arg_limit_rate_up_per_peer = {"limit-rate-up-per-peer", "set limit-rate-up for each peer [kB/s]", -1};
+    const command_line::arg_descriptor<int64_t> arg_limit_rate_down_per_peer = {"limit-rate-down-per-peer", "set limit-rate-down for each peer [kB/s]", -1};
 
     const command_line::arg_descriptor<bool> arg_save_graph = {"save-graph", "Save data for dr monero", false};
   }
@@ -122,6 +125,8 @@ namespace nodetool
     command_line::add_arg(desc, arg_limit_rate_up);
     command_line::add_arg(desc, arg_limit_rate_down);
     command_line::add_arg(desc, arg_limit_rate);
+    command_line::add_arg(desc, arg_limit_rate_up_per_peer);
+    command_line::add_arg(desc, arg_limit_rate_down_per_peer);
     command_line::add_arg(desc, arg_save_graph);
   }
   //-----------------------------------------------------------------------------------
@@ -233,6 +238,20 @@ namespace nodetool
   }
   //-----------------------------------------------------------------------------------
   template<class t_payload_net_handler>
+  bool node_server<t_payload_net_handler>::add_peer_fail(const epee::net_utils::connection_context_base& context)
+  {
+    // only the port of outgoing connections is the one the peer is known by
+    if(!context.m_is_income)
+    {
+      net_address na = AUTO_VAL_INIT(na);
+      na.ip = context.m_remote_ip;
+      na.port = context.m_remote_port;
+      m_peerlist.add_peer_invalid(na);
+    }
+    return add_ip_fail(context.m_remote_ip);
+  }
+  //-----------------------------------------------------------------------------------
+  template<class t_payload_net_handler>
   bool node_server<t_payload_net_handler>::parse_peer_from_string(nodetool::net_address& pe, const std::string& node_addr)
   {
     return epee::string_tools::parse_peer_from_string(pe.ip, pe.port, node_addr);
@@ -307,6 +326,9 @@ namespace nodetool
     if ( !set_rate_limit(vm, command_line::get_arg(vm, arg_limit_rate) ) )
       return false;
 
+    if ( !set_rate_limit_per_peer(vm, command_line::get_arg(vm, arg_limit_rate_up_per_peer), command_line::get_arg(vm, arg_limit_rate_down_per_peer) ) )
+      return false;
+
     return true;
   }
   //-----------------------------------------------------------------------------------
@@ -695,7 +717,7 @@ namespace nodetool
       if(!handle_remote_peerlist(rsp.local_peerlist, rsp.node_data.local_time, context))
       {
         LOG_ERROR_CCONTEXT("COMMAND_HANDSHAKE: failed to handle_remote_peerlist(...), closing connection.");
-        add_ip_fail(context.m_remote_ip);
+        add_peer_fail(context);
         return;
       }
       hsh_result = true;
@@ -757,7 +779,7 @@ namespace nodetool
       {
         LOG_ERROR_CCONTEXT("COMMAND_TIMED_SYNC: failed to handle_remote_peerlist(...), closing connection.");
         m_net_server.get_config_object().close(context.m_connection_id );
-        add_ip_fail(context.m_remote_ip);
+        add_peer_fail(context);
       }
       if(!context.m_is_income)
         m_peerlist.set_peer_just_seen(context.peer_id, context.m_remote_ip, context.m_remote_port);
@@ -936,6 +958,15 @@ namespace nodetool
       size_t random_index = get_random_index_with_fixed_probability(max_random_index);
       CHECK_AND_ASSERT_MES(random_index < local_peers_count, false, "random_starter_index < peers_local.size() failed!!");
 
+      if(use_white_list)
+      {
+        // of two picked at random, the one which served us better before;
+        // still random enough that every peer gets its turn
+        size_t other_index = get_random_index_with_fixed_probability(max_random_index);
+        if(!tried_peers.count(other_index) && (tried_peers.count(random_index) || get_white_peer_score(other_index) > get_white_peer_score(random_index)))
+          random_index = other_index;
+      }
+
       if(tried_peers.count(random_index))
         continue;
 
@@ -975,6 +1006,16 @@ namespace nodetool
   }
   //-----------------------------------------------------------------------------------
   template<class t_payload_net_handler>
+  double node_server<t_payload_net_handler>::get_white_peer_score(size_t index)
+  {
+    peerlist_entry pe = AUTO_VAL_INIT(pe);
+    peer_score score;
+    if(m_peerlist.get_white_peer_by_index(pe, index))
+      m_peerlist.get_peer_score(pe.adr, score);
+    return get_peer_score_value(score);
+  }
+  //-----------------------------------------------------------------------------------
+  template<class t_payload_net_handler>
   bool node_server<t_payload_net_handler>::connections_maker()
   {
     if (!connect_to_peerlist(m_exclusive_peers)) return false;
@@ -1072,6 +1113,45 @@ namespace nodetool
     m_peer_handshake_idle_maker_interval.do_call(boost::bind(&node_server<t_payload_net_handler>::peer_sync_idle_maker, this));
     m_connections_maker_interval.do_call(boost::bind(&node_server<t_payload_net_handler>::connections_maker, this));
     m_peerlist_store_interval.do_call(boost::bind(&node_server<t_payload_net_handler>::store_config, this));
+    m_peer_rotate_interval.do_call(boost::bind(&node_server<t_payload_net_handler>::rotate_slow_connections, this));
+    return true;
+  }
+  //-----------------------------------------------------------------------------------
+  template<class t_payload_net_handler>
+  bool node_server<t_payload_net_handler>::rotate_slow_connections()
+  {
+    if(m_offline || !m_exclusive_peers.empty())
+      return true;
+    // only once all outgoing connections are made, with more known peers to
+    // try in the place of one
+    if(get_outgoing_connections_count() < m_config.m_net_config.connections_count
+       || m_peerlist.get_white_peers_count() <= m_config.m_net_config.connections_count)
+      return true;
+
+    std::vector<std::pair<double, boost::uuids::uuid> > scores;
+    m_net_server.get_config_object().foreach_connection([&](const p2p_connection_context& cntxt)
+    {
+      net_address na = AUTO_VAL_INIT(na);
+      na.ip = cntxt.m_remote_ip;
+      na.port = cntxt.m_remote_port;
+      if(cntxt.m_is_income || !cntxt.peer_id || is_priority_node(na))
+        return true;
+      peer_score score;
+      m_payload_handler.get_peer_score(cntxt, score);
+      if(score.rate > 0)
+        scores.push_back(std::make_pair(get_peer_score_value(score), cntxt.m_connection_id));
+      return true;
+    });
+    if(scores.size() < P2P_PEER_ROTATE_MIN_SCORED)
+      return true;
+
+    std::sort(scores.begin(), scores.end());
+    const double median = scores[scores.size() / 2].first;
+    if(scores.front().first * P2P_PEER_ROTATE_SCORE_RATIO >= median)
+      return true;
+
+    LOG_PRINT_L1("Replacing slow outgoing connection " << scores.front().second << ", score " << scores.front().first << " against median " << median);
+    m_net_server.get_config_object().close(scores.front().second);
     return true;
   }
   //-----------------------------------------------------------------------------------
@@ -1241,6 +1321,13 @@ namespace nodetool
       return true;
     });
 
+    return relay_notify_to_list(command, boost::make_shared<std::string>(data_buff), connections);
+  }
+  //-----------------------------------------------------------------------------------
+  template<class t_payload_net_handler>
+  bool node_server<t_payload_net_handler>::relay_notify_to_list(int command, const epee::net_utils::shared_buffer& data_buff, const std::list<boost::uuids::uuid>& connections)
+  {
+    // every send queue refers to the same data_buff
     BOOST_FOREACH(const auto& c_id, connections)
     {
       m_net_server.get_config_object().notify(command, data_buff, c_id);
@@ -1249,6 +1336,12 @@ namespace nodetool
   }
   //-----------------------------------------------------------------------------------
   template<class t_payload_net_handler>
+  void node_server<t_payload_net_handler>::set_command_priority(int command, epee::net_utils::t_send_priority priority)
+  {
+    m_net_server.get_config_object().set_command_priority(command, priority);
+  }
+  //-----------------------------------------------------------------------------------
+  template<class t_payload_net_handler>
   void node_server<t_payload_net_handler>::callback(p2p_connection_context& context)
   {
     m_payload_handler.on_callback(context);
@@ -1366,7 +1459,7 @@ namespace nodetool
 
       LOG_PRINT_CCONTEXT_L1("WRONG NETWORK AGENT CONNECTED! id=" << epee::string_tools::get_str_from_guid_a(arg.node_data.network_id));
       drop_connection(context);
-      add_ip_fail(context.m_remote_ip);
+      add_peer_fail(context);
       return 1;
     }
 
@@ -1374,7 +1467,7 @@ namespace nodetool
     {
       LOG_ERROR_CCONTEXT("COMMAND_HANDSHAKE came not from incoming connection");
       drop_connection(context);
-      add_ip_fail(context.m_remote_ip);
+      add_peer_fail(context);
       return 1;
     }
 
@@ -1475,6 +1568,18 @@ namespace nodetool
   void node_server<t_payload_net_handler>::on_connection_close(p2p_connection_context& context)
   {
     LOG_PRINT_L2("["<< epee::net_utils::print_connection_context(context) << "] CLOSE CONNECTION");
+    // only the port of outgoing connections is the one the peer listens on,
+    // and so the one it is known by in the peerlist
+    if(!context.m_is_income && context.peer_id)
+    {
+      net_address na = AUTO_VAL_INIT(na);
+      na.ip = context.m_remote_ip;
+      na.port = context.m_remote_port;
+      peer_score score;
+      m_payload_handler.get_peer_score(context, score);
+      m_peerlist.update_peer_score(na, score);
+    }
+    m_payload_handler.on_connection_close(context);
   }
 
   template<class t_payload_net_handler>
@@ -1603,4 +1708,19 @@ namespace nodetool
 
     return true;
   }
+
+  template<class t_payload_net_handler>
+  bool node_server<t_payload_net_handler>::set_rate_limit_per_peer(const boost::program_options::variables_map& vm, int64_t limit_up, int64_t limit_down)
+  {
+    // -1 (the default) leaves each peer limited only by the global limits
+    if (limit_up != -1) {
+      epee::net_utils::connection<epee::levin::async_protocol_handler<p2p_connection_context> >::set_rate_up_limit_per_connection(limit_up * 1024);
+      LOG_PRINT_L0("Set limit-up per peer to " << limit_up << " kB/s");
+    }
+    if (limit_down != -1) {
+      epee::net_utils::connection<epee::levin::async_protocol_handler<p2p_connection_context> >::set_rate_down_limit_per_connection(limit_down * 1024);
+      LOG_PRINT_L0("Set limit-down per peer to " << limit_down << " kB/s");
+    }
+    return true;
+  }
 }
@@ -44,6 +44,7 @@ namespace nodetool
   struct i_p2p_endpoint
   {
     virtual bool relay_notify_to_all(int command, const std::string& data_buff, const epee::net_utils::connection_context_base& context)=0;
+    virtual bool relay_notify_to_list(int command, const epee::net_utils::shared_buffer& data_buff, const std::list<boost::uuids::uuid>& connections)=0;
     virtual bool invoke_command_to_peer(int command, const std::string& req_buff, std::string& resp_buff, const epee::net_utils::connection_context_base& context)=0;
     virtual bool invoke_notify_to_peer(int command, const std::string& req_buff, const epee::net_utils::connection_context_base& context)=0;
     virtual bool drop_connection(const epee::net_utils::connection_context_base& context)=0;
@@ -54,6 +55,9 @@ namespace nodetool
     virtual bool unblock_ip(uint32_t adress)=0;
     virtual std::map<uint32_t, time_t> get_blocked_ips()const=0;
     virtual bool add_ip_fail(uint32_t adress)=0;
+    // add_ip_fail, and counted against the peer's score
+    virtual bool add_peer_fail(const epee::net_utils::connection_context_base& context)=0;
+    virtual void set_command_priority(int command, epee::net_utils::t_send_priority priority)=0;
   };
 
   template<class t_connection_context>
@@ -63,6 +67,10 @@ namespace nodetool
     {
       return false;
     }
+    virtual bool relay_notify_to_list(int command, const epee::net_utils::shared_buffer& data_buff, const std::list<boost::uuids::uuid>& connections)
+    {
+      return false;
+    }
     virtual bool invoke_command_to_peer(int command, const std::string& req_buff, std::string& resp_buff, const epee::net_utils::connection_context_base& context)
     {
       return false;
@@ -104,5 +112,12 @@ namespace nodetool
     {
       return true;
     }
+    virtual bool add_peer_fail(const epee::net_utils::connection_context_base& context)
+    {
+      return true;
+    }
+    virtual void set_command_priority(int command, epee::net_utils::t_send_priority priority)
+    {
+    }
   };
 }
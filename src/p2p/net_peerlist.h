@@ -39,6 +39,7 @@
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/serialization/version.hpp>
+#include <boost/serialization/map.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -53,7 +54,7 @@
 #include "net_peerlist_boost_serialization.h"
 
 
-#define CURRENT_PEERLIST_STORAGE_ARCHIVE_VER    4
+#define CURRENT_PEERLIST_STORAGE_ARCHIVE_VER    5
 
 namespace nodetool
 {
@@ -80,6 +81,9 @@ namespace nodetool
     bool set_peer_just_seen(peerid_type peer, const net_address& addr);
     bool set_peer_unreachable(const peerlist_entry& pr);
     bool is_ip_allowed(uint32_t ip);
+    bool get_peer_score(const net_address& addr, peer_score& score);
+    bool update_peer_score(const net_address& addr, const peer_score& measured);
+    bool add_peer_invalid(const net_address& addr);
 
     
   private:
@@ -160,6 +164,9 @@ namespace nodetool
       }
       a & m_peers_white;
       a & m_peers_gray;
+      if(ver < 5)
+        return;
+      a & m_peer_scores;
     }
 
   private: 
@@ -175,6 +182,7 @@ namespace nodetool
 
     peers_indexed m_peers_gray;
     peers_indexed m_peers_white;
+    std::map<net_address, peer_score> m_peer_scores; // of white peers only
   };
   //--------------------------------------------------------------------------------------------------
   inline
@@ -219,6 +227,7 @@ namespace nodetool
     while(m_peers_white.size() > P2P_LOCAL_WHITE_PEERLIST_LIMIT)
     {
       peers_indexed::index<by_time>::type& sorted_index=m_peers_white.get<by_time>();
+      m_peer_scores.erase(sorted_index.begin()->adr);
       sorted_index.erase(sorted_index.begin());
     }
   }
@@ -393,6 +402,50 @@ namespace nodetool
     return true;
   }
   //--------------------------------------------------------------------------------------------------
+  inline
+  bool peerlist_manager::get_peer_score(const net_address& addr, peer_score& score)
+  {
+    CRITICAL_REGION_LOCAL(m_peerlist_lock);
+    auto it = m_peer_scores.find(addr);
+    if(it == m_peer_scores.end())
+      return false;
+    score = it->second;
+    decay_peer_invalid_count(score, time(NULL));
+    return true;
+  }
+  //--------------------------------------------------------------------------------------------------
+  inline
+  bool peerlist_manager::update_peer_score(const net_address& addr, const peer_score& measured)
+  {
+    CRITICAL_REGION_LOCAL(m_peerlist_lock);
+    if(m_peers_white.get<by_addr>().find(addr) == m_peers_white.get<by_addr>().end())
+      return false;
+
+    // averaged with what was measured on earlier connections, so one
+    // unlucky session does not condemn a peer
+    peer_score& score = m_peer_scores[addr];
+    auto smooth = [](double &avg, double sample) { if (sample > 0) avg = avg > 0 ? (avg + sample) / 2 : sample; };
+    smooth(score.rate, measured.rate);
+    smooth(score.latency, measured.latency);
+    score.height_behind = measured.height_behind;
+    return true;
+  }
+  //--------------------------------------------------------------------------------------------------
+  inline
+  bool peerlist_manager::add_peer_invalid(const net_address& addr)
+  {
+    CRITICAL_REGION_LOCAL(m_peerlist_lock);
+    if(m_peers_white.get<by_addr>().find(addr) == m_peers_white.get<by_addr>().end())
+      return false;
+
+    peer_score& score = m_peer_scores[addr];
+    const time_t now = time(NULL);
+    decay_peer_invalid_count(score, now);
+    ++score.invalid_count;
+    score.last_invalid = now;
+    return true;
+  }
+  //--------------------------------------------------------------------------------------------------
 }
 
 BOOST_CLASS_VERSION(nodetool::peerlist_manager, CURRENT_PEERLIST_STORAGE_ARCHIVE_VER)
@@ -50,5 +50,15 @@ namespace boost
       a & pl.id;
       a & pl.last_seen;
     }    
+
+    template <class Archive, class ver_type>
+    inline void serialize(Archive &a,  nodetool::peer_score& ps, const ver_type ver)
+    {
+      a & ps.rate;
+      a & ps.latency;
+      a & ps.height_behind;
+      a & ps.invalid_count;
+      a & ps.last_invalid;
+    }
   }
 }
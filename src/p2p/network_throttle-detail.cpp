@@ -377,6 +377,71 @@ double network_throttle::get_current_speed() const {
 	return bytes_transferred / ((m_history.size() - 1) * m_slot_size);
 }
 
+// ================================================================================================
+// network_token_bucket
+// ================================================================================================
+
+network_token_bucket::network_token_bucket()
+	: m_rate(0), m_tokens(0), m_last_refill(get_time_us())
+{
+}
+
+void network_token_bucket::set_rate(uint64_t bytes_per_second)
+{
+	m_rate = bytes_per_second;
+	m_tokens = (int64_t)bytes_per_second * 1000000; // start full
+	m_last_refill = get_time_us();
+}
+
+uint64_t network_token_bucket::get_rate() const
+{
+	return m_rate;
+}
+
+void network_token_bucket::refill()
+{
+	const int64_t rate = m_rate.load(std::memory_order_relaxed);
+	const int64_t now = get_time_us();
+	int64_t last = m_last_refill.load(std::memory_order_relaxed);
+	if (now <= last)
+		return;
+	// whoever moves m_last_refill adds the tokens for that time, so each
+	// microsecond is counted by exactly one thread
+	if (!m_last_refill.compare_exchange_strong(last, now, std::memory_order_relaxed))
+		return;
+
+	const int64_t full = rate * 1000000;
+	const int64_t added = std::min<int64_t>(now - last, 1000000) * rate;
+	int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+	while (tokens < full && !m_tokens.compare_exchange_weak(tokens, std::min(tokens + added, full), std::memory_order_relaxed))
+		;
+}
+
+network_time_seconds network_token_bucket::get_delay(size_t packet_size)
+{
+	const uint64_t rate = m_rate.load(std::memory_order_relaxed);
+	if (!rate)
+		return 0;
+	refill();
+	const int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+	if (tokens > 0)
+		return 0;
+	return (1 - tokens) / 1000000.0 / rate;
+}
+
+void network_token_bucket::consume(size_t packet_size)
+{
+	if (!m_rate.load(std::memory_order_relaxed))
+		return;
+	refill();
+	m_tokens.fetch_sub((int64_t)packet_size * 1000000, std::memory_order_relaxed);
+}
+
+int64_t network_token_bucket::get_time_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 } // namespace
 } // namespace
 
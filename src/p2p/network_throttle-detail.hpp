@@ -119,6 +119,33 @@ struct network_throttle_bw {
 		network_throttle_bw(const std::string &name1);
 };
 
+/***
+@brief Rate limit as a token bucket, safe to use from many threads without a lock
+
+Tokens (bytes) refill at the set rate, up to one second's worth. A packet may
+go as long as there are any tokens left, and may take the bucket below zero,
+so that a packet bigger than the bucket still goes; the next one then waits
+until the debt is paid back. Counts are kept in millionths of a byte, so that
+refilling every few microseconds loses nothing to rounding.
+*/
+class network_token_bucket {
+	public:
+		network_token_bucket();
+		void set_rate(uint64_t bytes_per_second); ///< 0 for no limit
+		uint64_t get_rate() const;
+
+		network_time_seconds get_delay(size_t packet_size); ///< how long to wait before sending/reading packet_size bytes, 0 if they may go now
+		void consume(size_t packet_size); ///< count packet_size bytes sent/read
+
+	private:
+		void refill();
+		static int64_t get_time_us();
+
+		std::atomic<uint64_t> m_rate; // bytes per second
+		std::atomic<int64_t> m_tokens; // millionths of a byte
+		std::atomic<int64_t> m_last_refill; // microseconds, from get_time_us()
+};
+
 
 
 } // namespace net_utils
@@ -67,21 +67,19 @@ namespace net_utils
 
 // ================================================================================================
 // static:
-std::mutex network_throttle_manager::m_lock_get_global_throttle_in;
 std::mutex network_throttle_manager::m_lock_get_global_throttle_inreq;
-std::mutex network_throttle_manager::m_lock_get_global_throttle_out;
 
 int network_throttle_manager::xxx;
 
 
 // ================================================================================================
 // methods:
-i_network_throttle & network_throttle_manager::get_global_throttle_in() { 
-	std::call_once(m_once_get_global_throttle_in, [] { m_obj_get_global_throttle_in.reset(new network_throttle("in/all","<<< global-IN",10)); }	);
-	return * m_obj_get_global_throttle_in;
+network_token_bucket & network_throttle_manager::get_global_bucket_in() {
+	std::call_once(m_once_get_global_bucket_in, [] { m_obj_get_global_bucket_in.reset(new network_token_bucket()); }	);
+	return * m_obj_get_global_bucket_in;
 }
-std::once_flag network_throttle_manager::m_once_get_global_throttle_in;
-std::unique_ptr<i_network_throttle> network_throttle_manager::m_obj_get_global_throttle_in;
+std::once_flag network_throttle_manager::m_once_get_global_bucket_in;
+std::unique_ptr<network_token_bucket> network_throttle_manager::m_obj_get_global_bucket_in;
 
 
 
@@ -93,12 +91,12 @@ std::once_flag network_throttle_manager::m_once_get_global_throttle_inreq;
 std::unique_ptr<i_network_throttle> network_throttle_manager::m_obj_get_global_throttle_inreq;
 
 
-i_network_throttle & network_throttle_manager::get_global_throttle_out() { 
-	std::call_once(m_once_get_global_throttle_out, [] { m_obj_get_global_throttle_out.reset(new network_throttle("out/all", ">>> global-OUT",10)); }	);
-	return * m_obj_get_global_throttle_out;
+network_token_bucket & network_throttle_manager::get_global_bucket_out() {
+	std::call_once(m_once_get_global_bucket_out, [] { m_obj_get_global_bucket_out.reset(new network_token_bucket()); }	);
+	return * m_obj_get_global_bucket_out;
 }
-std::once_flag network_throttle_manager::m_once_get_global_throttle_out;
-std::unique_ptr<i_network_throttle> network_throttle_manager::m_obj_get_global_throttle_out;
+std::once_flag network_throttle_manager::m_once_get_global_bucket_out;
+std::unique_ptr<network_token_bucket> network_throttle_manager::m_obj_get_global_bucket_out;
 
 
 
@@ -43,6 +43,7 @@
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <atomic>
+#include <chrono>
 
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
@@ -86,6 +87,7 @@ typedef double network_time_seconds;
 typedef double network_MB;
 
 class i_network_throttle;
+class network_token_bucket;
 
 /***
 @brief All information about given throttle - speed calculations
@@ -105,7 +107,7 @@ namespace cryptonote { class cryptonote_protocol_handler_base; } // a friend cla
 @brief Access to simple throttles, with singlton to access global network limits
 */
 class network_throttle_manager {
-	// provides global (singleton) in/inreq/out throttle access
+	// provides global (singleton) in/out limits and inreq throttle access
 
 	// [[note1]] see also http://www.nuonsoft.com/blog/2012/10/21/implementing-a-thread-safe-singleton-with-c11/
 	// [[note2]] _inreq is the requested in traffic - we anticipate we will get in-bound traffic soon as result of what we do (e.g. that we sent network downloads requests)
@@ -113,16 +115,14 @@ class network_throttle_manager {
 	//protected:
 	public: // XXX
 		// [[note1]]
-		static std::once_flag m_once_get_global_throttle_in; 
+		static std::once_flag m_once_get_global_bucket_in;
 		static std::once_flag m_once_get_global_throttle_inreq; // [[note2]]
-		static std::once_flag m_once_get_global_throttle_out;
-		static std::unique_ptr<i_network_throttle> m_obj_get_global_throttle_in;
+		static std::once_flag m_once_get_global_bucket_out;
+		static std::unique_ptr<network_token_bucket> m_obj_get_global_bucket_in;
 		static std::unique_ptr<i_network_throttle> m_obj_get_global_throttle_inreq;
-		static std::unique_ptr<i_network_throttle> m_obj_get_global_throttle_out;
+		static std::unique_ptr<network_token_bucket> m_obj_get_global_bucket_out;
 
-    static std::mutex m_lock_get_global_throttle_in;
     static std::mutex m_lock_get_global_throttle_inreq;
-    static std::mutex m_lock_get_global_throttle_out;
 
 		friend class cryptonote::cryptonote_protocol_handler_base; // FRIEND - to directly access global throttle-s. !! REMEMBER TO USE LOCKS!
 		friend class connection_basic; // FRIEND - to directly access global throttle-s. !! REMEMBER TO USE LOCKS!
@@ -131,9 +131,9 @@ class network_throttle_manager {
 		static int xxx;
 
 	public:
-		static i_network_throttle & get_global_throttle_in(); ///< singleton ; for friend class ; caller MUST use proper locks! like m_lock_get_global_throttle_in
-		static i_network_throttle & get_global_throttle_inreq(); ///< ditto ; use lock ... use m_lock_get_global_throttle_inreq obviously
-		static i_network_throttle & get_global_throttle_out(); ///< ditto ; use lock ... use m_lock_get_global_throttle_out obviously
+		static network_token_bucket & get_global_bucket_in(); ///< singleton ; no lock needed
+		static i_network_throttle & get_global_throttle_inreq(); ///< singleton ; for friend class ; caller MUST use m_lock_get_global_throttle_inreq
+		static network_token_bucket & get_global_bucket_out(); ///< singleton ; no lock needed
 };
 
 
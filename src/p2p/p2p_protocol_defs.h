@@ -65,6 +65,38 @@ namespace nodetool
 
 #pragma pack(pop)
 
+  // what we measured of a peer while connected to it; kept locally only,
+  // never sent to other peers
+  struct peer_score
+  {
+    double rate = 0; // bytes/s its blocks came in at, 0 if never measured
+    double latency = 0; // seconds from a request to its answer
+    uint64_t height_behind = 0; // blocks it was behind our chain when last seen
+    uint32_t invalid_count = 0; // times it was dropped for misbehaving
+    int64_t last_invalid = 0; // when it last was
+  };
+
+  // misbehaving is forgiven over time, halving the count every half life
+  inline void decay_peer_invalid_count(peer_score& s, int64_t now)
+  {
+    if(!s.invalid_count || now <= s.last_invalid)
+      return;
+    const int64_t half_lives = (now - s.last_invalid) / P2P_PEER_SCORE_INVALID_HALF_LIFE;
+    s.invalid_count = half_lives >= 32 ? 0 : s.invalid_count >> half_lives;
+    s.last_invalid += half_lives * P2P_PEER_SCORE_INVALID_HALF_LIFE;
+  }
+
+  // how good a source of blocks a peer is, in bytes/s it can be expected to
+  // deliver; peers never measured get a default rate, so they are tried too
+  inline double get_peer_score_value(const peer_score& s)
+  {
+    double value = s.rate > 0 ? s.rate : P2P_PEER_SCORE_DEFAULT_RATE;
+    value /= 1 + s.latency;
+    value /= 1 + (double)s.height_behind / P2P_PEER_SCORE_HEIGHT_SCALE;
+    value /= 1 + 4 * s.invalid_count;
+    return value;
+  }
+
   inline
   bool operator < (const net_address& a, const net_address& b)
   {
@@ -130,6 +130,10 @@ namespace cryptonote
     res.target = m_core.get_blockchain_storage().get_current_hard_fork_version() < 2 ? DIFFICULTY_TARGET_V1 : DIFFICULTY_TARGET_V2;
     res.tx_count = m_core.get_blockchain_storage().get_total_transactions() - res.height; //without coinbase
     res.tx_pool_size = m_core.get_pool_transactions_count();
+    res.tx_pool_bytes = m_core.get_pool().get_txpool_size();
+    res.tx_pool_max_bytes = m_core.get_pool().get_max_txpool_size();
+    res.tx_pool_evicted = m_core.get_pool().get_evicted_count();
+    res.tx_pool_rejected = m_core.get_pool().get_rejected_count();
     res.alt_blocks_count = m_core.get_blockchain_storage().get_alternative_blocks_count();
     uint64_t total_conn = m_p2p.get_connections_count();
     res.outgoing_connections_count = m_p2p.get_outgoing_connections_count();
@@ -293,51 +297,50 @@ namespace cryptonote
       if(b.size() != sizeof(crypto::key_image))
       {
         res.status = "Failed, size of data mismatch";
+        return true;
       }
       key_images.push_back(*reinterpret_cast<const crypto::key_image*>(b.data()));
     }
-    std::vector<bool> spent_status;
-    bool r = m_core.are_key_images_spent(key_images, spent_status);
-    if(!r)
+    std::vector<uint8_t> spent_status;
+    if(!get_key_images_spent_status(key_images, spent_status))
     {
       res.status = "Failed";
       return true;
     }
-    res.spent_status.clear();
-    for (size_t n = 0; n < spent_status.size(); ++n)
-      res.spent_status.push_back(spent_status[n] ? COMMAND_RPC_IS_KEY_IMAGE_SPENT::SPENT_IN_BLOCKCHAIN : COMMAND_RPC_IS_KEY_IMAGE_SPENT::UNSPENT);
-
-    // check the pool too
-    std::vector<cryptonote::tx_info> txs;
-    std::vector<cryptonote::spent_key_image_info> ki;
-    r = m_core.get_pool_transactions_and_spent_keys_info(txs, ki);
-    if(!r)
+    res.spent_status.assign(spent_status.begin(), spent_status.end());
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_is_key_image_spent_bin(const COMMAND_RPC_IS_KEY_IMAGE_SPENT_BIN::request& req, COMMAND_RPC_IS_KEY_IMAGE_SPENT_BIN::response& res)
+  {
+    CHECK_CORE_BUSY();
+    if(!get_key_images_spent_status(req.key_images, res.spent_status))
     {
       res.status = "Failed";
       return true;
     }
-    for (std::vector<cryptonote::spent_key_image_info>::const_iterator i = ki.begin(); i != ki.end(); ++i)
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::get_key_images_spent_status(const std::vector<crypto::key_image>& key_images, std::vector<uint8_t>& spent_status)
+  {
+    std::vector<bool> in_chain, in_pool;
+    if(!m_core.are_key_images_spent(key_images, in_chain))
+      return false;
+    if(!m_core.are_key_images_spent_in_pool(key_images, in_pool))
+      return false;
+    spent_status.resize(key_images.size());
+    for (size_t n = 0; n < key_images.size(); ++n)
     {
-      crypto::hash hash;
-      crypto::key_image spent_key_image;
-      if (parse_hash256(i->id_hash, hash))
-      {
-        memcpy(&spent_key_image, &hash, sizeof(hash)); // a bit dodgy, should be other parse functions somewhere
-        for (size_t n = 0; n < res.spent_status.size(); ++n)
-        {
-          if (res.spent_status[n] == COMMAND_RPC_IS_KEY_IMAGE_SPENT::UNSPENT)
-          {
-            if (key_images[n] == spent_key_image)
-            {
-              res.spent_status[n] = COMMAND_RPC_IS_KEY_IMAGE_SPENT::SPENT_IN_POOL;
-              break;
-            }
-          }
-        }
-      }
+      if (in_chain[n])
+        spent_status[n] = COMMAND_RPC_IS_KEY_IMAGE_SPENT::SPENT_IN_BLOCKCHAIN;
+      else if (in_pool[n])
+        spent_status[n] = COMMAND_RPC_IS_KEY_IMAGE_SPENT::SPENT_IN_POOL;
+      else
+        spent_status[n] = COMMAND_RPC_IS_KEY_IMAGE_SPENT::UNSPENT;
     }
-
-    res.status = CORE_RPC_STATUS_OK;
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------------
@@ -509,6 +512,23 @@ namespace cryptonote
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_transaction_pool_changes(const COMMAND_RPC_GET_TRANSACTION_POOL_CHANGES::request& req, COMMAND_RPC_GET_TRANSACTION_POOL_CHANGES::response& res)
+  {
+    CHECK_CORE_BUSY();
+    std::list<std::pair<crypto::hash, blobdata>> added;
+    std::list<crypto::hash> removed;
+    res.full = !m_core.get_pool_changes_since(req.since, res.sequence, added, removed);
+    res.tx_hashes.reserve(added.size());
+    for (auto& tx : added)
+    {
+      res.tx_hashes.push_back(tx.first);
+      res.txs.push_back(std::move(tx.second));
+    }
+    res.removed.assign(removed.begin(), removed.end());
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::on_stop_daemon(const COMMAND_RPC_STOP_DAEMON::request& req, COMMAND_RPC_STOP_DAEMON::response& res)
   {
     // FIXME: replace back to original m_p2p.send_stop_signal() after
@@ -906,6 +926,10 @@ namespace cryptonote
     res.target = m_core.get_blockchain_storage().get_current_hard_fork_version() < 2 ? DIFFICULTY_TARGET_V1 : DIFFICULTY_TARGET_V2;
     res.tx_count = m_core.get_blockchain_storage().get_total_transactions() - res.height; //without coinbase
     res.tx_pool_size = m_core.get_pool_transactions_count();
+    res.tx_pool_bytes = m_core.get_pool().get_txpool_size();
+    res.tx_pool_max_bytes = m_core.get_pool().get_max_txpool_size();
+    res.tx_pool_evicted = m_core.get_pool().get_evicted_count();
+    res.tx_pool_rejected = m_core.get_pool().get_rejected_count();
     res.alt_blocks_count = m_core.get_blockchain_storage().get_alternative_blocks_count();
     uint64_t total_conn = m_p2p.get_connections_count();
     res.outgoing_connections_count = m_p2p.get_outgoing_connections_count();
@@ -1038,6 +1062,31 @@ namespace cryptonote
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------------
+  bool core_rpc_server::on_get_block_processing_stats(const COMMAND_RPC_GET_BLOCK_PROCESSING_STATS::request& req, COMMAND_RPC_GET_BLOCK_PROCESSING_STATS::response& res, epee::json_rpc::error& error_resp)
+  {
+#if BLOCKCHAIN_DB == DB_LMDB
+    Blockchain &blockchain = m_core.get_blockchain_storage();
+    for (const auto &stats: blockchain.get_block_stage_stats())
+    {
+      COMMAND_RPC_GET_BLOCK_PROCESSING_STATS::stage stage;
+      stage.name = stats.name;
+      stage.count = stats.count;
+      stage.total = stats.total;
+      stage.max = stats.max;
+      stage.histogram = stats.histogram;
+      res.stages.push_back(stage);
+    }
+    if (req.reset)
+      blockchain.reset_block_stage_stats();
+    res.status = CORE_RPC_STATUS_OK;
+    return true;
+#else
+    error_resp.code = CORE_RPC_ERROR_CODE_UNSUPPORTED_RPC;
+    error_resp.message = "Block processing stats unavailable in memory mode.";
+    return false;
+#endif
+  }
+  //------------------------------------------------------------------------------------------------------------------------------
   bool core_rpc_server::on_fast_exit(const COMMAND_RPC_FAST_EXIT::request& req, COMMAND_RPC_FAST_EXIT::response& res)
   {
 	  cryptonote::core::set_fast_exit();
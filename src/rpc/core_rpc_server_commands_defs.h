@@ -151,6 +151,33 @@ namespace cryptonote
     };
   };
 
+  //-----------------------------------------------
+  // binary variant of COMMAND_RPC_IS_KEY_IMAGE_SPENT, for wallets asking
+  // about many key images: both key images and results travel as blobs
+  struct COMMAND_RPC_IS_KEY_IMAGE_SPENT_BIN
+  {
+    struct request
+    {
+      std::vector<crypto::key_image> key_images;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(key_images)
+      END_KV_SERIALIZE_MAP()
+    };
+
+
+    struct response
+    {
+      std::vector<uint8_t> spent_status; // COMMAND_RPC_IS_KEY_IMAGE_SPENT::STATUS
+      std::string status;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(spent_status)
+        KV_SERIALIZE(status)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
   //-----------------------------------------------
   struct COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES
   {
@@ -282,6 +309,10 @@ namespace cryptonote
       uint64_t target;
       uint64_t tx_count;
       uint64_t tx_pool_size;
+      uint64_t tx_pool_bytes;
+      uint64_t tx_pool_max_bytes;
+      uint64_t tx_pool_evicted;
+      uint64_t tx_pool_rejected;
       uint64_t alt_blocks_count;
       uint64_t outgoing_connections_count;
       uint64_t incoming_connections_count;
@@ -298,6 +329,10 @@ namespace cryptonote
         KV_SERIALIZE(target)
         KV_SERIALIZE(tx_count)
         KV_SERIALIZE(tx_pool_size)
+        KV_SERIALIZE(tx_pool_bytes)
+        KV_SERIALIZE(tx_pool_max_bytes)
+        KV_SERIALIZE(tx_pool_evicted)
+        KV_SERIALIZE(tx_pool_rejected)
         KV_SERIALIZE(alt_blocks_count)
         KV_SERIALIZE(outgoing_connections_count)
         KV_SERIALIZE(incoming_connections_count)
@@ -726,6 +761,41 @@ namespace cryptonote
     };
   };
 
+  //-----------------------------------------------
+  // what entered and left the pool after a given change number. Pass 0, or
+  // anything the daemon no longer knows about, and full comes back true with
+  // the whole pool in txs; otherwise, apply removed then txs.
+  struct COMMAND_RPC_GET_TRANSACTION_POOL_CHANGES
+  {
+    struct request
+    {
+      uint64_t since;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(since)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      uint64_t sequence;
+      bool full;
+      std::vector<crypto::hash> tx_hashes;
+      std::list<blobdata> txs;
+      std::vector<crypto::hash> removed;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE(sequence)
+        KV_SERIALIZE(full)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(tx_hashes)
+        KV_SERIALIZE(txs)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(removed)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
   struct COMMAND_RPC_GET_CONNECTIONS
   {
     struct request
@@ -986,5 +1056,45 @@ namespace cryptonote
       END_KV_SERIALIZE_MAP()
     };
   };
+
+  struct COMMAND_RPC_GET_BLOCK_PROCESSING_STATS
+  {
+    struct stage
+    {
+      std::string name;
+      uint64_t count;
+      uint64_t total;
+      uint64_t max;
+      std::vector<uint64_t> histogram;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(name)
+        KV_SERIALIZE(count)
+        KV_SERIALIZE(total)
+        KV_SERIALIZE(max)
+        KV_SERIALIZE(histogram)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct request
+    {
+      bool reset;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(reset)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::string status;
+      std::vector<stage> stages;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(status)
+        KV_SERIALIZE(stages)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
 }
 
@@ -53,6 +53,7 @@ int main(int argc, char *argv[]) {
     data.clear(data.rdstate());
     uint64_t timestamp, difficulty, cumulative_difficulty = 0;
     size_t n = 0;
+    cryptonote::difficulty_window window;
     while (data >> timestamp >> difficulty) {
         size_t begin, end;
         if (n < DIFFICULTY_WINDOW + DIFFICULTY_LAG) {
@@ -71,8 +72,16 @@ int main(int argc, char *argv[]) {
                 << "Found: " << res << endl;
             return 1;
         }
+        uint64_t window_res = window.next_difficulty(DEFAULT_TEST_DIFFICULTY_TARGET);
+        if (window_res != difficulty) {
+            cerr << "Wrong difficulty window result for block " << n << endl
+                << "Expected: " << difficulty << endl
+                << "Found: " << window_res << endl;
+            return 1;
+        }
         timestamps.push_back(timestamp);
         cumulative_difficulties.push_back(cumulative_difficulty += difficulty);
+        window.push_back(timestamp, cumulative_difficulty);
         ++n;
     }
     if (!data.eof()) {
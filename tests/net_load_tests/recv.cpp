@@ -0,0 +1,177 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Measures the levin receive path alone: packets are fed to
+// async_protocol_handler::handle_recv in socket sized reads, as the tcp
+// connection does, and handed to a handler which only counts them.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "include_base_utils.h"
+#include "net/levin_protocol_handler_async.h"
+#include "net/net_utils_base.h"
+
+namespace
+{
+  // every allocation is counted, a copy into a new buffer being one
+  size_t g_allocated_bytes = 0;
+}
+
+void* operator new(size_t size)
+{
+  g_allocated_bytes += size;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+namespace
+{
+  struct test_connection_context : public epee::net_utils::connection_context_base
+  {
+  };
+
+  typedef epee::levin::async_protocol_handler<test_connection_context> test_levin_protocol_handler;
+  typedef epee::levin::async_protocol_handler_config<test_connection_context> test_levin_protocol_handler_config;
+
+  struct counting_commands_handler : public epee::levin::levin_commands_handler<test_connection_context>
+  {
+    virtual int invoke(int command, const std::string& in_buff, std::string& buff_out, test_connection_context& context) { return LEVIN_OK; }
+    virtual int notify(int command, const std::string& in_buff, test_connection_context& context)
+    {
+      ++m_notify_count;
+      m_notify_bytes += in_buff.size();
+      return LEVIN_OK;
+    }
+    virtual void callback(test_connection_context& context) {}
+    virtual void on_connection_new(test_connection_context& context) {}
+    virtual void on_connection_close(test_connection_context& context) {}
+
+    size_t m_notify_count = 0;
+    size_t m_notify_bytes = 0;
+  };
+
+  struct null_connection : public epee::net_utils::i_service_endpoint
+  {
+    null_connection(boost::asio::io_service& io_service): m_io_service(io_service) {}
+    virtual bool do_send(const void* ptr, size_t cb) { return true; }
+    virtual bool close() { return true; }
+    virtual bool call_run_once_service_io() { return true; }
+    virtual bool request_callback() { return true; }
+    virtual boost::asio::io_service& get_io_service() { return m_io_service; }
+    virtual bool add_ref() { return true; }
+    virtual bool release() { return true; }
+
+    boost::asio::io_service& m_io_service;
+  };
+
+  std::string make_stream(size_t packet_count, size_t body_size)
+  {
+    epee::levin::bucket_head2 head = {0};
+    head.m_signature = LEVIN_SIGNATURE;
+    head.m_cb = body_size;
+    head.m_have_to_return_data = false;
+    head.m_command = 1001;
+    head.m_flags = LEVIN_PACKET_REQUEST;
+    head.m_protocol_version = LEVIN_PROTOCOL_VER_1;
+
+    std::string packet((const char*)&head, sizeof(head));
+    packet.append(body_size, 'b');
+    std::string stream;
+    stream.reserve(packet.size() * packet_count);
+    for (size_t i = 0; i < packet_count; ++i)
+      stream += packet;
+    return stream;
+  }
+
+  bool run(const char* name, size_t packet_count, size_t body_size, size_t read_size)
+  {
+    const std::string stream = make_stream(packet_count, body_size);
+
+    boost::asio::io_service io_service;
+    null_connection conn(io_service);
+    counting_commands_handler commands_handler;
+    test_levin_protocol_handler_config config;
+    config.m_pcommands_handler = &commands_handler;
+    config.m_max_packet_size = LEVIN_DEFAULT_MAX_PACKET_SIZE;
+    test_connection_context context;
+    test_levin_protocol_handler handler(&conn, config, context);
+    if (!handler.after_init_connection())
+      return false;
+
+    const size_t allocated_before = g_allocated_bytes;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < stream.size(); pos += read_size)
+    {
+      if (!handler.handle_recv(stream.data() + pos, std::min(read_size, stream.size() - pos)))
+      {
+        std::cout << name << ": handle_recv failed" << std::endl;
+        return false;
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const size_t allocated = g_allocated_bytes - allocated_before;
+
+    if (commands_handler.m_notify_count != packet_count || commands_handler.m_notify_bytes != packet_count * body_size)
+    {
+      std::cout << name << ": " << commands_handler.m_notify_count << " of " << packet_count << " packets handled" << std::endl;
+      return false;
+    }
+
+    std::cout << name << ": " << packet_count << " packets of " << body_size << " bytes in " << read_size << " byte reads" << std::endl
+      << "  " << (size_t)(packet_count / seconds) << " packets/s, " << (size_t)(stream.size() / seconds / 1e6) << " MB/s" << std::endl
+      << "  " << allocated / packet_count << " bytes allocated per packet ("
+      << (double)allocated / (packet_count * body_size) << " per body byte)" << std::endl;
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  epee::debug::get_set_enable_assert(true, false);
+  epee::log_space::get_set_log_detalisation_level(true, LOG_LEVEL_0);
+  epee::log_space::log_singletone::add_logger(LOGGER_CONSOLE, NULL, NULL);
+
+  // the tcp connection reads 8kB at a time
+  const size_t read_size = 8192;
+  bool ok = true;
+  ok &= run("small pipelined", 200000, 64, read_size);
+  ok &= run("medium pipelined", 20000, 4 * 1024, read_size);
+  ok &= run("large", 20, 10 * 1000 * 1000, read_size);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Measures what the rate limiter costs per packet when many threads send at
+// once: the old global network_throttle behind its mutex, against the token
+// buckets (a global one plus one per connection) the connections now use.
+// The limits are set high enough that nothing is ever delayed.
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "include_base_utils.h"
+#include "p2p/network_throttle-detail.hpp"
+
+using namespace epee::net_utils;
+
+namespace
+{
+  const size_t packet_size = 1024;
+  const uint64_t rate = 1000ull * 1000 * 1000 * 1000; // bytes per second
+
+  template<class t_packet>
+  double run(size_t thread_count, size_t packets_per_thread, t_packet packet)
+  {
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+      threads.push_back(std::thread([&, t]() {
+        while (!go)
+          std::this_thread::yield();
+        for (size_t i = 0; i < packets_per_thread; ++i)
+          packet(t);
+      }));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th: threads)
+      th.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / (thread_count * packets_per_thread);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  epee::debug::get_set_enable_assert(true, false);
+  epee::log_space::get_set_log_detalisation_level(true, LOG_LEVEL_0);
+  epee::log_space::log_singletone::add_logger(LOGGER_CONSOLE, NULL, NULL);
+
+  const size_t packets_per_thread = 20000;
+  const size_t max_threads = 32;
+
+  network_throttle throttle("out/bench", "bench-OUT", 10);
+  throttle.set_target_speed(rate / 1024);
+  std::mutex throttle_lock;
+
+  network_token_bucket global_bucket;
+  global_bucket.set_rate(rate);
+  std::vector<network_token_bucket> connection_buckets(max_threads);
+  for (auto& bucket: connection_buckets)
+    bucket.set_rate(rate);
+
+  std::cout << "ns per " << packet_size << " byte packet, " << packets_per_thread << " packets per thread" << std::endl;
+  std::cout << "threads\thistory window\ttoken bucket" << std::endl;
+  for (size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2)
+  {
+    // as get_send_delay() then count_send() did before
+    const double window_ns = run(thread_count, packets_per_thread, [&](size_t) {
+      std::lock_guard<std::mutex> lock(throttle_lock);
+      if (throttle.get_sleep_time_after_tick(packet_size) <= 0)
+        throttle.handle_trafic_exact(packet_size);
+    });
+
+    const double bucket_ns = run(thread_count, packets_per_thread, [&](size_t t) {
+      network_token_bucket& connection_bucket = connection_buckets[t];
+      if (std::max(global_bucket.get_delay(packet_size), connection_bucket.get_delay(packet_size)) <= 0)
+      {
+        global_bucket.consume(packet_size);
+        connection_bucket.consume(packet_size);
+      }
+    });
+
+    std::cout << thread_count << "\t" << (size_t)window_ns << "\t\t" << (size_t)bucket_ns << std::endl;
+  }
+  return 0;
+}
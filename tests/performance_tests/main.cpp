@@ -41,6 +41,7 @@
 #include "generate_key_image.h"
 #include "generate_key_image_helper.h"
 #include "is_out_to_acc.h"
+#include "next_difficulty.h"
 
 int main(int argc, char** argv)
 {
@@ -85,6 +86,9 @@ int main(int argc, char** argv)
 
   TEST_PERFORMANCE0(test_cn_slow_hash);
 
+  TEST_PERFORMANCE0(test_next_difficulty);
+  TEST_PERFORMANCE0(test_next_difficulty_window);
+
   std::cout << "Tests finished. Elapsed time: " << timer.elapsed_ms() / 1000 << " sec" << std::endl;
 
   return 0;
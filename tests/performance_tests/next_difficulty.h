@@ -0,0 +1,109 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <vector>
+
+#include "cryptonote_config.h"
+#include "cryptonote_core/difficulty.h"
+
+// Both tests advance the chain by one block per call and compute the
+// difficulty for the next one, the first the way it was done before the
+// difficulty window (copy the last DIFFICULTY_BLOCKS_COUNT blocks and sort),
+// the second with cryptonote::difficulty_window.
+
+class test_next_difficulty_base
+{
+public:
+  static const size_t loop_count = 100000;
+  static const size_t target_seconds = DIFFICULTY_TARGET_V2;
+
+  bool init()
+  {
+    m_timestamp = 1400000000;
+    m_cumulative_difficulty = 0;
+    m_seed = 0;
+    return true;
+  }
+
+protected:
+  void next_block(uint64_t& timestamp, cryptonote::difficulty_type& cumulative_difficulty)
+  {
+    // cheap pseudo random jitter so the timestamps are not already sorted
+    m_seed = m_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    m_timestamp += target_seconds;
+    timestamp = m_timestamp - (m_seed >> 33) % (2 * target_seconds);
+    m_cumulative_difficulty += 1000000 + (m_seed >> 40) % 1000;
+    cumulative_difficulty = m_cumulative_difficulty;
+  }
+
+private:
+  uint64_t m_timestamp;
+  cryptonote::difficulty_type m_cumulative_difficulty;
+  uint64_t m_seed;
+};
+
+class test_next_difficulty : public test_next_difficulty_base
+{
+public:
+  bool test()
+  {
+    uint64_t timestamp;
+    cryptonote::difficulty_type cumulative_difficulty;
+    next_block(timestamp, cumulative_difficulty);
+    m_timestamps.push_back(timestamp);
+    m_cumulative_difficulties.push_back(cumulative_difficulty);
+    if (m_timestamps.size() > DIFFICULTY_BLOCKS_COUNT)
+    {
+      m_timestamps.erase(m_timestamps.begin());
+      m_cumulative_difficulties.erase(m_cumulative_difficulties.begin());
+    }
+    return cryptonote::next_difficulty(m_timestamps, m_cumulative_difficulties, target_seconds) != 0;
+  }
+
+private:
+  std::vector<uint64_t> m_timestamps;
+  std::vector<cryptonote::difficulty_type> m_cumulative_difficulties;
+};
+
+class test_next_difficulty_window : public test_next_difficulty_base
+{
+public:
+  bool test()
+  {
+    uint64_t timestamp;
+    cryptonote::difficulty_type cumulative_difficulty;
+    next_block(timestamp, cumulative_difficulty);
+    m_window.push_back(timestamp, cumulative_difficulty);
+    return m_window.next_difficulty(target_seconds) != 0;
+  }
+
+private:
+  cryptonote::difficulty_window m_window;
+};
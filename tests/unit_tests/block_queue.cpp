@@ -0,0 +1,180 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <boost/uuid/uuid_generators.hpp>
+
+#include "cryptonote_protocol/block_queue.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  std::list<crypto::hash> make_hashes(size_t n)
+  {
+    std::list<crypto::hash> hashes;
+    for (size_t i = 0; i < n; ++i)
+    {
+      crypto::hash h;
+      memset(&h, 0, sizeof(h));
+      memcpy(&h, &i, sizeof(i));
+      hashes.push_back(h);
+    }
+    return hashes;
+  }
+
+  std::list<block_complete_entry> make_blocks(const std::list<crypto::hash> &hashes)
+  {
+    std::list<block_complete_entry> blocks;
+    for (const auto &h : hashes)
+    {
+      block_complete_entry e;
+      e.block = std::string((const char*)&h, sizeof(h));
+      blocks.push_back(e);
+    }
+    return blocks;
+  }
+
+  const boost::uuids::uuid peer_a = boost::uuids::random_generator()();
+  const boost::uuids::uuid peer_b = boost::uuids::random_generator()();
+  const size_t no_limit = std::numeric_limits<size_t>::max();
+}
+
+TEST(block_queue, peers_get_disjoint_spans)
+{
+  block_queue queue;
+  const std::list<crypto::hash> hashes = make_hashes(12);
+  uint64_t start;
+  std::list<crypto::hash> span_a, span_b, span_c;
+
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_a, start, span_a));
+  ASSERT_EQ(100, start);
+  ASSERT_EQ(5, span_a.size());
+  ASSERT_TRUE(span_a.front() == hashes.front());
+
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_b, start, span_b));
+  ASSERT_EQ(105, start);
+  ASSERT_EQ(5, span_b.size());
+  ASSERT_TRUE(span_b.front() == *std::next(hashes.begin(), 5));
+
+  // what is left is shorter than max_blocks
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_a, start, span_c));
+  ASSERT_EQ(110, start);
+  ASSERT_EQ(2, span_c.size());
+
+  span_c.clear();
+  ASSERT_FALSE(queue.reserve_span(100, hashes, 5, no_limit, peer_b, start, span_c));
+  ASSERT_EQ(3, queue.get_num_spans());
+}
+
+TEST(block_queue, spans_come_out_in_height_order)
+{
+  block_queue queue;
+  const std::list<crypto::hash> hashes = make_hashes(10);
+  uint64_t start;
+  std::list<crypto::hash> span_a, span_b;
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_a, start, span_a));
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_b, start, span_b));
+
+  // the later span arrives first, and waits for the one before it
+  std::list<block_complete_entry> blocks = make_blocks(span_b);
+  ASSERT_TRUE(queue.add_blocks(peer_b, blocks, 1000));
+  ASSERT_EQ(1000, queue.get_data_size());
+  block_queue::span s;
+  ASSERT_FALSE(queue.has_next_span(100));
+  ASSERT_FALSE(queue.get_next_span(100, s));
+
+  blocks = make_blocks(span_a);
+  ASSERT_TRUE(queue.add_blocks(peer_a, blocks, 500));
+  // not until the chain is high enough for it
+  ASSERT_FALSE(queue.get_next_span(99, s));
+  ASSERT_TRUE(queue.get_next_span(100, s));
+  ASSERT_EQ(100, s.start_height);
+  ASSERT_EQ(5, s.blocks.size());
+  ASSERT_TRUE(s.connection_id == peer_a);
+  ASSERT_FALSE(queue.get_next_span(100, s));
+  ASSERT_TRUE(queue.get_next_span(105, s));
+  ASSERT_EQ(105, s.start_height);
+  ASSERT_EQ(0, queue.get_data_size());
+  ASSERT_EQ(0, queue.get_num_spans());
+}
+
+TEST(block_queue, flushed_spans_are_given_out_again)
+{
+  block_queue queue;
+  const std::list<crypto::hash> hashes = make_hashes(10);
+  uint64_t start;
+  std::list<crypto::hash> span_a, span_b;
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_a, start, span_a));
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_b, start, span_b));
+  std::list<block_complete_entry> blocks = make_blocks(span_b);
+  ASSERT_TRUE(queue.add_blocks(peer_b, blocks, 1000));
+
+  // arrived spans stay, unless asked to go too
+  queue.flush_spans(peer_b);
+  ASSERT_EQ(2, queue.get_num_spans());
+  queue.flush_spans(peer_a);
+  ASSERT_EQ(1, queue.get_num_spans());
+  blocks = make_blocks(span_a);
+  ASSERT_FALSE(queue.add_blocks(peer_a, blocks, 500));
+
+  span_a.clear();
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_b, start, span_a));
+  ASSERT_EQ(100, start);
+
+  queue.flush_spans(peer_b, true);
+  ASSERT_EQ(0, queue.get_num_spans());
+  ASSERT_EQ(0, queue.get_data_size());
+
+  // and the ones taking too long
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, no_limit, peer_a, start, span_a));
+  ASSERT_EQ(0, queue.flush_stale_spans(60));
+  ASSERT_EQ(1, queue.flush_stale_spans(-1));
+  ASSERT_EQ(0, queue.get_num_spans());
+}
+
+TEST(block_queue, full_queue_only_gives_out_what_holds_it_up)
+{
+  block_queue queue;
+  const std::list<crypto::hash> hashes = make_hashes(20);
+  uint64_t start;
+  std::list<crypto::hash> span_a, span_b, span_c;
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, 1000, peer_a, start, span_a));
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, 1000, peer_b, start, span_b));
+  std::list<block_complete_entry> blocks = make_blocks(span_b);
+  ASSERT_TRUE(queue.add_blocks(peer_b, blocks, 1000));
+
+  // full: nothing past what is queued
+  ASSERT_FALSE(queue.reserve_span(100, hashes, 5, 1000, peer_b, start, span_c));
+
+  // but the front, if it is given up on
+  queue.flush_spans(peer_a);
+  ASSERT_TRUE(queue.reserve_span(100, hashes, 5, 1000, peer_b, start, span_c));
+  ASSERT_EQ(100, start);
+}
@@ -32,6 +32,7 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <type_traits>
 
 #include "gtest/gtest.h"
 
@@ -41,6 +42,8 @@
 #include "blockchain_db/berkeleydb/db_bdb.h"
 #endif
 #include "cryptonote_core/cryptonote_format_utils.h"
+#include "blockchain_utilities/snapshot_file.h"
+#include "file_io_utils.h"
 
 using namespace cryptonote;
 using epee::string_tools::pod_to_hex;
@@ -279,6 +282,9 @@ TYPED_TEST(BlockchainDBTest, AddBlock)
 
   block b;
   ASSERT_TRUE(this->m_db->block_exists(get_block_hash(this->m_blocks[0])));
+  uint64_t height = 0;
+  ASSERT_TRUE(this->m_db->block_exists(get_block_hash(this->m_blocks[1]), &height));
+  ASSERT_EQ(1, height);
   ASSERT_NO_THROW(b = this->m_db->get_block(get_block_hash(this->m_blocks[0])));
 
   ASSERT_TRUE(compare_blocks(this->m_blocks[0], b));
@@ -337,4 +343,228 @@ TYPED_TEST(BlockchainDBTest, RetrieveBlockData)
   ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1]), hashes[1]);
 }
 
+TYPED_TEST(BlockchainDBTest, PopBlocks)
+{
+  std::string fname(tmpnam(NULL));
+  this->set_prefix(fname);
+
+  // make sure open does not throw
+  ASSERT_NO_THROW(this->m_db->open(fname));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  std::vector<std::pair<block, std::vector<transaction>>> popped;
+  ASSERT_NO_THROW(this->m_db->pop_blocks(2, popped));
+  ASSERT_EQ(0, this->m_db->height());
+
+  // popped top first, each with its non-miner transactions
+  ASSERT_EQ(2, popped.size());
+  ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1]), get_block_hash(popped[0].first));
+  ASSERT_HASH_EQ(get_block_hash(this->m_blocks[0]), get_block_hash(popped[1].first));
+  ASSERT_EQ(this->m_txs[1].size(), popped[0].second.size());
+  ASSERT_EQ(this->m_txs[0].size(), popped[1].second.size());
+
+  for (size_t i = 0; i < 2; ++i)
+  {
+    ASSERT_FALSE(this->m_db->block_exists(get_block_hash(this->m_blocks[i])));
+    ASSERT_FALSE(this->m_db->tx_exists(get_transaction_hash(this->m_blocks[i].miner_tx)));
+    for (const auto& out : this->m_blocks[i].miner_tx.vout)
+      ASSERT_EQ(0, this->m_db->get_num_outputs(out.amount));
+    for (const auto& tx : this->m_txs[i])
+    {
+      ASSERT_FALSE(this->m_db->tx_exists(get_transaction_hash(tx)));
+      for (const auto& in : tx.vin)
+      {
+        if (in.type() == typeid(txin_to_key))
+        {
+          ASSERT_FALSE(this->m_db->has_key_image(boost::get<txin_to_key>(in).k_image));
+        }
+      }
+    }
+  }
+
+  // nothing the blocks added is left behind, so they can be added again
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+  ASSERT_EQ(2, this->m_db->height());
+}
+
+TYPED_TEST(BlockchainDBTest, HasKeyImages)
+{
+  std::string fname(tmpnam(NULL));
+  this->set_prefix(fname);
+
+  // make sure open does not throw
+  ASSERT_NO_THROW(this->m_db->open(fname));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  // spent ones, unknown ones below and above all of them, and repeats
+  std::vector<crypto::key_image> key_images;
+  for (size_t i = 0; i < 2; ++i)
+    for (const auto& tx : this->m_txs[i])
+      for (const auto& in : tx.vin)
+        if (in.type() == typeid(txin_to_key))
+          key_images.push_back(boost::get<txin_to_key>(in).k_image);
+  ASSERT_FALSE(key_images.empty());
+  crypto::key_image low, high;
+  memset(&low, 0, sizeof(low));
+  memset(&high, 0xff, sizeof(high));
+  key_images.push_back(high);
+  key_images.push_back(low);
+  key_images.push_back(key_images[0]);
+  key_images.push_back(high);
+
+  std::vector<bool> spent;
+  ASSERT_NO_THROW(this->m_db->has_key_images(key_images, spent));
+  ASSERT_EQ(key_images.size(), spent.size());
+  for (size_t i = 0; i < key_images.size(); ++i)
+    ASSERT_EQ(this->m_db->has_key_image(key_images[i]), spent[i]);
+  ASSERT_TRUE(spent[0]);
+  ASSERT_FALSE(spent[spent.size() - 1]);
+}
+
+TYPED_TEST(BlockchainDBTest, CopyRecords)
+{
+  // only LMDB has raw record access, the other backends throw
+  if (!std::is_same<TypeParam, BlockchainLMDB>::value)
+    return;
+
+  std::string fname(tmpnam(NULL));
+  this->set_prefix(fname);
+
+  // make sure open does not throw
+  ASSERT_NO_THROW(this->m_db->open(fname));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  std::string copy_fname(tmpnam(NULL));
+  TypeParam copy;
+  ASSERT_NO_THROW(copy.open(copy_fname));
+
+  // feed the records to the copy table by table, as a snapshot load does
+  std::string table;
+  std::vector<std::pair<std::string, std::string>> records;
+  ASSERT_TRUE(this->m_db->for_all_records([&](const std::string& t, const std::string& k, const std::string& v) {
+    if (t != table && !records.empty())
+    {
+      copy.append_records(table, records);
+      records.clear();
+    }
+    table = t;
+    records.push_back(std::make_pair(k, v));
+    return true;
+  }));
+  ASSERT_NO_THROW(copy.append_records(table, records));
+
+  ASSERT_EQ(2, copy.height());
+  ASSERT_HASH_EQ(this->m_db->top_block_hash(), copy.top_block_hash());
+  for (size_t i = 0; i < 2; ++i)
+  {
+    ASSERT_HASH_EQ(get_block_hash(this->m_blocks[i]), copy.get_block_hash_from_height(i));
+    for (const auto& out : this->m_blocks[i].miner_tx.vout)
+      ASSERT_EQ(this->m_db->get_num_outputs(out.amount), copy.get_num_outputs(out.amount));
+    for (const auto& tx : this->m_txs[i])
+    {
+      ASSERT_TRUE(copy.tx_exists(get_transaction_hash(tx)));
+      for (const auto& in : tx.vin)
+      {
+        if (in.type() == typeid(txin_to_key))
+        {
+          ASSERT_TRUE(copy.has_key_image(boost::get<txin_to_key>(in).k_image));
+        }
+      }
+    }
+  }
+
+  copy.close();
+  boost::filesystem::remove_all(copy_fname);
+}
+
+// redoes the checksum of the single chunk of a small snapshot, after its
+// payload was changed
+void rechecksum_snapshot(std::string& snapshot)
+{
+  const size_t header_size = 12;
+  const size_t payload_size = snapshot.size() - header_size - 4 - sizeof(crypto::hash);
+  crypto::hash data[2] = {crypto::cn_fast_hash(snapshot.data(), header_size), crypto::cn_fast_hash(snapshot.data() + header_size + 4, payload_size)};
+  const crypto::hash checksum = crypto::cn_fast_hash(data, sizeof(data));
+  snapshot.replace(snapshot.size() - sizeof(checksum), sizeof(checksum), checksum.data, sizeof(checksum));
+}
+
+TYPED_TEST(BlockchainDBTest, SnapshotFile)
+{
+  // only LMDB has raw record access, the other backends throw
+  if (!std::is_same<TypeParam, BlockchainLMDB>::value)
+    return;
+
+  std::string fname(tmpnam(NULL));
+  this->set_prefix(fname);
+
+  ASSERT_NO_THROW(this->m_db->open(fname));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[0], t_sizes[0], t_diffs[0], t_coins[0], this->m_txs[0]));
+  ASSERT_NO_THROW(this->m_db->add_block(this->m_blocks[1], t_sizes[1], t_diffs[1], t_coins[1], this->m_txs[1]));
+
+  const std::string snapshot_fname(tmpnam(NULL));
+  ASSERT_TRUE(SnapshotFile().store_snapshot(this->m_db, snapshot_fname));
+  std::string snapshot;
+  ASSERT_TRUE(epee::file_io_utils::load_file_to_string(snapshot_fname, snapshot));
+
+  auto load = [&](const std::string& contents, const checkpoints& points) {
+    epee::file_io_utils::save_string_to_file(snapshot_fname, contents);
+    std::string copy_fname(tmpnam(NULL));
+    TypeParam copy;
+    copy.open(copy_fname);
+    const bool loaded = SnapshotFile().load_snapshot(&copy, snapshot_fname, points);
+    copy.close();
+    boost::filesystem::remove_all(copy_fname);
+    return loaded;
+  };
+
+  checkpoints points;
+  ASSERT_TRUE(points.add_checkpoint(0, pod_to_hex(get_block_hash(this->m_blocks[0]))));
+  ASSERT_TRUE(load(snapshot, points));
+
+  // a block which is not the checkpointed one
+  checkpoints wrong_points;
+  ASSERT_TRUE(wrong_points.add_checkpoint(1, pod_to_hex(get_block_hash(this->m_blocks[0]))));
+  ASSERT_FALSE(load(snapshot, wrong_points));
+
+  // any change breaks the checksum chain
+  std::string changed = snapshot;
+  changed[changed.size() / 2] ^= 1;
+  ASSERT_FALSE(load(changed, points));
+
+  ASSERT_FALSE(load(snapshot.substr(0, snapshot.size() - 1), points));
+  ASSERT_FALSE(load(snapshot.substr(0, snapshot.size() / 2), points));
+
+  // a block record changed, checksums and all, no longer is the one the
+  // block above it names
+  block b = this->m_blocks[0];
+  const std::string blob = block_to_blob(b);
+  ++b.nonce;
+  const std::string corrupt_blob = block_to_blob(b);
+  ASSERT_EQ(blob.size(), corrupt_blob.size());
+  const size_t pos = snapshot.find(blob);
+  ASSERT_NE(std::string::npos, pos);
+  std::string corrupt = snapshot;
+  corrupt.replace(pos, blob.size(), corrupt_blob);
+  rechecksum_snapshot(corrupt);
+  ASSERT_FALSE(load(corrupt, checkpoints()));
+
+  boost::filesystem::remove(snapshot_fname);
+}
+
 }  // anonymous namespace
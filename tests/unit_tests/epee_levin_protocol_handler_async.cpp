@@ -31,6 +31,8 @@
 #include <mutex>
 #include <thread>
 
+#include <boost/make_shared.hpp>
+
 #include "gtest/gtest.h"
 
 #include "include_base_utils.h"
@@ -131,6 +133,7 @@ namespace
       : m_io_service(io_service)
       , m_protocol_handler(this, protocol_config, m_context)
       , m_send_return(true)
+      , m_last_send_priority(epee::net_utils::e_send_priority_bulk)
     {
     }
 
@@ -149,6 +152,12 @@ namespace
       return m_send_return;
     }
 
+    virtual bool do_send_shared(const void* head_ptr, size_t head_cb, const epee::net_utils::shared_buffer& data, epee::net_utils::t_send_priority priority)
+    {
+      m_last_send_priority = priority;
+      return epee::net_utils::i_service_endpoint::do_send_shared(head_ptr, head_cb, data, priority);
+    }
+
     virtual bool close()                              { /*std::cout << "test_connection::close()" << std::endl; */return true; }
     virtual bool call_run_once_service_io()           { std::cout << "test_connection::call_run_once_service_io()" << std::endl; return true; }
     virtual bool request_callback()                   { std::cout << "test_connection::request_callback()" << std::endl; return true; }
@@ -164,6 +173,8 @@ namespace
     bool send_return() const { return m_send_return; }
     void send_return(bool v) { m_send_return = v; }
 
+    epee::net_utils::t_send_priority last_send_priority() const { return m_last_send_priority; }
+
   public:
     test_levin_protocol_handler m_protocol_handler;
 
@@ -177,6 +188,7 @@ namespace
     std::string m_last_send_data;
 
     bool m_send_return;
+    epee::net_utils::t_send_priority m_last_send_priority;
   };
 
   class async_protocol_handler_test : public ::testing::Test
@@ -410,6 +422,53 @@ TEST_F(positive_test_connection_to_levin_protocol_handler_calls, handler_process
   ASSERT_TRUE(conn->last_send_data().empty());
 }
 
+TEST_F(positive_test_connection_to_levin_protocol_handler_calls, handler_notifies_shared_buffer)
+{
+  // Setup
+  const int expected_command = 2634981;
+
+  test_connection_ptr conn = create_connection();
+  conn->reset_last_send_data();
+
+  epee::net_utils::shared_buffer in_data = boost::make_shared<std::string>(256, 's');
+
+  // Test, locked as async_protocol_handler_config::notify() does
+  ASSERT_TRUE(conn->m_protocol_handler.start_outer_call());
+  ASSERT_EQ(1, conn->m_protocol_handler.notify(expected_command, in_data));
+
+  // Check the header went first, then the data, unchanged
+  const std::string& sent = conn->last_send_data();
+  ASSERT_EQ(sizeof(epee::levin::bucket_head2) + in_data->size(), sent.size());
+  epee::levin::bucket_head2 head;
+  memcpy(&head, sent.data(), sizeof(head));
+  ASSERT_EQ(LEVIN_SIGNATURE, head.m_signature);
+  ASSERT_EQ(in_data->size(), head.m_cb);
+  ASSERT_FALSE(head.m_have_to_return_data);
+  ASSERT_EQ(expected_command, head.m_command);
+  ASSERT_EQ(LEVIN_PACKET_REQUEST, head.m_flags);
+  ASSERT_EQ(*in_data, sent.substr(sizeof(head)));
+}
+
+TEST_F(positive_test_connection_to_levin_protocol_handler_calls, handler_sends_in_command_priority)
+{
+  // Setup
+  const int priority_command = 2634982;
+  const int other_command = 2634983;
+  m_handler_config.set_command_priority(priority_command, epee::net_utils::e_send_priority_block);
+
+  test_connection_ptr conn = create_connection();
+  std::string in_data(256, 'p');
+
+  // Test
+  ASSERT_TRUE(conn->m_protocol_handler.start_outer_call());
+  ASSERT_EQ(1, conn->m_protocol_handler.notify(priority_command, in_data));
+  ASSERT_EQ(epee::net_utils::e_send_priority_block, conn->last_send_priority());
+
+  ASSERT_TRUE(conn->m_protocol_handler.start_outer_call());
+  ASSERT_EQ(1, conn->m_protocol_handler.notify(other_command, in_data));
+  ASSERT_EQ(epee::net_utils::e_send_priority_handshake, conn->last_send_priority());
+}
+
 TEST_F(positive_test_connection_to_levin_protocol_handler_calls, handler_processes_qued_callback)
 {
   test_connection_ptr conn = create_connection();
@@ -514,6 +573,24 @@ TEST_F(test_levin_protocol_handler__hanle_recv_with_invalid_data, handles_chunke
   ASSERT_EQ(1, m_commands_handler.invoke_counter());
 }
 
+TEST_F(test_levin_protocol_handler__hanle_recv_with_invalid_data, handles_body_past_initial_reserve_in_pieces)
+{
+  m_in_data.clear();
+  for (size_t i = 0; i < 3 * LEVIN_INITIAL_BODY_RESERVE; ++i)
+    m_in_data.push_back(static_cast<char>(i * 7));
+  m_req_head.m_cb = m_in_data.size();
+  prepare_buf();
+
+  const size_t piece_size = 64 * 1024 + 3;
+  for (size_t offset = 0; offset < m_buf.size(); offset += piece_size)
+  {
+    ASSERT_EQ(0, m_commands_handler.invoke_counter());
+    ASSERT_TRUE(m_conn->m_protocol_handler.handle_recv(m_buf.data() + offset, std::min(piece_size, m_buf.size() - offset)));
+  }
+  ASSERT_EQ(1, m_commands_handler.invoke_counter());
+  ASSERT_EQ(m_in_data, m_commands_handler.last_in_buf());
+}
+
 TEST_F(test_levin_protocol_handler__hanle_recv_with_invalid_data, handles_two_requests_at_once)
 {
   prepare_buf();
@@ -0,0 +1,98 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "p2p/network_throttle-detail.hpp"
+
+using epee::net_utils::network_token_bucket;
+
+namespace
+{
+  TEST(network_token_bucket, no_limit_never_delays)
+  {
+    network_token_bucket bucket;
+    ASSERT_EQ(0, bucket.get_rate());
+    bucket.consume(100 * 1000 * 1000);
+    ASSERT_EQ(0, bucket.get_delay(1000));
+  }
+
+  TEST(network_token_bucket, starts_full)
+  {
+    network_token_bucket bucket;
+    bucket.set_rate(1000);
+    ASSERT_EQ(1000, bucket.get_rate());
+    ASSERT_EQ(0, bucket.get_delay(500));
+    bucket.consume(500);
+    ASSERT_EQ(0, bucket.get_delay(400));
+  }
+
+  TEST(network_token_bucket, debt_is_paid_back_at_rate)
+  {
+    network_token_bucket bucket;
+    bucket.set_rate(1000);
+    // a packet bigger than the bucket still goes, then the next one waits
+    bucket.consume(3000);
+    ASSERT_NEAR(2.0, bucket.get_delay(100), 0.01);
+  }
+
+  TEST(network_token_bucket, setting_rate_refills)
+  {
+    network_token_bucket bucket;
+    bucket.set_rate(1000);
+    bucket.consume(5000);
+    ASSERT_GT(bucket.get_delay(1), 0);
+    bucket.set_rate(2000);
+    ASSERT_EQ(0, bucket.get_delay(1));
+    bucket.set_rate(0);
+    bucket.consume(5000);
+    ASSERT_EQ(0, bucket.get_delay(1));
+  }
+
+  TEST(network_token_bucket, counts_every_thread)
+  {
+    network_token_bucket bucket;
+    bucket.set_rate(1000);
+    const size_t thread_count = 8;
+    const size_t packets = 1000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t)
+      threads.push_back(std::thread([&]() {
+        for (size_t i = 0; i < packets; ++i)
+          bucket.consume(10);
+      }));
+    for (auto& th: threads)
+      th.join();
+    // 80000 bytes taken from 1000, with at most a few ms of refill since
+    ASSERT_NEAR(79.0, bucket.get_delay(1), 0.1);
+  }
+}
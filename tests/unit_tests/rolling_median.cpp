@@ -0,0 +1,127 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <random>
+
+#include "misc_language.h"
+#include "common/rolling_median.h"
+
+namespace
+{
+  uint64_t reference_median(const std::deque<uint64_t>& values)
+  {
+    std::vector<uint64_t> v(values.begin(), values.end());
+    return epee::misc_utils::median(v);
+  }
+
+  TEST(rolling_median, empty)
+  {
+    tools::rolling_median_t<uint64_t> m(5);
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(0, m.median());
+  }
+
+  TEST(rolling_median, odd_and_even)
+  {
+    tools::rolling_median_t<uint64_t> m(5);
+    m.push_back(7);
+    ASSERT_EQ(7, m.median());
+    m.push_back(3);
+    ASSERT_EQ(5, m.median());
+    m.push_back(9);
+    ASSERT_EQ(7, m.median());
+    m.push_back(1);
+    ASSERT_EQ(5, m.median());
+  }
+
+  TEST(rolling_median, evicts_oldest)
+  {
+    tools::rolling_median_t<uint64_t> m(3);
+    m.push_back(100);
+    m.push_back(1);
+    m.push_back(2);
+    ASSERT_TRUE(m.full());
+    ASSERT_EQ(2, m.median());
+    m.push_back(3);
+    ASSERT_EQ(3, m.size());
+    ASSERT_EQ(2, m.median());
+  }
+
+  TEST(rolling_median, slides_back)
+  {
+    tools::rolling_median_t<uint64_t> m(3);
+    for (uint64_t v : {10, 20, 30, 40})
+      m.push_back(v);
+    ASSERT_EQ(30, m.median());
+    m.pop_back();
+    m.push_front(10);
+    ASSERT_EQ(20, m.median());
+    // full, so this is ignored
+    m.push_front(1000);
+    ASSERT_EQ(20, m.median());
+  }
+
+  TEST(rolling_median, matches_full_sort)
+  {
+    std::mt19937 rng(0);
+    std::deque<uint64_t> values;
+    tools::rolling_median_t<uint64_t> m(60);
+    for (int i = 0; i < 10000; ++i)
+    {
+      uint64_t v = rng() % 1000;
+      switch (rng() % 4)
+      {
+        case 0:
+          if (!values.empty())
+          {
+            values.pop_back();
+            m.pop_back();
+          }
+          break;
+        case 1:
+          if (values.size() < 60)
+          {
+            values.push_front(v);
+            m.push_front(v);
+          }
+          break;
+        default:
+          if (values.size() == 60)
+            values.pop_front();
+          values.push_back(v);
+          m.push_back(v);
+          break;
+      }
+      ASSERT_EQ(values.size(), m.size());
+      ASSERT_EQ(reference_median(values), m.median());
+    }
+  }
+}
@@ -30,6 +30,7 @@
 
 #include "gtest/gtest.h"
 
+#include <sstream>
 #include "common/util.h"
 #include "p2p/net_peerlist.h"
 #include "net/net_utils_base.h"
@@ -82,3 +83,83 @@ TEST(peer_list, merge_peer_lists)
 
 
 }
+
+TEST(peer_list, peer_scores)
+{
+  nodetool::peerlist_manager plm;
+  plm.init(false);
+  ADD_WHITE_NODE(MAKE_IP(123,43,12,1), 8080, 121241, 34345);
+  ADD_GRAY_NODE(MAKE_IP(123,43,12,2), 8080, 121242, 34345);
+
+  nodetool::net_address white, gray;
+  white.ip = MAKE_IP(123,43,12,1); white.port = 8080;
+  gray.ip = MAKE_IP(123,43,12,2); gray.port = 8080;
+
+  nodetool::peer_score measured, score;
+  measured.rate = 1000;
+  measured.latency = 1;
+  measured.height_behind = 5;
+  ASSERT_FALSE(plm.update_peer_score(gray, measured));
+  ASSERT_FALSE(plm.get_peer_score(gray, score));
+  ASSERT_FALSE(plm.get_peer_score(white, score));
+
+  ASSERT_TRUE(plm.update_peer_score(white, measured));
+  measured.rate = 3000;
+  measured.latency = 0; // not measured, the previous one stays
+  measured.height_behind = 0;
+  ASSERT_TRUE(plm.update_peer_score(white, measured));
+  ASSERT_TRUE(plm.add_peer_invalid(white));
+  ASSERT_TRUE(plm.get_peer_score(white, score));
+  ASSERT_EQ(2000, score.rate);
+  ASSERT_EQ(1, score.latency);
+  ASSERT_EQ(0, score.height_behind);
+  ASSERT_EQ(1, score.invalid_count);
+
+  // stored along with the peerlist
+  std::stringstream ss;
+  {
+    boost::archive::binary_oarchive a(ss);
+    a << plm;
+  }
+  nodetool::peerlist_manager loaded;
+  loaded.init(false);
+  {
+    boost::archive::binary_iarchive a(ss);
+    a >> loaded;
+  }
+  nodetool::peer_score score_loaded;
+  ASSERT_TRUE(loaded.get_peer_score(white, score_loaded));
+  ASSERT_EQ(score.rate, score_loaded.rate);
+  ASSERT_EQ(score.invalid_count, score_loaded.invalid_count);
+}
+
+TEST(peer_list, peer_score_value)
+{
+  nodetool::peer_score unknown, fast, slow, behind, invalid;
+  fast.rate = 10 * P2P_PEER_SCORE_DEFAULT_RATE;
+  slow.rate = P2P_PEER_SCORE_DEFAULT_RATE / 10;
+  behind.height_behind = P2P_PEER_SCORE_HEIGHT_SCALE;
+  invalid.invalid_count = 1;
+
+  ASSERT_GT(nodetool::get_peer_score_value(fast), nodetool::get_peer_score_value(unknown));
+  ASSERT_LT(nodetool::get_peer_score_value(slow), nodetool::get_peer_score_value(unknown));
+  ASSERT_DOUBLE_EQ(nodetool::get_peer_score_value(unknown) / 2, nodetool::get_peer_score_value(behind));
+  ASSERT_LT(nodetool::get_peer_score_value(invalid), nodetool::get_peer_score_value(behind));
+}
+
+TEST(peer_list, peer_invalid_count_decays)
+{
+  nodetool::peer_score score;
+  score.invalid_count = 8;
+  score.last_invalid = 1000;
+
+  nodetool::decay_peer_invalid_count(score, 1000 + P2P_PEER_SCORE_INVALID_HALF_LIFE - 1);
+  ASSERT_EQ(8u, score.invalid_count);
+  nodetool::decay_peer_invalid_count(score, 1000 + 2 * P2P_PEER_SCORE_INVALID_HALF_LIFE);
+  ASSERT_EQ(2u, score.invalid_count);
+  // what is left of a half life still counts towards the next one
+  nodetool::decay_peer_invalid_count(score, 1000 + 3 * P2P_PEER_SCORE_INVALID_HALF_LIFE);
+  ASSERT_EQ(1u, score.invalid_count);
+  nodetool::decay_peer_invalid_count(score, 1000 + 100 * P2P_PEER_SCORE_INVALID_HALF_LIFE);
+  ASSERT_EQ(0u, score.invalid_count);
+}
@@ -0,0 +1,291 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+#include <boost/uuid/random_generator.hpp>
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_protocol/cryptonote_protocol_handler.h"
+
+namespace
+{
+  class test_core
+  {
+  public:
+    void on_synchronized(){}
+    uint64_t get_current_blockchain_height() const {return 1;}
+    void set_target_blockchain_height(uint64_t) {}
+    bool init(const boost::program_options::variables_map& vm) {return true ;}
+    bool deinit(){return true;}
+    bool get_short_chain_history(std::list<crypto::hash>& ids) const { return true; }
+    bool get_stat_info(cryptonote::core_stat_info& st_inf) const {return true;}
+    bool have_block(const crypto::hash& id) const {return true;}
+    bool get_blockchain_top(uint64_t& height, crypto::hash& top_id)const{height=0;top_id=cryptonote::null_hash;return true;}
+    bool handle_incoming_tx(const cryptonote::blobdata& tx_blob, cryptonote::tx_verification_context& tvc, bool keeped_by_block, bool relaued) { return true; }
+    bool handle_incoming_txs(const std::list<cryptonote::blobdata>& tx_blobs, std::vector<cryptonote::tx_verification_context>& tvc, bool keeped_by_block, bool relaued) { tvc.resize(tx_blobs.size()); return true; }
+    bool handle_incoming_block(const cryptonote::blobdata& block_blob, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true) { return true; }
+    void pause_mine(){}
+    void resume_mine(){}
+    bool on_idle(){return true;}
+    bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, cryptonote::NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp){return true;}
+    bool handle_get_objects(cryptonote::NOTIFY_REQUEST_GET_OBJECTS::request& arg, cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request& rsp, cryptonote::cryptonote_connection_context& context){return true;}
+    bool get_test_drop_download() const {return true;}
+    bool get_test_drop_download_height() const {return true;}
+    bool prepare_handle_incoming_blocks(const std::list<cryptonote::block_complete_entry>  &blocks) { return true; }
+    bool cleanup_handle_incoming_blocks(bool force_sync = false) { return true; }
+    uint64_t get_target_blockchain_height() const { return 1; }
+    bool get_block_by_hash(const crypto::hash &h, cryptonote::block &blk) const { return false; }
+    bool get_transactions(const std::vector<crypto::hash>& txs_ids, std::list<cryptonote::transaction>& txs, std::list<crypto::hash>& missed_txs) const { return false; }
+    bool get_pool_transaction(const crypto::hash& id, cryptonote::transaction& tx) const { return false; }
+    bool have_tx(const crypto::hash& id) const { return false; }
+  };
+
+  // keeps the connections in a list, and the txs each was asked for or
+  // had announced to it
+  class test_p2p: public nodetool::p2p_endpoint_stub<cryptonote::cryptonote_connection_context>
+  {
+  public:
+    virtual bool invoke_notify_to_peer(int command, const std::string& req_buff, const epee::net_utils::connection_context_base& context)
+    {
+      if(command == cryptonote::NOTIFY_REQUEST_TXS::ID)
+        return record<cryptonote::NOTIFY_REQUEST_TXS>(req_buff, m_requested[context.m_connection_id]);
+      if(command == cryptonote::NOTIFY_TX_INVENTORY::ID)
+        return record<cryptonote::NOTIFY_TX_INVENTORY>(req_buff, m_announced[context.m_connection_id]);
+      return true;
+    }
+    virtual void for_each_connection(std::function<bool(cryptonote::cryptonote_connection_context&, nodetool::peerid_type)> f)
+    {
+      for(auto& context: m_connections)
+        if(!f(context, 1))
+          break;
+    }
+
+    cryptonote::cryptonote_connection_context& add_connection()
+    {
+      cryptonote::cryptonote_connection_context context = AUTO_VAL_INIT(context);
+      static_cast<epee::net_utils::connection_context_base&>(context) =
+        epee::net_utils::connection_context_base(boost::uuids::random_generator()(), 0, 0, false);
+      context.m_state = cryptonote::cryptonote_connection_context::state_normal;
+      context.m_support_flags = P2P_SUPPORT_FLAG_TX_INVENTORY;
+      m_connections.push_back(context);
+      return m_connections.back();
+    }
+
+    std::list<cryptonote::cryptonote_connection_context> m_connections;
+    std::map<boost::uuids::uuid, std::vector<crypto::hash>> m_requested;
+    std::map<boost::uuids::uuid, std::vector<crypto::hash>> m_announced;
+
+  private:
+    template<class t_command>
+    static bool record(const std::string& req_buff, std::vector<crypto::hash>& tx_hashes)
+    {
+      typename t_command::request r;
+      if(!epee::serialization::load_t_from_binary(r, req_buff))
+        return false;
+      tx_hashes.insert(tx_hashes.end(), r.tx_hashes.begin(), r.tx_hashes.end());
+      return true;
+    }
+  };
+
+  template<class t_command>
+  void notify(cryptonote::t_cryptonote_protocol_handler<test_core>& protocol, cryptonote::cryptonote_connection_context& context, const typename t_command::request& r)
+  {
+    std::string blob, out;
+    epee::serialization::store_t_to_binary(r, blob);
+    bool handled = false;
+    protocol.handle_invoke_map(true, t_command::ID, blob, out, context, handled);
+    ASSERT_TRUE(handled);
+  }
+
+  void announce(cryptonote::t_cryptonote_protocol_handler<test_core>& protocol, cryptonote::cryptonote_connection_context& context, const std::vector<crypto::hash>& tx_hashes)
+  {
+    cryptonote::NOTIFY_TX_INVENTORY::request r;
+    r.tx_hashes = tx_hashes;
+    notify<cryptonote::NOTIFY_TX_INVENTORY>(protocol, context, r);
+  }
+
+  void announce(cryptonote::t_cryptonote_protocol_handler<test_core>& protocol, cryptonote::cryptonote_connection_context& context, const crypto::hash& tx_hash)
+  {
+    announce(protocol, context, std::vector<crypto::hash>(1, tx_hash));
+  }
+
+  // txs and their hashes, distinct for each i
+  void make_txs(size_t first, size_t count, std::list<cryptonote::blobdata>& txs, std::vector<crypto::hash>& tx_hashes)
+  {
+    for(size_t i = first; i < first + count; ++i)
+    {
+      txs.push_back(std::to_string(i));
+      tx_hashes.push_back(cryptonote::get_blob_hash(txs.back()));
+    }
+  }
+}
+
+TEST(tx_inventory, timed_out_request_goes_to_next_announcer)
+{
+  test_core core;
+  test_p2p p2p;
+  cryptonote::t_cryptonote_protocol_handler<test_core> protocol(core, NULL);
+  protocol.set_p2p_endpoint(&p2p);
+
+  cryptonote::cryptonote_connection_context& a = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& b = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& c = p2p.add_connection();
+  const crypto::hash tx_hash = crypto::cn_fast_hash("tx", 2);
+  const std::vector<crypto::hash> expected(1, tx_hash);
+
+  // only the first to announce it is asked
+  const time_t now = time(NULL);
+  announce(protocol, a, tx_hash);
+  announce(protocol, b, tx_hash);
+  announce(protocol, c, tx_hash);
+  ASSERT_EQ(1u, p2p.m_requested.size());
+  ASSERT_EQ(expected, p2p.m_requested[a.m_connection_id]);
+  p2p.m_requested.clear();
+
+  protocol.request_timed_out_txs(now);
+  ASSERT_TRUE(p2p.m_requested.empty());
+
+  // a does not send it in time, so b is asked
+  time_t t = now + P2P_TX_REQUEST_TIMEOUT + 5;
+  protocol.request_timed_out_txs(t);
+  ASSERT_EQ(1u, p2p.m_requested.size());
+  ASSERT_EQ(expected, p2p.m_requested[b.m_connection_id]);
+  p2p.m_requested.clear();
+
+  // c is asked next, unless it is gone by then
+  const boost::uuids::uuid c_id = c.m_connection_id;
+  p2p.m_connections.pop_back();
+  t += P2P_TX_REQUEST_TIMEOUT;
+  protocol.request_timed_out_txs(t);
+  ASSERT_TRUE(p2p.m_requested.empty());
+
+  // nobody is left to ask, until it is announced again
+  announce(protocol, a, tx_hash);
+  ASSERT_EQ(1u, p2p.m_requested.size());
+  ASSERT_EQ(expected, p2p.m_requested[a.m_connection_id]);
+  ASSERT_EQ(0u, p2p.m_requested.count(c_id));
+}
+
+TEST(tx_inventory, next_announcer_is_asked_while_connected)
+{
+  test_core core;
+  test_p2p p2p;
+  cryptonote::t_cryptonote_protocol_handler<test_core> protocol(core, NULL);
+  protocol.set_p2p_endpoint(&p2p);
+
+  cryptonote::cryptonote_connection_context& a = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& b = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& c = p2p.add_connection();
+  const crypto::hash tx_hash = crypto::cn_fast_hash("tx", 2);
+  const std::vector<crypto::hash> expected(1, tx_hash);
+
+  const time_t now = time(NULL);
+  announce(protocol, a, tx_hash);
+  announce(protocol, b, tx_hash);
+  announce(protocol, c, tx_hash);
+  p2p.m_requested.clear();
+
+  // b closed before a timed out, c is asked in its place
+  p2p.m_connections.erase(std::next(p2p.m_connections.begin()));
+  protocol.request_timed_out_txs(now + P2P_TX_REQUEST_TIMEOUT + 5);
+  ASSERT_EQ(1u, p2p.m_requested.size());
+  ASSERT_EQ(expected, p2p.m_requested[c.m_connection_id]);
+}
+
+TEST(tx_inventory, announcer_past_its_cap_is_ignored)
+{
+  test_core core;
+  test_p2p p2p;
+  cryptonote::t_cryptonote_protocol_handler<test_core> protocol(core, NULL);
+  protocol.set_p2p_endpoint(&p2p);
+
+  cryptonote::cryptonote_connection_context& a = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& b = p2p.add_connection();
+  std::list<cryptonote::blobdata> txs;
+  std::vector<crypto::hash> tx_hashes;
+  make_txs(0, P2P_TX_REQUEST_MAX_PER_PEER + 1, txs, tx_hashes);
+
+  for(size_t i = 0; i < P2P_TX_REQUEST_MAX_PER_PEER; i += P2P_TX_INVENTORY_MAX_HASHES)
+    announce(protocol, a, std::vector<crypto::hash>(tx_hashes.begin() + i, tx_hashes.begin() + i + P2P_TX_INVENTORY_MAX_HASHES));
+  ASSERT_EQ((size_t)P2P_TX_REQUEST_MAX_PER_PEER, p2p.m_requested[a.m_connection_id].size());
+  p2p.m_requested.clear();
+
+  // a has too many still to send, b does not
+  announce(protocol, a, tx_hashes.back());
+  ASSERT_TRUE(p2p.m_requested.empty());
+  announce(protocol, b, tx_hashes.back());
+  ASSERT_EQ(std::vector<crypto::hash>(1, tx_hashes.back()), p2p.m_requested[b.m_connection_id]);
+  p2p.m_requested.clear();
+
+  // once one comes in, a is listened to again
+  cryptonote::NOTIFY_NEW_TRANSACTIONS::request r;
+  r.txs.push_back(txs.front());
+  notify<cryptonote::NOTIFY_NEW_TRANSACTIONS>(protocol, a, r);
+  const crypto::hash other = crypto::cn_fast_hash("tx", 2);
+  announce(protocol, a, other);
+  ASSERT_EQ(std::vector<crypto::hash>(1, other), p2p.m_requested[a.m_connection_id]);
+}
+
+TEST(tx_inventory, oldest_known_txs_are_forgotten_first)
+{
+  test_core core;
+  test_p2p p2p;
+  cryptonote::t_cryptonote_protocol_handler<test_core> protocol(core, NULL);
+  protocol.set_p2p_endpoint(&p2p);
+  cryptonote::i_cryptonote_protocol& relay = protocol;
+
+  cryptonote::cryptonote_connection_context& a = p2p.add_connection();
+  cryptonote::cryptonote_connection_context& b = p2p.add_connection();
+  std::list<cryptonote::blobdata> txs;
+  std::vector<crypto::hash> tx_hashes;
+  make_txs(0, P2P_TX_INVENTORY_MAX_KNOWN + 1, txs, tx_hashes);
+
+  // b is told of all but the last, then of the last, which pushes out the first
+  cryptonote::NOTIFY_NEW_TRANSACTIONS::request r;
+  r.txs.assign(txs.begin(), std::prev(txs.end()));
+  relay.relay_transactions(r, a);
+  protocol.on_idle();
+  ASSERT_EQ((size_t)P2P_TX_INVENTORY_MAX_KNOWN, p2p.m_announced[b.m_connection_id].size());
+  p2p.m_announced.clear();
+
+  r.txs.assign(std::prev(txs.end()), txs.end());
+  relay.relay_transactions(r, a);
+  protocol.on_idle();
+  ASSERT_EQ(std::vector<crypto::hash>(1, tx_hashes.back()), p2p.m_announced[b.m_connection_id]);
+  p2p.m_announced.clear();
+
+  // the second is still known to it, the first is not
+  r.txs.assign(std::next(txs.begin()), std::next(txs.begin(), 2));
+  relay.relay_transactions(r, a);
+  protocol.on_idle();
+  ASSERT_TRUE(p2p.m_announced.empty());
+
+  r.txs.assign(txs.begin(), std::next(txs.begin()));
+  relay.relay_transactions(r, a);
+  protocol.on_idle();
+  ASSERT_EQ(std::vector<crypto::hash>(1, tx_hashes.front()), p2p.m_announced[b.m_connection_id]);
+}
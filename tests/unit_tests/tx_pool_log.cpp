@@ -0,0 +1,162 @@
+// Copyright (c) 2014-2016, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <unordered_map>
+
+#include "cryptonote_core/tx_pool_log.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  typedef std::unordered_map<crypto::hash, std::pair<tx_pool_log_meta, blobdata>> log_contents;
+
+  crypto::hash make_hash(char c)
+  {
+    crypto::hash h;
+    memset(&h, c, sizeof(h));
+    return h;
+  }
+
+  tx_pool_log_meta make_meta(uint64_t fee)
+  {
+    tx_pool_log_meta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.fee = fee;
+    meta.receive_time = 1000 + fee;
+    return meta;
+  }
+
+  log_contents load(tx_pool_log& log, const std::string& path)
+  {
+    log_contents contents;
+    EXPECT_TRUE(log.open(path, [&](const crypto::hash& id, const tx_pool_log_meta& meta, const blobdata& blob) {
+      contents[id] = std::make_pair(meta, blob);
+    }));
+    return contents;
+  }
+
+  TEST(tx_pool_log, replays_adds_updates_and_removes)
+  {
+    const std::string path(tmpnam(NULL));
+    {
+      tx_pool_log log;
+      ASSERT_TRUE(load(log, path).empty());
+      ASSERT_TRUE(log.add_tx(make_hash(1), make_meta(1), "first"));
+      ASSERT_TRUE(log.add_tx(make_hash(2), make_meta(2), "second"));
+      ASSERT_TRUE(log.add_tx(make_hash(3), make_meta(3), "third"));
+      tx_pool_log_meta relayed = make_meta(2);
+      relayed.relayed = 1;
+      ASSERT_TRUE(log.update_tx(make_hash(2), relayed));
+      ASSERT_TRUE(log.remove_tx(make_hash(1)));
+    }
+
+    tx_pool_log log;
+    log_contents contents = load(log, path);
+    ASSERT_EQ(2, contents.size());
+    ASSERT_EQ(0, contents.count(make_hash(1)));
+    ASSERT_EQ("second", contents[make_hash(2)].second);
+    ASSERT_EQ(2, contents[make_hash(2)].first.fee);
+    ASSERT_EQ(1, contents[make_hash(2)].first.relayed);
+    ASSERT_EQ("third", contents[make_hash(3)].second);
+    ASSERT_EQ(0, contents[make_hash(3)].first.relayed);
+    log.close();
+    boost::filesystem::remove(path);
+  }
+
+  TEST(tx_pool_log, drops_torn_tail)
+  {
+    const std::string path(tmpnam(NULL));
+    {
+      tx_pool_log log;
+      load(log, path);
+      ASSERT_TRUE(log.add_tx(make_hash(1), make_meta(1), "first"));
+      ASSERT_TRUE(log.add_tx(make_hash(2), make_meta(2), "second"));
+    }
+
+    // cut the last record short, as a crash in the middle of a write would
+    const uint64_t size = boost::filesystem::file_size(path);
+    boost::filesystem::resize_file(path, size - 3);
+
+    {
+      tx_pool_log log;
+      log_contents contents = load(log, path);
+      ASSERT_EQ(1, contents.size());
+      ASSERT_EQ("first", contents[make_hash(1)].second);
+
+      // appending after the cut keeps the log readable
+      ASSERT_TRUE(log.add_tx(make_hash(3), make_meta(3), "third"));
+    }
+
+    tx_pool_log log;
+    log_contents contents = load(log, path);
+    ASSERT_EQ(2, contents.size());
+    ASSERT_EQ("third", contents[make_hash(3)].second);
+    log.close();
+    boost::filesystem::remove(path);
+  }
+
+  TEST(tx_pool_log, rewrite_keeps_only_given_txs)
+  {
+    const std::string path(tmpnam(NULL));
+    const blobdata big_blob(1024 * 1024, 'x');
+    {
+      tx_pool_log log;
+      load(log, path);
+      for (char c = 1; c <= 40; ++c)
+      {
+        ASSERT_TRUE(log.add_tx(make_hash(c), make_meta(c), big_blob));
+        if (c > 1)
+        {
+          ASSERT_TRUE(log.remove_tx(make_hash(c)));
+        }
+      }
+      ASSERT_TRUE(log.needs_compaction());
+
+      ASSERT_TRUE(log.start_rewrite());
+      ASSERT_TRUE(log.rewrite_tx(make_hash(1), make_meta(1), big_blob));
+      ASSERT_TRUE(log.finish_rewrite());
+      ASSERT_FALSE(log.needs_compaction());
+      ASSERT_LT(boost::filesystem::file_size(path), 2 * big_blob.size());
+
+      ASSERT_TRUE(log.add_tx(make_hash(50), make_meta(50), "after"));
+    }
+
+    tx_pool_log log;
+    log_contents contents = load(log, path);
+    ASSERT_EQ(2, contents.size());
+    ASSERT_EQ(big_blob, contents[make_hash(1)].second);
+    ASSERT_EQ("after", contents[make_hash(50)].second);
+    log.close();
+    boost::filesystem::remove(path);
+  }
+}